@@ -0,0 +1,160 @@
+/*
+ * intelli_plug hotplug decision logic.
+ *
+ * Copyright 2012 Paul Reioux
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Everything here is a pure function of its arguments so that the same
+ * code drives both the driver and the trace replay tool in
+ * tools/intelli_plug/, which builds it in userspace.
+ */
+#ifndef __ARCH_ARM_MACH_MSM_INTELLI_PLUG_POLICY_H
+#define __ARCH_ARM_MACH_MSM_INTELLI_PLUG_POLICY_H
+
+#ifndef FSHIFT
+#define FSHIFT		11	/* nr of bits of precision */
+#endif
+
+#define IP_NR_CORES			4
+
+#define DUAL_CORE_PERSISTENCE		60
+#define TRI_CORE_PERSISTENCE		50
+#define QUAD_CORE_PERSISTENCE		40
+
+/* poll periods an event-driven plug-up is held against the poll path */
+#define DEF_EVENT_HOLD_SAMPLES		4
+
+struct ip_tunables {
+	unsigned int eco_mode;
+	unsigned int event_hold_samples;
+};
+
+struct ip_state {
+	unsigned int nr_run_last;
+	unsigned int persist_count;
+	/* floor set by the event path and how many polls it lasts */
+	unsigned int hold_cores;
+	unsigned int hold_samples;
+};
+
+static const unsigned int ip_nr_run_thresholds_full[] = {
+/* 	1,  2,  3,  4 - on-line cpus target */
+	5,  7,  9,  UINT_MAX /* avg run threads * 2 (e.g., 9 = 2.25 threads) */
+	};
+
+static const unsigned int ip_nr_run_thresholds_eco[] = {
+/*      1,  2, - on-line cpus target */
+	3,  UINT_MAX /* avg run threads * 2 (e.g., 9 = 2.25 threads) */
+	};
+
+/*
+ * Map the averaged number of runnable threads (FSHIFT fixed point, as
+ * returned by avg_nr_running()) to a number of cores.
+ */
+static inline unsigned int ip_calculate_thread_stats(struct ip_state *s,
+		const struct ip_tunables *t, unsigned int avg_nr_run)
+{
+	const unsigned int *thresholds;
+	unsigned int threshold_size, nr_run_hysteresis, nr_fshift;
+	unsigned int nr_run;
+
+	if (!t->eco_mode) {
+		thresholds = ip_nr_run_thresholds_full;
+		threshold_size = ARRAY_SIZE(ip_nr_run_thresholds_full);
+		nr_run_hysteresis = 2;
+		nr_fshift = 3;
+	} else {
+		thresholds = ip_nr_run_thresholds_eco;
+		threshold_size = ARRAY_SIZE(ip_nr_run_thresholds_eco);
+		nr_run_hysteresis = 4;
+		nr_fshift = 1;
+	}
+
+	for (nr_run = 1; nr_run < threshold_size; nr_run++) {
+		unsigned int nr_threshold = thresholds[nr_run - 1];
+
+		if (s->nr_run_last <= nr_run)
+			nr_threshold += nr_run_hysteresis;
+		if (avg_nr_run <= (nr_threshold << (FSHIFT - nr_fshift)))
+			break;
+	}
+	s->nr_run_last = nr_run;
+
+	return nr_run;
+}
+
+/*
+ * Periodic decision: how many cores should be online given the average
+ * load and the number currently online.
+ */
+static inline unsigned int ip_poll_target(struct ip_state *s,
+		const struct ip_tunables *t, unsigned int avg_nr_run,
+		unsigned int online)
+{
+	unsigned int target;
+
+	switch (ip_calculate_thread_stats(s, t, avg_nr_run)) {
+	case 1:
+		if (s->persist_count > 0)
+			s->persist_count--;
+		target = online;
+		if (target == 2 && s->persist_count == 0)
+			target = 1;
+		if (t->eco_mode && target > 2)
+			target = 2;
+		break;
+	case 2:
+		s->persist_count = DUAL_CORE_PERSISTENCE;
+		target = 2;
+		break;
+	case 3:
+		s->persist_count = TRI_CORE_PERSISTENCE;
+		target = 3;
+		break;
+	default:
+		s->persist_count = QUAD_CORE_PERSISTENCE;
+		target = 4;
+		break;
+	}
+
+	if (s->hold_samples) {
+		s->hold_samples--;
+		if (target < s->hold_cores)
+			target = s->hold_cores;
+	}
+
+	return target;
+}
+
+/*
+ * Event decision on a run-queue spike: nr_running is the instantaneous
+ * number of runnable threads. Only ever adds cores; the poll path takes
+ * them away again once the hold expires.
+ */
+static inline unsigned int ip_event_target(struct ip_state *s,
+		const struct ip_tunables *t, unsigned int nr_running,
+		unsigned int online)
+{
+	unsigned int max = t->eco_mode ? 2 : IP_NR_CORES;
+	unsigned int target = nr_running < max ? nr_running : max;
+
+	if (target <= online)
+		return online;
+
+	s->hold_cores = target;
+	s->hold_samples = t->event_hold_samples;
+	if (s->persist_count < DUAL_CORE_PERSISTENCE)
+		s->persist_count = DUAL_CORE_PERSISTENCE;
+
+	return target;
+}
+
+#endif /* __ARCH_ARM_MACH_MSM_INTELLI_PLUG_POLICY_H */
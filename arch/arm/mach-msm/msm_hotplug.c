@@ -0,0 +1,934 @@
+/*
+ * Common cpu hotplug engine.
+ *
+ * Driver framework derived from Paul Reioux's intelli_plug and
+ * Christopher R. Palmer's simple_plug.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * The engine owns everything the hotplug drivers used to duplicate: the
+ * sampling work on cpu0, early suspend, bringing cores up and down and
+ * noticing when someone else changed them, and it gathers the inputs a
+ * policy decides on. Policies register a struct hotplug_policy and only
+ * map a struct hotplug_input to a number of cores. One policy is active
+ * at a time and can be switched at run time through
+ * /sys/kernel/msm_hotplug/policy; each keeps its own statistics so they
+ * can be compared under the same load.
+ */
+
+#define PR_NAME "msm_hotplug: "
+
+#include <linux/earlysuspend.h>
+#include <linux/workqueue.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/module.h>
+#include <linux/irq_work.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/input.h>
+#include <linux/slab.h>
+#include <linux/tick.h>
+#include <linux/rq_stats.h>
+
+#include "msm_hotplug.h"
+
+#define NUM_CORES			MSM_HOTPLUG_NR_CORES
+
+#define STARTUP_DELAY_MS		5000
+#define DEF_VERIFY_MS			120000
+#define DEF_RESUME_CORES		2
+#define DEF_BOOST_MS			0
+#define DEF_BOOST_CORES			2
+#define DEF_EVENT_MIN_INTERVAL_MS	20
+
+static DEFINE_MUTEX(hotplug_mutex);
+static LIST_HEAD(hotplug_policies);
+static struct hotplug_policy *active_policy;
+
+static struct delayed_work hotplug_work;
+static struct work_struct hotplug_event_work;
+static struct irq_work hotplug_irq_work;
+
+static unsigned int hotplug_enabled = 1;
+static unsigned int min_cores = 1;
+static unsigned int max_cores = NUM_CORES;
+static unsigned int sampling_ms;	/* 0: the policy's own */
+static unsigned int down_samples;
+static unsigned int resume_cores = DEF_RESUME_CORES;
+static unsigned int boost_ms = DEF_BOOST_MS;
+static unsigned int boost_cores = DEF_BOOST_CORES;
+static unsigned int event_min_interval_ms = DEF_EVENT_MIN_INTERVAL_MS;
+static unsigned int verify_ms = DEF_VERIFY_MS;
+
+static bool started;
+static bool suspended;
+static unsigned long event_next;
+static unsigned long boost_until;
+static u64 event_stamp;
+
+/* cores we last asked for, see hotplug_apply() */
+static unsigned int n_online;
+static unsigned int n_until_verify;
+static bool verify_needed;
+static unsigned int down_count;
+
+static u64 policy_since;
+
+/* last idle/wall times for the cpu_load input */
+static u64 prev_idle[NUM_CORES];
+static u64 prev_wall[NUM_CORES];
+
+static unsigned int hotplug_sampling_ms(void)
+{
+	return sampling_ms ? sampling_ms : active_policy->sampling_ms;
+}
+
+static void hotplug_schedule(unsigned int ms)
+{
+	schedule_delayed_work_on(0, &hotplug_work, msecs_to_jiffies(ms));
+}
+
+/* Restart sampling immediately, e.g. after switching policies */
+static void hotplug_reschedule(void)
+{
+	cancel_delayed_work(&hotplug_work);
+	hotplug_schedule(0);
+}
+
+/*
+ * Busiest online core since the previous sample, as a governor would
+ * compute it. Returns 0 without NO_HZ idle accounting.
+ */
+static unsigned int hotplug_cpu_load(void)
+{
+	unsigned int cpu, load, max_load = 0;
+	u64 idle, wall;
+
+	for_each_online_cpu(cpu) {
+		if (cpu >= NUM_CORES)
+			break;
+
+		idle = get_cpu_idle_time_us(cpu, &wall);
+		if (idle == -1ULL)
+			return 0;
+
+		if (wall > prev_wall[cpu] && prev_wall[cpu] &&
+		    idle >= prev_idle[cpu]) {
+			u64 dwall = wall - prev_wall[cpu];
+			u64 didle = idle - prev_idle[cpu];
+
+			if (didle > dwall)
+				didle = dwall;
+			load = div64_u64(100 * (dwall - didle), dwall);
+			if (load > max_load)
+				max_load = load;
+		}
+		prev_idle[cpu] = idle;
+		prev_wall[cpu] = wall;
+	}
+
+	return max_load;
+}
+
+static unsigned int hotplug_rq_avg(void)
+{
+	unsigned long flags;
+	unsigned int val;
+
+	if (rq_info.init != 1)
+		return 0;
+
+	spin_lock_irqsave(&rq_lock, flags);
+	val = rq_info.rq_avg;
+	spin_unlock_irqrestore(&rq_lock, flags);
+
+	return val;
+}
+
+static void hotplug_get_ewma(struct hotplug_input *in)
+{
+	struct rq_hist_cpu load;
+	int cpu, i;
+
+	memset(in->nr_run_ewma, 0, sizeof(in->nr_run_ewma));
+	for_each_online_cpu(cpu) {
+		if (rq_stats_load(cpu, &load))
+			return;
+		for (i = 0; i < RQ_EWMA_NR; i++)
+			in->nr_run_ewma[i] += load.nr_run[i];
+	}
+}
+
+static void hotplug_get_input(struct hotplug_input *in, bool event)
+{
+	in->online = num_online_cpus();
+	in->avg_nr_running = avg_nr_running();
+	in->nr_running = nr_running();
+	in->rq_avg = hotplug_rq_avg();
+	hotplug_get_ewma(in);
+	in->cpu_load = event ? 0 : hotplug_cpu_load();
+	in->boosted = boost_ms && time_before(jiffies, boost_until);
+	in->event = event;
+}
+
+/*
+ * Per-core online residency. Updated from the hotplug notifier so that
+ * cores plugged by anyone, not just us, are accounted.
+ */
+static DEFINE_SPINLOCK(residency_lock);
+static u64 residency_last;
+static u64 core_online_since[NUM_CORES];
+static u64 core_online_ms[NUM_CORES];
+static unsigned int core_ups[NUM_CORES];
+static unsigned int core_downs[NUM_CORES];
+static u64 nr_online_ms[NUM_CORES];
+
+static u64 residency_now(void)
+{
+	return div_u64(ktime_to_ns(ktime_get()), NSEC_PER_MSEC);
+}
+
+/* Called with residency_lock held */
+static void residency_update(u64 now, unsigned int online)
+{
+	if (online >= 1 && online <= NUM_CORES)
+		nr_online_ms[online - 1] += now - residency_last;
+	residency_last = now;
+}
+
+static int __cpuinit hotplug_cpu_callback(struct notifier_block *nfb,
+		unsigned long action, void *hcpu)
+{
+	unsigned int cpu = (unsigned long)hcpu;
+	unsigned long flags;
+	u64 now;
+
+	if (cpu >= NUM_CORES)
+		return NOTIFY_OK;
+
+	switch (action & ~CPU_TASKS_FROZEN) {
+	case CPU_ONLINE:
+		spin_lock_irqsave(&residency_lock, flags);
+		now = residency_now();
+		residency_update(now, num_online_cpus() - 1);
+		core_online_since[cpu] = now;
+		core_ups[cpu]++;
+		spin_unlock_irqrestore(&residency_lock, flags);
+		break;
+	case CPU_DEAD:
+		spin_lock_irqsave(&residency_lock, flags);
+		now = residency_now();
+		residency_update(now, num_online_cpus() + 1);
+		core_online_ms[cpu] += now - core_online_since[cpu];
+		core_downs[cpu]++;
+		spin_unlock_irqrestore(&residency_lock, flags);
+		break;
+	}
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block __refdata hotplug_cpu_notifier = {
+	.notifier_call = hotplug_cpu_callback,
+};
+
+static bool cpu_state_is_not_valid(int cpu)
+{
+	return (cpu < n_online && !cpu_online(cpu)) ||
+	       (cpu >= n_online && cpu_online(cpu));
+}
+
+/*
+ * Bring cores 0..target-1 online and the rest offline. If a core was
+ * changed behind our back, leave things alone for verify_ms and then
+ * force our view back with verify_cores().
+ */
+static void __cpuinit cpus_up_down(struct hotplug_policy *policy,
+				   unsigned int target)
+{
+	int cpu;
+
+	if (n_online == target)
+		return;
+
+	for (cpu = NUM_CORES - 1; cpu >= 0; cpu--) {
+		if (cpu_state_is_not_valid(cpu)) {
+			pr_info(PR_NAME "cpu%d state was externally changed, "
+				"scheduling verify\n", cpu);
+			verify_needed = true;
+			n_until_verify = DIV_ROUND_UP(verify_ms,
+						      hotplug_sampling_ms());
+			if (!n_until_verify)
+				n_until_verify = 1;
+			return;
+		}
+	}
+
+	for (cpu = 1; cpu < NUM_CORES; cpu++) {
+		if (cpu >= n_online && cpu < target) {
+			pr_debug(PR_NAME "starting cpu%d, want %u online\n",
+				 cpu, target);
+			if (cpu_up(cpu))
+				continue;
+			policy->stats.ups++;
+			if (policy->cpu_plugged)
+				policy->cpu_plugged(cpu);
+		}
+	}
+	for (cpu = NUM_CORES - 1; cpu > 0; cpu--) {
+		if (cpu >= target && cpu < n_online) {
+			pr_debug(PR_NAME "unplugging cpu%d, want %u online\n",
+				 cpu, target);
+			if (!cpu_down(cpu))
+				policy->stats.downs++;
+		}
+	}
+
+	n_online = num_online_cpus();
+}
+
+static void __cpuinit verify_cores(unsigned int target)
+{
+	int cpu;
+
+	for (cpu = 1; cpu < NUM_CORES; cpu++) {
+		if (cpu < target && !cpu_online(cpu)) {
+			pr_info(PR_NAME "re-plugging cpu%d that someone took "
+				"offline.\n", cpu);
+			cpu_up(cpu);
+		} else if (cpu >= target && cpu_online(cpu)) {
+			pr_info(PR_NAME "unplugging cpu%d that we want "
+				"offline\n", cpu);
+			cpu_down(cpu);
+		}
+	}
+
+	n_online = num_online_cpus();
+	verify_needed = false;
+}
+
+/*
+ * Clamp the policy's answer to the shared limits and apply the shared
+ * down hysteresis, then make it so. Called with hotplug_mutex held.
+ */
+static void __cpuinit hotplug_apply(struct hotplug_policy *policy,
+				    const struct hotplug_input *in,
+				    unsigned int target, u64 trigger_ns)
+{
+	u64 latency;
+
+	if (in->boosted && target < boost_cores)
+		target = boost_cores;
+	if (target > max_cores)
+		target = max_cores;
+	if (target < min_cores)
+		target = min_cores;
+	if (target < 1)
+		target = 1;
+	if (target > NUM_CORES)
+		target = NUM_CORES;
+
+	if (target < n_online && !in->event) {
+		if (++down_count <= down_samples)
+			target = n_online;
+		else
+			down_count = 0;
+	} else {
+		down_count = 0;
+	}
+
+	policy->stats.decisions++;
+
+	if (verify_needed) {
+		if (--n_until_verify == 0)
+			verify_cores(target);
+		return;
+	}
+	if (target == n_online)
+		return;
+
+	cpus_up_down(policy, target);
+
+	policy->stats.applied++;
+	latency = ktime_to_ns(ktime_get()) - trigger_ns;
+	policy->stats.latency_ns += latency;
+	if (latency > policy->stats.latency_max_ns)
+		policy->stats.latency_max_ns = latency;
+}
+
+static void __cpuinit hotplug_work_fn(struct work_struct *work)
+{
+	struct hotplug_input in;
+	struct hotplug_policy *policy;
+	u64 start = ktime_to_ns(ktime_get());
+
+	mutex_lock(&hotplug_mutex);
+	policy = active_policy;
+	if (hotplug_enabled && !suspended) {
+		hotplug_get_input(&in, false);
+		hotplug_apply(policy, &in, policy->decide(&in), start);
+	}
+	mutex_unlock(&hotplug_mutex);
+
+	hotplug_schedule(hotplug_sampling_ms());
+}
+
+static void __cpuinit hotplug_event_work_fn(struct work_struct *work)
+{
+	struct hotplug_input in;
+	struct hotplug_policy *policy;
+	unsigned int target;
+
+	mutex_lock(&hotplug_mutex);
+	policy = active_policy;
+	if (hotplug_enabled && !suspended) {
+		hotplug_get_input(&in, true);
+		target = policy->event ? policy->event(&in) : 0;
+		if (in.boosted && target < boost_cores)
+			target = boost_cores;
+		if (target > n_online)
+			hotplug_apply(policy, &in, target, event_stamp);
+	}
+	mutex_unlock(&hotplug_mutex);
+}
+
+static void hotplug_irq_work_fn(struct irq_work *work)
+{
+	schedule_work(&hotplug_event_work);
+}
+
+/*
+ * Called by the scheduler with the run-queue lock held whenever a task
+ * is queued behind another one, so keep it cheap: rate limit, then defer
+ * to irq_work and from there to process context for the actual hotplug.
+ */
+void msm_hotplug_rq_spike(void)
+{
+	unsigned long now = jiffies;
+
+	if (!started || !hotplug_enabled || suspended ||
+	    !active_policy->event)
+		return;
+	if (time_before(now, event_next))
+		return;
+	if (num_online_cpus() >= max_cores)
+		return;
+
+	event_next = now + msecs_to_jiffies(event_min_interval_ms);
+	if (irq_work_queue(&hotplug_irq_work))
+		event_stamp = ktime_to_ns(ktime_get());
+}
+
+/* Touch boost: keep boost_cores online for boost_ms after input */
+static void hotplug_input_event(struct input_handle *handle,
+		unsigned int type, unsigned int code, int value)
+{
+	unsigned long now = jiffies;
+
+	if (!boost_ms || !started || suspended)
+		return;
+
+	/* one kick per boost period is plenty */
+	if (time_before(now, boost_until))
+		return;
+	boost_until = now + msecs_to_jiffies(boost_ms);
+
+	if (num_online_cpus() < boost_cores) {
+		event_stamp = ktime_to_ns(ktime_get());
+		schedule_work(&hotplug_event_work);
+	}
+}
+
+static int input_dev_filter(const char *input_dev_name)
+{
+	if (strstr(input_dev_name, "touchscreen") ||
+		strstr(input_dev_name, "-keypad") ||
+		strstr(input_dev_name, "-nav") ||
+		strstr(input_dev_name, "-oj")) {
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+static int hotplug_input_connect(struct input_handler *handler,
+		struct input_dev *dev, const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
+
+	/* filter out those input_dev that we don't care */
+	if (input_dev_filter(dev->name))
+		return -ENODEV;
+
+	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "msm_hotplug";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err2;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err1;
+
+	return 0;
+err1:
+	input_unregister_handle(handle);
+err2:
+	kfree(handle);
+	return error;
+}
+
+static void hotplug_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id hotplug_ids[] = {
+	{ .driver_info = 1 },
+	{ },
+};
+
+static struct input_handler hotplug_input_handler = {
+	.event		= hotplug_input_event,
+	.connect	= hotplug_input_connect,
+	.disconnect	= hotplug_input_disconnect,
+	.name		= "msm_hotplug",
+	.id_table	= hotplug_ids,
+};
+
+/* Called with hotplug_mutex held */
+static void hotplug_account_active(u64 now)
+{
+	if (active_policy)
+		active_policy->stats.active_ns += now - policy_since;
+	policy_since = now;
+}
+
+static void hotplug_set_policy(struct hotplug_policy *policy)
+{
+	hotplug_account_active(ktime_to_ns(ktime_get()));
+	active_policy = policy;
+	down_count = 0;
+	if (policy->start)
+		policy->start();
+}
+
+int hotplug_register_policy(struct hotplug_policy *policy)
+{
+	if (!policy->name || !policy->decide || !policy->sampling_ms)
+		return -EINVAL;
+
+	mutex_lock(&hotplug_mutex);
+	list_add_tail(&policy->list, &hotplug_policies);
+	if (!active_policy)
+		hotplug_set_policy(policy);
+	mutex_unlock(&hotplug_mutex);
+
+	pr_info(PR_NAME "registered policy %s\n", policy->name);
+
+	return 0;
+}
+
+#ifdef CONFIG_HAS_EARLYSUSPEND
+static void __cpuinit hotplug_early_suspend(struct early_suspend *handler)
+{
+	cancel_delayed_work_sync(&hotplug_work);
+
+	mutex_lock(&hotplug_mutex);
+	suspended = true;
+	mutex_unlock(&hotplug_mutex);
+
+	irq_work_sync(&hotplug_irq_work);
+	cancel_work_sync(&hotplug_event_work);
+
+	/* put rest of the cores to sleep! */
+	mutex_lock(&hotplug_mutex);
+	verify_cores(1);
+	mutex_unlock(&hotplug_mutex);
+}
+
+static void __cpuinit hotplug_late_resume(struct early_suspend *handler)
+{
+	unsigned int cores;
+
+	mutex_lock(&hotplug_mutex);
+	suspended = false;
+	if (active_policy->start)
+		active_policy->start();
+
+	/* wake up cores early, there is usually plenty of resume work */
+	cores = min(resume_cores, max_cores);
+	if (hotplug_enabled && cores > 1)
+		verify_cores(cores);
+	mutex_unlock(&hotplug_mutex);
+
+	hotplug_schedule(10);
+}
+
+static struct early_suspend hotplug_early_suspend_struct_driver = {
+	.level = EARLY_SUSPEND_LEVEL_DISABLE_FB + 10,
+	.suspend = hotplug_early_suspend,
+	.resume = hotplug_late_resume,
+};
+#endif	/* CONFIG_HAS_EARLYSUSPEND */
+
+/* /sys/kernel/msm_hotplug */
+
+#define show_one(name)							\
+static ssize_t show_##name(struct kobject *kobj,			\
+		struct kobj_attribute *attr, char *buf)			\
+{									\
+	return sprintf(buf, "%u\n", name);				\
+}
+
+#define store_one(name, min, max)					\
+static ssize_t store_##name(struct kobject *kobj,			\
+		struct kobj_attribute *attr, const char *buf,		\
+		size_t count)						\
+{									\
+	unsigned int val;						\
+									\
+	if (kstrtouint(buf, 0, &val) || val < (min) || val > (max))	\
+		return -EINVAL;						\
+									\
+	mutex_lock(&hotplug_mutex);					\
+	name = val;							\
+	mutex_unlock(&hotplug_mutex);					\
+	return count;							\
+}
+
+#define hotplug_attr_rw(name, min, max)					\
+show_one(name)								\
+store_one(name, min, max)						\
+static struct kobj_attribute name##_attr =				\
+	__ATTR(name, 0644, show_##name, store_##name)
+
+hotplug_attr_rw(min_cores, 1, NUM_CORES);
+hotplug_attr_rw(max_cores, 1, NUM_CORES);
+hotplug_attr_rw(down_samples, 0, 1000);
+hotplug_attr_rw(resume_cores, 1, NUM_CORES);
+hotplug_attr_rw(boost_ms, 0, 10000);
+hotplug_attr_rw(boost_cores, 1, NUM_CORES);
+hotplug_attr_rw(event_min_interval_ms, 0, 1000);
+hotplug_attr_rw(verify_ms, 0, UINT_MAX);
+
+static ssize_t show_enabled(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", hotplug_enabled);
+}
+
+static ssize_t store_enabled(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val))
+		return -EINVAL;
+
+	mutex_lock(&hotplug_mutex);
+	hotplug_enabled = !!val;
+	/* our view of the cores is stale after being disabled */
+	if (hotplug_enabled)
+		n_online = num_online_cpus();
+	mutex_unlock(&hotplug_mutex);
+
+	return count;
+}
+
+static struct kobj_attribute enabled_attr =
+	__ATTR(enabled, 0644, show_enabled, store_enabled);
+
+static ssize_t show_sampling_ms(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	unsigned int val;
+
+	mutex_lock(&hotplug_mutex);
+	val = hotplug_sampling_ms();
+	mutex_unlock(&hotplug_mutex);
+
+	return sprintf(buf, "%u\n", val);
+}
+
+/* 0 goes back to the active policy's default */
+static ssize_t store_sampling_ms(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val) || val > 10000)
+		return -EINVAL;
+
+	mutex_lock(&hotplug_mutex);
+	sampling_ms = val;
+	mutex_unlock(&hotplug_mutex);
+
+	return count;
+}
+
+static struct kobj_attribute sampling_ms_attr =
+	__ATTR(sampling_ms, 0644, show_sampling_ms, store_sampling_ms);
+
+static ssize_t show_policy(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	struct hotplug_policy *policy;
+	ssize_t sz = 0;
+
+	mutex_lock(&hotplug_mutex);
+	list_for_each_entry(policy, &hotplug_policies, list) {
+		if (policy == active_policy)
+			sz += sprintf(buf + sz, "[%s] ", policy->name);
+		else
+			sz += sprintf(buf + sz, "%s ", policy->name);
+	}
+	mutex_unlock(&hotplug_mutex);
+
+	if (sz)
+		buf[sz - 1] = '\n';
+
+	return sz;
+}
+
+static ssize_t store_policy(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct hotplug_policy *policy;
+	char name[16];
+	int ret = -EINVAL;
+
+	strlcpy(name, buf, sizeof(name));
+	strim(name);
+
+	mutex_lock(&hotplug_mutex);
+	list_for_each_entry(policy, &hotplug_policies, list) {
+		if (!strcmp(policy->name, name)) {
+			if (policy != active_policy)
+				hotplug_set_policy(policy);
+			ret = count;
+			break;
+		}
+	}
+	mutex_unlock(&hotplug_mutex);
+
+	if (ret > 0 && started)
+		hotplug_reschedule();
+
+	return ret;
+}
+
+static struct kobj_attribute policy_attr =
+	__ATTR(policy, 0644, show_policy, store_policy);
+
+static ssize_t show_stats(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	struct hotplug_policy *policy;
+	ssize_t sz;
+
+	mutex_lock(&hotplug_mutex);
+	hotplug_account_active(ktime_to_ns(ktime_get()));
+
+	sz = sprintf(buf, "%-12s %10s %10s %8s %8s %12s %12s\n", "policy",
+		     "active_ms", "decisions", "ups", "downs",
+		     "avg_lat_us", "max_lat_us");
+	list_for_each_entry(policy, &hotplug_policies, list) {
+		struct hotplug_policy_stats *st = &policy->stats;
+
+		sz += sprintf(buf + sz, "%-12s %10llu %10u %8u %8u %12llu "
+			      "%12llu\n", policy->name,
+			      div_u64(st->active_ns, NSEC_PER_MSEC),
+			      st->decisions, st->ups, st->downs,
+			      st->applied ? div_u64(st->latency_ns,
+					st->applied * NSEC_PER_USEC) : 0,
+			      div_u64(st->latency_max_ns, NSEC_PER_USEC));
+	}
+	mutex_unlock(&hotplug_mutex);
+
+	return sz;
+}
+
+static ssize_t store_stats(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct hotplug_policy *policy;
+
+	mutex_lock(&hotplug_mutex);
+	hotplug_account_active(ktime_to_ns(ktime_get()));
+	list_for_each_entry(policy, &hotplug_policies, list)
+		memset(&policy->stats, 0, sizeof(policy->stats));
+	mutex_unlock(&hotplug_mutex);
+
+	return count;
+}
+
+static struct kobj_attribute stats_attr =
+	__ATTR(stats, 0644, show_stats, store_stats);
+
+static struct attribute *hotplug_attrs[] = {
+	&enabled_attr.attr,
+	&policy_attr.attr,
+	&sampling_ms_attr.attr,
+	&min_cores_attr.attr,
+	&max_cores_attr.attr,
+	&down_samples_attr.attr,
+	&resume_cores_attr.attr,
+	&boost_ms_attr.attr,
+	&boost_cores_attr.attr,
+	&event_min_interval_ms_attr.attr,
+	&verify_ms_attr.attr,
+	&stats_attr.attr,
+	NULL,
+};
+
+static struct attribute_group hotplug_attr_group = {
+	.attrs = hotplug_attrs,
+};
+
+#ifdef CONFIG_DEBUG_FS
+static int residency_show(struct seq_file *s, void *unused)
+{
+	unsigned long flags;
+	u64 online_ms[NUM_CORES], n_ms[NUM_CORES], now;
+	unsigned int ups[NUM_CORES], downs[NUM_CORES];
+	int cpu;
+
+	spin_lock_irqsave(&residency_lock, flags);
+	now = residency_now();
+	residency_update(now, num_online_cpus());
+	for (cpu = 0; cpu < NUM_CORES; cpu++) {
+		online_ms[cpu] = core_online_ms[cpu];
+		if (cpu_online(cpu))
+			online_ms[cpu] += now - core_online_since[cpu];
+		n_ms[cpu] = nr_online_ms[cpu];
+		ups[cpu] = core_ups[cpu];
+		downs[cpu] = core_downs[cpu];
+	}
+	spin_unlock_irqrestore(&residency_lock, flags);
+
+	seq_printf(s, "%-4s %12s %8s %8s\n", "cpu", "online_ms", "ups",
+		   "downs");
+	for (cpu = 0; cpu < NUM_CORES; cpu++)
+		seq_printf(s, "%-4d %12llu %8u %8u\n", cpu, online_ms[cpu],
+			   ups[cpu], downs[cpu]);
+
+	seq_printf(s, "\n%-6s %12s\n", "online", "time_ms");
+	for (cpu = 0; cpu < NUM_CORES; cpu++)
+		seq_printf(s, "%-6d %12llu\n", cpu + 1, n_ms[cpu]);
+
+	return 0;
+}
+
+static int residency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, residency_show, NULL);
+}
+
+static const struct file_operations residency_fops = {
+	.open		= residency_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void hotplug_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("msm_hotplug", NULL);
+	if (!dir)
+		return;
+
+	debugfs_create_file("residency", S_IRUGO, dir, NULL, &residency_fops);
+}
+#else
+static void hotplug_debugfs_init(void) { }
+#endif
+
+static void hotplug_residency_init(void)
+{
+	int cpu;
+	u64 now = residency_now();
+
+	residency_last = now;
+	for_each_online_cpu(cpu)
+		if (cpu < NUM_CORES)
+			core_online_since[cpu] = now;
+
+	register_hotcpu_notifier(&hotplug_cpu_notifier);
+	hotplug_debugfs_init();
+}
+
+static int __init msm_hotplug_init(void)
+{
+	struct kobject *kobj;
+	int ret;
+
+	/* policies register from their own initcalls, before this one */
+	if (!active_policy) {
+		pr_info(PR_NAME "no policy registered\n");
+		return 0;
+	}
+
+	hotplug_residency_init();
+
+	kobj = kobject_create_and_add("msm_hotplug", kernel_kobj);
+	if (kobj) {
+		ret = sysfs_create_group(kobj, &hotplug_attr_group);
+		if (ret)
+			pr_err(PR_NAME "failed to create sysfs group\n");
+	}
+
+	ret = input_register_handler(&hotplug_input_handler);
+	if (ret)
+		pr_err(PR_NAME "failed to register input handler\n");
+
+#ifdef CONFIG_HAS_EARLYSUSPEND
+	register_early_suspend(&hotplug_early_suspend_struct_driver);
+#endif
+
+	n_online = num_online_cpus();
+	INIT_DELAYED_WORK(&hotplug_work, hotplug_work_fn);
+	INIT_WORK(&hotplug_event_work, hotplug_event_work_fn);
+	init_irq_work(&hotplug_irq_work, hotplug_irq_work_fn);
+	smp_wmb();
+	started = true;
+
+	/*
+	 * hack-o-rama: there is a race with the PM module starting
+	 * and this starting.  If you try to turn cores off before the PM
+	 * is initialized, it will crash.  The race window seems to be in the
+	 * order 10s of ms, so 5 seconds gives tons of time for it to
+	 * resolve itself.
+	 */
+	hotplug_schedule(STARTUP_DELAY_MS);
+
+	return 0;
+}
+
+MODULE_DESCRIPTION("Common cpu hotplug engine for pluggable policies");
+MODULE_LICENSE("GPL");
+
+late_initcall_sync(msm_hotplug_init);
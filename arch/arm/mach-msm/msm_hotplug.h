@@ -0,0 +1,73 @@
+/*
+ * Common cpu hotplug engine for the intelli_plug and simple_plug policies.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __ARCH_ARM_MACH_MSM_MSM_HOTPLUG_H
+#define __ARCH_ARM_MACH_MSM_MSM_HOTPLUG_H
+
+#include <linux/list.h>
+#include <linux/types.h>
+#include <linux/rq_stats.h>
+
+#define MSM_HOTPLUG_NR_CORES	4
+
+/*
+ * What a policy gets to look at on each decision. Filled in by the core
+ * so that every policy sees exactly the same inputs.
+ */
+struct hotplug_input {
+	unsigned int online;		/* cores online now */
+	unsigned int avg_nr_running;	/* FSHIFT fixed point */
+	unsigned int nr_running;	/* instantaneous */
+	unsigned int rq_avg;		/* msm_rq_stats x10, 0 if disabled */
+	/* msm_rq_stats load history summed over cpus, 0 if disabled */
+	u32 nr_run_ewma[RQ_EWMA_NR];
+	unsigned int cpu_load;		/* busiest online core since last
+					   sample, in percent */
+	bool boosted;			/* touch input within boost_ms */
+	bool event;			/* run-queue spike, not a poll */
+};
+
+struct hotplug_policy_stats {
+	u64 active_ns;
+	unsigned int decisions;
+	unsigned int applied;		/* decisions that changed cores */
+	unsigned int ups;
+	unsigned int downs;
+	u64 latency_ns;			/* trigger to cores plugged, summed */
+	u64 latency_max_ns;
+};
+
+struct hotplug_policy {
+	const char *name;
+	unsigned int sampling_ms;
+
+	/* Return the number of cores wanted online. Required. */
+	unsigned int (*decide)(const struct hotplug_input *in);
+	/*
+	 * Optional: run-queue spike. Return the number of cores wanted,
+	 * or 0 to ignore it. Policies without it only ever get polled.
+	 */
+	unsigned int (*event)(const struct hotplug_input *in);
+	/* Optional: policy became active or the screen came back on. */
+	void (*start)(void);
+	/* Optional: cpu was just plugged on behalf of this policy. */
+	void (*cpu_plugged)(unsigned int cpu);
+
+	/* private to msm_hotplug.c */
+	struct list_head list;
+	struct hotplug_policy_stats stats;
+};
+
+int hotplug_register_policy(struct hotplug_policy *policy);
+
+#endif /* __ARCH_ARM_MACH_MSM_MSM_HOTPLUG_H */
@@ -26,6 +26,9 @@
 #include <linux/sched.h>
 #include <linux/spinlock.h>
 #include <linux/rq_stats.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/vmalloc.h>
 #include <asm/smp_plat.h>
 
 #define MAX_LONG_SIZE 24
@@ -44,6 +47,259 @@ static void def_work_fn(struct work_struct *work)
 	sysfs_notify(rq_info.kobj, NULL, "def_timer_ms");
 }
 
+/*
+ * Load history, see linux/rq_stats.h.
+ *
+ * The history is written from the tick on the cpu doing jiffies updates,
+ * serialized by rq_hist_lock, and read without locks: each entry carries
+ * the sequence number of the sample it holds, odd while it is being
+ * written, so readers can tell a stale or torn entry and skip it.
+ */
+static DEFINE_SPINLOCK(rq_hist_lock);
+static struct rq_hist_entry rq_hist[RQ_HIST_SIZE];
+static u32 rq_hist_head;		/* samples written so far */
+static unsigned long rq_hist_last_jiffy;
+static struct rq_hist_cpu rq_ewma[NR_CPUS];
+static const unsigned int rq_ewma_shift[RQ_EWMA_NR] = RQ_EWMA_SHIFTS;
+
+/* Fold @ticks samples of value @val into @avg */
+static u32 rq_ewma_update(u32 avg, u32 val, unsigned int shift,
+			  unsigned long ticks)
+{
+	/* after this many samples the old average has decayed away */
+	if (ticks > (4UL << shift))
+		return val;
+
+	while (ticks--) {
+		if (val >= avg)
+			avg += (val - avg) >> shift;
+		else
+			avg -= (avg - val) >> shift;
+	}
+
+	return avg;
+}
+
+void rq_stats_update_history(void)
+{
+	unsigned long ticks;
+	struct rq_hist_entry *e;
+	unsigned int cpu, i;
+	u32 n;
+
+	spin_lock(&rq_hist_lock);
+
+	ticks = jiffies - rq_hist_last_jiffy;
+	if (!ticks) {
+		spin_unlock(&rq_hist_lock);
+		return;
+	}
+	rq_hist_last_jiffy = jiffies;
+
+	for_each_possible_cpu(cpu) {
+		u32 nr_run = 0, iowait = 0;
+
+		if (cpu_online(cpu)) {
+			nr_run = nr_running_cpu(cpu) << FSHIFT;
+			iowait = nr_iowait_cpu(cpu) << FSHIFT;
+		}
+
+		for (i = 0; i < RQ_EWMA_NR; i++) {
+			u32 avg = rq_ewma[cpu].nr_run[i];
+
+			/*
+			 * Missed ticks mean the jiffies cpu was idle with
+			 * NO_HZ, and another cpu would have taken over the
+			 * tick if it had work, so count them as idle.
+			 */
+			if (ticks > 1)
+				avg = rq_ewma_update(avg, 0, rq_ewma_shift[i],
+						     ticks - 1);
+			rq_ewma[cpu].nr_run[i] =
+				rq_ewma_update(avg, nr_run, rq_ewma_shift[i], 1);
+			rq_ewma[cpu].iowait[i] =
+				rq_ewma_update(rq_ewma[cpu].iowait[i], iowait,
+					       rq_ewma_shift[i], ticks);
+		}
+	}
+
+	n = rq_hist_head;
+	e = &rq_hist[n % RQ_HIST_SIZE];
+
+	e->seq = 2 * n + 1;
+	smp_wmb();
+	e->jiffies = (u32)jiffies;
+	memcpy(e->cpu, rq_ewma, sizeof(e->cpu));
+	smp_wmb();
+	e->seq = 2 * n + 2;
+	smp_wmb();
+	rq_hist_head = n + 1;
+
+	spin_unlock(&rq_hist_lock);
+}
+
+/* Copy sample @n into @buf. Returns false if it was overwritten. */
+static bool rq_hist_read(u32 n, struct rq_hist_entry *buf)
+{
+	const struct rq_hist_entry *e = &rq_hist[n % RQ_HIST_SIZE];
+	u32 seq;
+
+	seq = ACCESS_ONCE(e->seq);
+	smp_rmb();
+	if (seq != 2 * n + 2)
+		return false;
+
+	memcpy(buf, e, sizeof(*buf));
+	smp_rmb();
+
+	return ACCESS_ONCE(e->seq) == seq;
+}
+
+/**
+ * rq_stats_history - copy the most recent load history
+ * @buf: array of at least @n entries
+ * @n: number of entries wanted, at most RQ_HIST_SIZE
+ *
+ * Fills @buf oldest first. Safe from any context. Returns the number of
+ * entries copied, which is less than @n early after boot or if the
+ * writer lapped us.
+ */
+int rq_stats_history(struct rq_hist_entry *buf, int n)
+{
+	u32 head, first, i;
+	int copied = 0;
+
+	if (n > RQ_HIST_SIZE)
+		n = RQ_HIST_SIZE;
+	if (n <= 0)
+		return 0;
+
+	head = ACCESS_ONCE(rq_hist_head);
+	smp_rmb();
+	if (head < n)
+		n = head;
+	first = head - n;
+
+	for (i = first; i < head; i++)
+		if (rq_hist_read(i, &buf[copied]))
+			copied++;
+
+	return copied;
+}
+EXPORT_SYMBOL_GPL(rq_stats_history);
+
+/**
+ * rq_stats_load - latest load averages of a cpu
+ * @cpu: cpu to look up
+ * @load: filled with the run-queue and iowait averages
+ *
+ * Returns 0, or -EAGAIN if there is no sample yet.
+ */
+int rq_stats_load(int cpu, struct rq_hist_cpu *load)
+{
+	struct rq_hist_entry e;
+
+	if (cpu < 0 || cpu >= NR_CPUS)
+		return -EINVAL;
+	if (!rq_stats_history(&e, 1))
+		return -EAGAIN;
+
+	*load = e.cpu[cpu];
+	return 0;
+}
+EXPORT_SYMBOL_GPL(rq_stats_load);
+
+#ifdef CONFIG_DEBUG_FS
+/*
+ * debugfs rq_stats/load_history: a struct rq_hist_file_header followed
+ * by header.count struct rq_hist_entry, oldest first, snapshotted when
+ * the file is opened.
+ */
+struct rq_hist_file_header {
+	u32 version;
+	u32 entry_size;
+	u32 count;
+	u32 nr_cpus;
+	u32 nr_ewma;
+	u32 fshift;
+	u32 tick_hz;
+	u32 ewma_shift[RQ_EWMA_NR];
+};
+
+#define RQ_HIST_FILE_VERSION	1
+
+struct rq_hist_snapshot {
+	size_t size;
+	struct rq_hist_file_header hdr;
+	struct rq_hist_entry entries[RQ_HIST_SIZE];
+};
+
+static int load_history_open(struct inode *inode, struct file *file)
+{
+	struct rq_hist_snapshot *snap;
+	int i;
+
+	snap = vmalloc(sizeof(*snap));
+	if (!snap)
+		return -ENOMEM;
+
+	snap->hdr.version = RQ_HIST_FILE_VERSION;
+	snap->hdr.entry_size = sizeof(struct rq_hist_entry);
+	snap->hdr.count = rq_stats_history(snap->entries, RQ_HIST_SIZE);
+	snap->hdr.nr_cpus = NR_CPUS;
+	snap->hdr.nr_ewma = RQ_EWMA_NR;
+	snap->hdr.fshift = FSHIFT;
+	snap->hdr.tick_hz = HZ;
+	for (i = 0; i < RQ_EWMA_NR; i++)
+		snap->hdr.ewma_shift[i] = rq_ewma_shift[i];
+
+	for (i = 0; i < snap->hdr.count; i++)
+		snap->entries[i].seq = 0;
+
+	snap->size = sizeof(snap->hdr) +
+		snap->hdr.count * sizeof(struct rq_hist_entry);
+	file->private_data = snap;
+
+	return 0;
+}
+
+static ssize_t load_history_read(struct file *file, char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	struct rq_hist_snapshot *snap = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, &snap->hdr,
+				       snap->size);
+}
+
+static int load_history_release(struct inode *inode, struct file *file)
+{
+	vfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations load_history_fops = {
+	.open		= load_history_open,
+	.read		= load_history_read,
+	.llseek		= default_llseek,
+	.release	= load_history_release,
+};
+
+static void init_rq_debugfs(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("rq_stats", NULL);
+	if (!dir)
+		return;
+
+	debugfs_create_file("load_history", S_IRUSR, dir, NULL,
+			    &load_history_fops);
+}
+#else
+static void init_rq_debugfs(void) { }
+#endif
+
 static ssize_t run_queue_avg_show(struct kobject *kobj,
 		struct kobj_attribute *attr, char *buf)
 {
@@ -173,6 +429,7 @@ static int __init msm_rq_stats_init(void)
 	rq_info.rq_poll_last_jiffy = 0;
 	rq_info.def_timer_last_jiffy = 0;
 	ret = init_rq_attribs();
+	init_rq_debugfs();
 
 	rq_info.init = 1;
 	return ret;
@@ -58,6 +58,8 @@
 #include <linux/cgroup.h>
 #include <linux/elevator.h>
 #include <linux/jiffies.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
 #include <linux/rbtree.h>
 #include <linux/ioprio.h>
 #include "bfq.h"
@@ -75,8 +77,8 @@ static const int bfq_back_max = 16 * 1024;
 /* Penalty of a backwards seek, in number of sectors. */
 static const int bfq_back_penalty = 2;
 
-/* Idling period duration, in jiffies. */
-static int bfq_slice_idle = HZ / 125;
+/* Idling period duration, in ns. */
+static const u64 bfq_slice_idle = NSEC_PER_SEC / 125;
 
 /* Default maximum budget values, in sectors and number of requests. */
 static const int bfq_default_max_budget = 16 * 1024;
@@ -89,14 +91,18 @@ static const int bfq_max_budget_async_rq = 4;
  */
 static const int bfq_async_charge_factor = 10;
 
-/* Default timeout values, in jiffies, approximating CFQ defaults. */
-static const int bfq_timeout_sync = HZ / 8;
-static int bfq_timeout_async = HZ / 25;
+/*
+ * Default timeout values, in ns, approximating CFQ defaults. Idling and
+ * budget timeouts are kept in ns and the idle timer is an hrtimer, so that
+ * they do not truncate to zero or to a whole tick at low HZ.
+ */
+static const u64 bfq_timeout_sync = NSEC_PER_SEC / 8;
+static const u64 bfq_timeout_async = NSEC_PER_SEC / 25;
 
 struct kmem_cache *bfq_pool;
 
-/* Below this threshold (in ms), we consider thinktime immediate. */
-#define BFQ_MIN_TT		2
+/* Below this threshold (in ns), we consider thinktime immediate. */
+#define BFQ_MIN_TT		(2 * NSEC_PER_MSEC)
 
 /* hw_tag detection: parallel requests threshold and min samples needed. */
 #define BFQ_HW_QUEUE_THRESHOLD	4
@@ -117,6 +123,16 @@ struct kmem_cache *bfq_pool;
 #define RQ_BIC(rq)		((struct bfq_io_cq *) (rq)->elv.priv[0])
 #define RQ_BFQQ(rq)		((rq)->elv.priv[1])
 
+static inline u64 bfq_now_ns(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static inline u64 bfq_jiffies_to_ns(unsigned long j)
+{
+	return (u64)jiffies_to_usecs(j) * NSEC_PER_USEC;
+}
+
 #include "bfq-ioc.c"
 #include "bfq-sched.c"
 #include "bfq-cgroup.c"
@@ -410,6 +426,83 @@ static void bfq_updated_next_req(struct bfq_data *bfqd,
 	bfq_activate_bfqq(bfqd, bfqq);
 }
 
+static const char * const bfq_raising_reasons[BFQ_RAISING_NR] = {
+	[BFQ_RAISING_NEW] = "new",
+	[BFQ_RAISING_IDLE] = "idle",
+	[BFQ_RAISING_SOFT_RT] = "soft_rt",
+	[BFQ_RAISING_ASYNC] = "async",
+};
+
+static void bfq_raising_start(struct bfq_data *bfqd, struct bfq_queue *bfqq,
+			      enum bfq_raising_reason reason,
+			      unsigned int max_time)
+{
+	bfqq->raising_coeff = bfqd->bfq_raising_coeff;
+	bfqq->raising_cur_max_time = max_time;
+	bfqq->raising_reason = reason;
+	bfqq->raising_since = jiffies;
+	bfqq->raising_periods++;
+	bfqd->raising_started[reason]++;
+}
+
+static void bfq_raising_end(struct bfq_data *bfqd, struct bfq_queue *bfqq)
+{
+	bfqq->raising_coeff = 1;
+	bfqq->raising_time += jiffies - bfqq->raising_since;
+	bfqd->raising_ended++;
+}
+
+/*
+ * Launching an application typically makes it, and whatever it starts,
+ * create many sync queues in a short time.  If they all got weight-raised
+ * they would just compete with each other, and with the interactive
+ * queues the raising is meant for, so the queues of a large burst are not
+ * raised as new or idle queues.  Called on the first activation of a sync
+ * queue, with the queue lock held.
+ */
+static void bfq_handle_burst(struct bfq_data *bfqd, struct bfq_queue *bfqq)
+{
+	struct bfq_queue *item;
+	struct hlist_node *pos, *n;
+
+	bfq_clear_bfqq_just_created(bfqq);
+	if (bfqd->bfq_raising_large_burst == 0 || bfqq == &bfqd->oom_bfqq)
+		return;
+
+	if (time_is_before_jiffies(bfqd->last_ins_in_burst +
+				   bfqd->bfq_raising_burst_interval)) {
+		/* too late, a new burst starts with this queue */
+		hlist_for_each_entry_safe(item, pos, n, &bfqd->burst_list,
+					  burst_list_node)
+			hlist_del_init(&item->burst_list_node);
+		bfqd->burst_size = 0;
+		bfqd->large_burst = false;
+	}
+	bfqd->last_ins_in_burst = jiffies;
+
+	if (bfqd->large_burst) {
+		bfq_mark_bfqq_in_large_burst(bfqq);
+		return;
+	}
+
+	bfqd->burst_size++;
+	if (bfqd->burst_size < bfqd->bfq_raising_large_burst) {
+		hlist_add_head(&bfqq->burst_list_node, &bfqd->burst_list);
+		return;
+	}
+
+	/* the burst has just become large, mark all of its queues */
+	bfqd->large_burst = true;
+	bfqd->large_bursts++;
+	bfq_mark_bfqq_in_large_burst(bfqq);
+	hlist_for_each_entry_safe(item, pos, n, &bfqd->burst_list,
+				  burst_list_node) {
+		bfq_mark_bfqq_in_large_burst(item);
+		hlist_del_init(&item->burst_list_node);
+	}
+	bfq_log(bfqd, "large burst of %u queues", bfqd->burst_size);
+}
+
 static void bfq_add_rq_rb(struct request *rq)
 {
 	struct bfq_queue *bfqq = RQ_BFQQ(rq);
@@ -418,7 +511,8 @@ static void bfq_add_rq_rb(struct request *rq)
 	struct request *next_rq, *prev;
 	unsigned long old_raising_coeff = bfqq->raising_coeff;
 	int idle_for_long_time = bfqq->budget_timeout +
-		bfqd->bfq_raising_min_idle_time < jiffies;
+		bfq_jiffies_to_ns(bfqd->bfq_raising_min_idle_time) <
+		bfq_now_ns();
 
 	bfq_log_bfqq(bfqd, bfqq, "add_rq_rb %d", rq_is_sync(rq));
 	bfqq->queued[rq_is_sync(rq)]++;
@@ -443,21 +537,42 @@ static void bfq_add_rq_rb(struct request *rq)
 	if (!bfq_bfqq_busy(bfqq)) {
 		int soft_rt = bfqd->bfq_raising_max_softrt_rate > 0 &&
 			bfqq->soft_rt_next_start < jiffies;
+		int just_created = bfq_bfqq_just_created(bfqq);
+		int raise_idle;
+
 		entity->budget = max_t(unsigned long, bfqq->max_budget,
 				       bfq_serv_to_charge(next_rq, bfqq));
 
 		if (! bfqd->low_latency)
 			goto add_bfqq_busy;
 
+		if (just_created)
+			bfq_handle_burst(bfqd, bfqq);
+		/*
+		 * Queues created in a large burst keep only the soft
+		 * real-time raising, see bfq_handle_burst().
+		 */
+		raise_idle = idle_for_long_time;
+		if (bfq_bfqq_in_large_burst(bfqq) && raise_idle) {
+			if (old_raising_coeff == 1)
+				bfqd->burst_not_raised++;
+			raise_idle = 0;
+		}
+
 		/*
 		 * If the queue is not being boosted and has been idle
 		 * for enough time, start a weight-raising period
 		 */
-		if(old_raising_coeff == 1 && (idle_for_long_time || soft_rt)) {
-			bfqq->raising_coeff = bfqd->bfq_raising_coeff;
-			bfqq->raising_cur_max_time = idle_for_long_time ?
-				bfqd->bfq_raising_max_time :
-				bfqd->bfq_raising_rt_max_time;
+		if(old_raising_coeff == 1 && (raise_idle || soft_rt)) {
+			if (raise_idle)
+				bfq_raising_start(bfqd, bfqq, just_created ?
+						  BFQ_RAISING_NEW :
+						  BFQ_RAISING_IDLE,
+						  bfqd->bfq_raising_max_time);
+			else
+				bfq_raising_start(bfqd, bfqq,
+						  BFQ_RAISING_SOFT_RT,
+						  bfqd->bfq_raising_rt_max_time);
 			bfq_log_bfqq(bfqd, bfqq,
 				     "wrais starting at %llu msec,"
 				     "rais_max_time %u",
@@ -465,13 +580,18 @@ static void bfq_add_rq_rb(struct request *rq)
 				     jiffies_to_msecs(bfqq->
 					raising_cur_max_time));
 		} else if (old_raising_coeff > 1) {
-			if (idle_for_long_time)
+			if (bfq_bfqq_in_large_burst(bfqq) &&
+			    bfqq->raising_reason != BFQ_RAISING_SOFT_RT) {
+				bfq_raising_end(bfqd, bfqq);
+				bfq_log_bfqq(bfqd, bfqq,
+					     "wrais ending, large burst");
+			} else if (raise_idle)
 				bfqq->raising_cur_max_time =
 					bfqd->bfq_raising_max_time;
 			else if (bfqq->raising_cur_max_time ==
 				 bfqd->bfq_raising_rt_max_time &&
 				 !soft_rt) {
-				bfqq->raising_coeff = 1;
+				bfq_raising_end(bfqd, bfqq);
 				bfq_log_bfqq(bfqd, bfqq,
 					     "wrais ending at %llu msec,"
 					     "rais_max_time %u",
@@ -485,12 +605,12 @@ static void bfq_add_rq_rb(struct request *rq)
 add_bfqq_busy:
 		bfq_add_bfqq_busy(bfqd, bfqq);
         } else {
-                if(bfqd->low_latency && old_raising_coeff == 1 &&
-			!rq_is_sync(rq) &&
+                if(bfqd->low_latency && bfqd->bfq_raising_async &&
+			old_raising_coeff == 1 && !rq_is_sync(rq) &&
 			bfqq->last_rais_start_finish +
                         bfqd->bfq_raising_min_inter_arr_async < jiffies) {
-                        bfqq->raising_coeff = bfqd->bfq_raising_coeff;
-			bfqq->raising_cur_max_time = bfqd->bfq_raising_max_time;
+			bfq_raising_start(bfqd, bfqq, BFQ_RAISING_ASYNC,
+					  bfqd->bfq_raising_max_time);
 
 			entity->ioprio_changed = 1;
 			bfq_log_bfqq(bfqd, bfqq,
@@ -831,7 +951,7 @@ static void bfq_arm_slice_timer(struct bfq_data *bfqd)
 {
 	struct bfq_queue *bfqq = bfqd->active_queue;
 	struct bfq_io_cq *bic;
-	unsigned long sl;
+	u64 sl;
 
 	WARN_ON(!RB_EMPTY_ROOT(&bfqq->sort_list));
 
@@ -860,13 +980,15 @@ static void bfq_arm_slice_timer(struct bfq_data *bfqd)
 	if (bfq_sample_valid(bfqq->seek_samples) && BFQQ_SEEKY(bfqq) &&
 	    bfqq->entity.service > bfq_max_budget(bfqd) / 8 &&
 	    bfqq->raising_coeff == 1)
-		sl = min(sl, msecs_to_jiffies(BFQ_MIN_TT));
+		sl = min_t(u64, sl, BFQ_MIN_TT);
 	else if (bfqq->raising_coeff > 1)
 		sl = sl * 3;
 	bfqd->last_idling_start = ktime_get();
-	mod_timer(&bfqd->idle_slice_timer, jiffies + sl);
-	bfq_log(bfqd, "arm idle: %u/%u ms",
-		jiffies_to_msecs(sl), jiffies_to_msecs(bfqd->bfq_slice_idle));
+	hrtimer_start(&bfqd->idle_slice_timer, ns_to_ktime(sl),
+		      HRTIMER_MODE_REL);
+	bfq_log(bfqd, "arm idle: %llu/%llu us",
+		div_u64(sl, NSEC_PER_USEC),
+		div_u64(bfqd->bfq_slice_idle, NSEC_PER_USEC));
 }
 
 /*
@@ -884,12 +1006,12 @@ static void bfq_set_budget_timeout(struct bfq_data *bfqd)
 	bfqd->last_budget_start = ktime_get();
 
 	bfq_clear_bfqq_budget_new(bfqq);
-	bfqq->budget_timeout = jiffies +
+	bfqq->budget_timeout = ktime_to_ns(bfqd->last_budget_start) +
 		bfqd->bfq_timeout[bfq_bfqq_sync(bfqq)] * timeout_coeff;
 
-	bfq_log_bfqq(bfqd, bfqq, "set budget_timeout %u",
-		jiffies_to_msecs(bfqd->bfq_timeout[bfq_bfqq_sync(bfqq)] *
-		timeout_coeff));
+	bfq_log_bfqq(bfqd, bfqq, "set budget_timeout %llu us",
+		div_u64(bfqd->bfq_timeout[bfq_bfqq_sync(bfqq)] *
+			timeout_coeff, NSEC_PER_USEC));
 }
 
 /*
@@ -1007,7 +1129,7 @@ static void __bfq_bfqq_expire(struct bfq_data *bfqd, struct bfq_queue *bfqq)
 		 * the queue remains with no backlog, used by
 		 * the weight-raising mechanism
 		 */
-		bfqq->budget_timeout = jiffies ;
+		bfqq->budget_timeout = bfq_now_ns();
 	} else {
 		bfq_activate_bfqq(bfqd, bfqq);
 		/*
@@ -1206,7 +1328,7 @@ static int bfq_update_peak_rate(struct bfq_data *bfqd, struct bfq_queue *bfqq,
 	bw = (u64)bfqq->entity.service << BFQ_RATE_SHIFT;
 	do_div(bw, (unsigned long)usecs);
 
-	timeout = jiffies_to_msecs(bfqd->bfq_timeout[BLK_RW_SYNC]);
+	timeout = div_u64(bfqd->bfq_timeout[BLK_RW_SYNC], NSEC_PER_MSEC);
 
 	/*
 	 * Use only long (> 20ms) intervals to filter out spikes for
@@ -1364,7 +1486,7 @@ static int bfq_bfqq_budget_timeout(struct bfq_queue *bfqq)
 	if (bfq_bfqq_budget_new(bfqq))
 		return 0;
 
-	if (time_before(jiffies, bfqq->budget_timeout))
+	if (bfq_now_ns() < bfqq->budget_timeout)
 		return 0;
 
 	return 1;
@@ -1437,7 +1559,7 @@ static struct bfq_queue *bfq_select_queue(struct bfq_data *bfqd)
 			 * The idle timer may be pending because we may not
 			 * disable disk idling even when a new request arrives
 			 */
-			if (timer_pending(&bfqd->idle_slice_timer)) {
+			if (hrtimer_is_queued(&bfqd->idle_slice_timer)) {
 				/*
 				 * If we get here: 1) at least a new request
 				 * has arrived but we have not disabled the
@@ -1451,7 +1573,7 @@ static struct bfq_queue *bfq_select_queue(struct bfq_data *bfqd)
 				 * So we disable idling.
 				 */
 				bfq_clear_bfqq_wait_request(bfqq);
-				del_timer(&bfqd->idle_slice_timer);
+				hrtimer_try_to_cancel(&bfqd->idle_slice_timer);
 			}
 			if (new_bfqq == NULL)
 				goto keep_queue;
@@ -1465,17 +1587,18 @@ static struct bfq_queue *bfq_select_queue(struct bfq_data *bfqd)
 	 * queue still has requests in flight or is idling for a new request,
 	 * then keep it.
 	 */
-	if (new_bfqq == NULL && (timer_pending(&bfqd->idle_slice_timer) ||
+	if (new_bfqq == NULL && (hrtimer_is_queued(&bfqd->idle_slice_timer) ||
 		(bfqq->dispatched != 0 && bfq_bfqq_idle_window(bfqq)))) {
 		bfqq = NULL;
 		goto keep_queue;
-	} else if (new_bfqq != NULL && timer_pending(&bfqd->idle_slice_timer)) {
+	} else if (new_bfqq != NULL &&
+		   hrtimer_is_queued(&bfqd->idle_slice_timer)) {
 		/*
 		 * Expiring the queue because there is a close cooperator,
 		 * cancel timer.
 		 */
 		bfq_clear_bfqq_wait_request(bfqq);
-		del_timer(&bfqd->idle_slice_timer);
+		hrtimer_try_to_cancel(&bfqd->idle_slice_timer);
 	}
 
 	reason = BFQ_BFQQ_NO_MORE_REQUESTS;
@@ -1510,26 +1633,30 @@ static void update_raising_data(struct bfq_data *bfqd, struct bfq_queue *bfqq)
 			"WARN: pending prio change");
 		/*
 		 * If too much time has elapsed from the beginning
-		 * of this weight-raising period and process is not soft
+		 * of this weight-raising period, or the queue turned out
+		 * to belong to a large burst, and process is not soft
 		 * real-time, stop it
 		 */
 		if (jiffies - bfqq->last_rais_start_finish >
-			bfqq->raising_cur_max_time) {
+			bfqq->raising_cur_max_time ||
+		    (bfq_bfqq_in_large_burst(bfqq) &&
+		     bfqq->raising_reason != BFQ_RAISING_SOFT_RT)) {
 			int soft_rt = bfqd->bfq_raising_max_softrt_rate > 0 &&
 				bfqq->soft_rt_next_start < jiffies;
 
 			bfqq->last_rais_start_finish = jiffies;
-			if (soft_rt)
+			if (soft_rt) {
 				bfqq->raising_cur_max_time =
 					bfqd->bfq_raising_rt_max_time;
-			else {
+				bfqq->raising_reason = BFQ_RAISING_SOFT_RT;
+			} else {
 				bfq_log_bfqq(bfqd, bfqq,
 					     "wrais ending at %llu msec,"
 					     "rais_max_time %u",
 					     bfqq->last_rais_start_finish,
 					     jiffies_to_msecs(bfqq->
 						raising_cur_max_time));
-				bfqq->raising_coeff = 1;
+				bfq_raising_end(bfqd, bfqq);
 				entity->ioprio_changed = 1;
 				__bfq_entity_update_weight_prio(
 					bfq_entity_service_tree(entity),
@@ -1697,7 +1824,7 @@ static int bfq_dispatch_requests(struct request_queue *q, int force)
 		return 0;
 
 	bfq_clear_bfqq_wait_request(bfqq);
-	BUG_ON(timer_pending(&bfqd->idle_slice_timer));
+	BUG_ON(hrtimer_is_queued(&bfqd->idle_slice_timer));
 
 	if (! bfq_dispatch_request(bfqd, bfqq))
 		return 0;
@@ -1733,6 +1860,8 @@ static void bfq_put_queue(struct bfq_queue *bfqq)
 
 	bfq_log_bfqq(bfqd, bfqq, "put_queue: %p freed", bfqq);
 
+	if (!hlist_unhashed(&bfqq->burst_list_node))
+		hlist_del(&bfqq->burst_list_node);
 	kmem_cache_free(bfq_pool, bfqq);
 }
 
@@ -1776,7 +1905,7 @@ static void bfq_init_icq(struct io_cq *icq)
 {
 	struct bfq_io_cq *bic = icq_to_bic(icq);
 
-	bic->ttime.last_end_request = jiffies;
+	bic->ttime.last_end_request = bfq_now_ns();
 }
 
 static void bfq_exit_icq(struct io_cq *icq)
@@ -1892,7 +2021,9 @@ static void bfq_init_bfqq(struct bfq_data *bfqd, struct bfq_queue *bfqq,
 		if (!bfq_class_idle(bfqq))
 			bfq_mark_bfqq_idle_window(bfqq);
 		bfq_mark_bfqq_sync(bfqq);
+		bfq_mark_bfqq_just_created(bfqq);
 	}
+	INIT_HLIST_NODE(&bfqq->burst_list_node);
 
 	/* Tentative initial value to trade off between thr and lat */
 	bfqq->max_budget = (2 * bfq_max_budget(bfqd)) / 3;
@@ -2011,12 +2142,14 @@ static struct bfq_queue *bfq_get_queue(struct bfq_data *bfqd,
 static void bfq_update_io_thinktime(struct bfq_data *bfqd,
 				    struct bfq_io_cq *bic)
 {
-	unsigned long elapsed = jiffies - bic->ttime.last_end_request;
-	unsigned long ttime = min(elapsed, 2UL * bfqd->bfq_slice_idle);
+	u64 elapsed = bfq_now_ns() - bic->ttime.last_end_request;
+	u64 ttime = min_t(u64, elapsed, 2 * bfqd->bfq_slice_idle);
 
 	bic->ttime.ttime_samples = (7*bic->ttime.ttime_samples + 256) / 8;
-	bic->ttime.ttime_total = (7*bic->ttime.ttime_total + 256*ttime) / 8;
-	bic->ttime.ttime_mean = (bic->ttime.ttime_total + 128) / bic->ttime.ttime_samples;
+	bic->ttime.ttime_total = div_u64(7*bic->ttime.ttime_total + 256*ttime,
+					 8);
+	bic->ttime.ttime_mean = div64_u64(bic->ttime.ttime_total + 128,
+					  bic->ttime.ttime_samples);
 }
 
 static void bfq_update_io_seektime(struct bfq_data *bfqd,
@@ -2153,7 +2286,7 @@ static void bfq_rq_enqueued(struct bfq_data *bfqd, struct bfq_queue *bfqq,
 			 * this queue just now.
 			 */
 			bfq_clear_bfqq_wait_request(bfqq);
-			del_timer(&bfqd->idle_slice_timer);
+			hrtimer_try_to_cancel(&bfqd->idle_slice_timer);
 			/*
 			 * Here we can safely expire the queue, in
 			 * case of budget timeout, without wasting
@@ -2225,7 +2358,7 @@ static void bfq_completed_request(struct request_queue *q, struct request *rq)
 		bfqd->sync_flight--;
 
 	if (sync)
-		RQ_BIC(rq)->ttime.last_end_request = jiffies;
+		RQ_BIC(rq)->ttime.last_end_request = bfq_now_ns();
 
 	/*
 	 * If this is the active queue, check if it needs to be expired,
@@ -2442,9 +2575,10 @@ static void bfq_kick_queue(struct work_struct *work)
  * Handler of the expiration of the timer running if the active_queue
  * is idling inside its time slice.
  */
-static void bfq_idle_slice_timer(unsigned long data)
+static enum hrtimer_restart bfq_idle_slice_timer(struct hrtimer *timer)
 {
-	struct bfq_data *bfqd = (struct bfq_data *)data;
+	struct bfq_data *bfqd = container_of(timer, struct bfq_data,
+					     idle_slice_timer);
 	struct bfq_queue *bfqq;
 	unsigned long flags;
 	enum bfqq_expiration reason;
@@ -2487,11 +2621,12 @@ schedule_dispatch:
 	bfq_schedule_dispatch(bfqd);
 
 	spin_unlock_irqrestore(bfqd->queue->queue_lock, flags);
+	return HRTIMER_NORESTART;
 }
 
 static void bfq_shutdown_timer_wq(struct bfq_data *bfqd)
 {
-	del_timer_sync(&bfqd->idle_slice_timer);
+	hrtimer_cancel(&bfqd->idle_slice_timer);
 	cancel_work_sync(&bfqd->unplug_work);
 }
 
@@ -2549,7 +2684,7 @@ static void bfq_exit_queue(struct elevator_queue *e)
 
 	synchronize_rcu();
 
-	BUG_ON(timer_pending(&bfqd->idle_slice_timer));
+	BUG_ON(hrtimer_active(&bfqd->idle_slice_timer));
 
 	bfq_free_root_group(bfqd);
 	kfree(bfqd);
@@ -2582,9 +2717,9 @@ static void *bfq_init_queue(struct request_queue *q)
 
 	bfqd->root_group = bfqg;
 
-	init_timer(&bfqd->idle_slice_timer);
+	hrtimer_init(&bfqd->idle_slice_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL);
 	bfqd->idle_slice_timer.function = bfq_idle_slice_timer;
-	bfqd->idle_slice_timer.data = (unsigned long)bfqd;
 
 	bfqd->rq_pos_tree = RB_ROOT;
 
@@ -2616,6 +2751,10 @@ static void *bfq_init_queue(struct request_queue *q)
 	bfqd->bfq_raising_min_idle_time = msecs_to_jiffies(2000);
 	bfqd->bfq_raising_min_inter_arr_async = msecs_to_jiffies(500);
 	bfqd->bfq_raising_max_softrt_rate = 7000;
+	bfqd->bfq_raising_async = false;
+	bfqd->bfq_raising_burst_interval = msecs_to_jiffies(180);
+	bfqd->bfq_raising_large_burst = 11;
+	INIT_HLIST_HEAD(&bfqd->burst_list);
 
 	return bfqd;
 }
@@ -2639,6 +2778,37 @@ static ssize_t bfq_var_show(unsigned int var, char *page)
 	return sprintf(page, "%d\n", var);
 }
 
+/* __CONV for the attributes below: ms in jiffies, ms in ns, us in ns */
+#define BFQ_CONV_JIFFIES	1
+#define BFQ_CONV_NS_MS		2
+#define BFQ_CONV_NS_US		3
+
+static u64 bfq_conv_show(u64 val, int conv)
+{
+	switch (conv) {
+	case BFQ_CONV_JIFFIES:
+		return jiffies_to_msecs(val);
+	case BFQ_CONV_NS_MS:
+		return div_u64(val, NSEC_PER_MSEC);
+	case BFQ_CONV_NS_US:
+		return div_u64(val, NSEC_PER_USEC);
+	}
+	return val;
+}
+
+static u64 bfq_conv_store(unsigned long val, int conv)
+{
+	switch (conv) {
+	case BFQ_CONV_JIFFIES:
+		return msecs_to_jiffies(val);
+	case BFQ_CONV_NS_MS:
+		return (u64)val * NSEC_PER_MSEC;
+	case BFQ_CONV_NS_US:
+		return (u64)val * NSEC_PER_USEC;
+	}
+	return val;
+}
+
 static ssize_t bfq_var_store(unsigned long *var, const char *page, size_t count)
 {
 	unsigned long new_val;
@@ -2683,9 +2853,7 @@ static ssize_t bfq_weights_show(struct elevator_queue *e, char *page)
 static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
 {									\
 	struct bfq_data *bfqd = e->elevator_data;			\
-	unsigned int __data = __VAR;					\
-	if (__CONV)							\
-		__data = jiffies_to_msecs(__data);			\
+	unsigned int __data = bfq_conv_show(__VAR, __CONV);		\
 	return bfq_var_show(__data, (page));				\
 }
 SHOW_FUNCTION(bfq_quantum_show, bfqd->bfq_quantum, 0);
@@ -2693,11 +2861,14 @@ SHOW_FUNCTION(bfq_fifo_expire_sync_show, bfqd->bfq_fifo_expire[1], 1);
 SHOW_FUNCTION(bfq_fifo_expire_async_show, bfqd->bfq_fifo_expire[0], 1);
 SHOW_FUNCTION(bfq_back_seek_max_show, bfqd->bfq_back_max, 0);
 SHOW_FUNCTION(bfq_back_seek_penalty_show, bfqd->bfq_back_penalty, 0);
-SHOW_FUNCTION(bfq_slice_idle_show, bfqd->bfq_slice_idle, 1);
+SHOW_FUNCTION(bfq_slice_idle_show, bfqd->bfq_slice_idle, BFQ_CONV_NS_MS);
+SHOW_FUNCTION(bfq_slice_idle_us_show, bfqd->bfq_slice_idle, BFQ_CONV_NS_US);
 SHOW_FUNCTION(bfq_max_budget_show, bfqd->bfq_user_max_budget, 0);
 SHOW_FUNCTION(bfq_max_budget_async_rq_show, bfqd->bfq_max_budget_async_rq, 0);
-SHOW_FUNCTION(bfq_timeout_sync_show, bfqd->bfq_timeout[BLK_RW_SYNC], 1);
-SHOW_FUNCTION(bfq_timeout_async_show, bfqd->bfq_timeout[BLK_RW_ASYNC], 1);
+SHOW_FUNCTION(bfq_timeout_sync_show, bfqd->bfq_timeout[BLK_RW_SYNC],
+	BFQ_CONV_NS_MS);
+SHOW_FUNCTION(bfq_timeout_async_show, bfqd->bfq_timeout[BLK_RW_ASYNC],
+	BFQ_CONV_NS_MS);
 SHOW_FUNCTION(bfq_low_latency_show, bfqd->low_latency, 0);
 SHOW_FUNCTION(bfq_raising_coeff_show, bfqd->bfq_raising_coeff, 0);
 SHOW_FUNCTION(bfq_raising_max_time_show, bfqd->bfq_raising_max_time, 1);
@@ -2709,6 +2880,10 @@ SHOW_FUNCTION(bfq_raising_min_inter_arr_async_show,
 	1);
 SHOW_FUNCTION(bfq_raising_max_softrt_rate_show,
 	bfqd->bfq_raising_max_softrt_rate, 0);
+SHOW_FUNCTION(bfq_raising_async_show, bfqd->bfq_raising_async, 0);
+SHOW_FUNCTION(bfq_raising_burst_interval_show,
+	bfqd->bfq_raising_burst_interval, 1);
+SHOW_FUNCTION(bfq_raising_large_burst_show, bfqd->bfq_raising_large_burst, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -2722,10 +2897,7 @@ __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
 		__data = (MIN);						\
 	else if (__data > (MAX))					\
 		__data = (MAX);						\
-	if (__CONV)							\
-		*(__PTR) = msecs_to_jiffies(__data);			\
-	else								\
-		*(__PTR) = __data;					\
+	*(__PTR) = bfq_conv_store(__data, __CONV);			\
 	return ret;							\
 }
 STORE_FUNCTION(bfq_quantum_store, &bfqd->bfq_quantum, 1, INT_MAX, 0);
@@ -2736,11 +2908,14 @@ STORE_FUNCTION(bfq_fifo_expire_async_store, &bfqd->bfq_fifo_expire[0], 1,
 STORE_FUNCTION(bfq_back_seek_max_store, &bfqd->bfq_back_max, 0, INT_MAX, 0);
 STORE_FUNCTION(bfq_back_seek_penalty_store, &bfqd->bfq_back_penalty, 1,
 		INT_MAX, 0);
-STORE_FUNCTION(bfq_slice_idle_store, &bfqd->bfq_slice_idle, 0, INT_MAX, 1);
+STORE_FUNCTION(bfq_slice_idle_store, &bfqd->bfq_slice_idle, 0, INT_MAX,
+		BFQ_CONV_NS_MS);
+STORE_FUNCTION(bfq_slice_idle_us_store, &bfqd->bfq_slice_idle, 0, INT_MAX,
+		BFQ_CONV_NS_US);
 STORE_FUNCTION(bfq_max_budget_async_rq_store, &bfqd->bfq_max_budget_async_rq,
 		1, INT_MAX, 0);
 STORE_FUNCTION(bfq_timeout_async_store, &bfqd->bfq_timeout[BLK_RW_ASYNC], 0,
-		INT_MAX, 1);
+		INT_MAX, BFQ_CONV_NS_MS);
 STORE_FUNCTION(bfq_raising_coeff_store, &bfqd->bfq_raising_coeff, 1,
 		INT_MAX, 0);
 STORE_FUNCTION(bfq_raising_max_time_store, &bfqd->bfq_raising_max_time, 0,
@@ -2753,6 +2928,11 @@ STORE_FUNCTION(bfq_raising_min_inter_arr_async_store,
 		&bfqd->bfq_raising_min_inter_arr_async, 0, INT_MAX, 1);
 STORE_FUNCTION(bfq_raising_max_softrt_rate_store,
 	       &bfqd->bfq_raising_max_softrt_rate, 0, INT_MAX, 0);
+STORE_FUNCTION(bfq_raising_async_store, &bfqd->bfq_raising_async, 0, 1, 0);
+STORE_FUNCTION(bfq_raising_burst_interval_store,
+	       &bfqd->bfq_raising_burst_interval, 0, INT_MAX, 1);
+STORE_FUNCTION(bfq_raising_large_burst_store,
+	       &bfqd->bfq_raising_large_burst, 0, INT_MAX, 0);
 #undef STORE_FUNCTION
 
 /* do nothing for the moment */
@@ -2762,9 +2942,36 @@ static ssize_t bfq_weights_store(struct elevator_queue *e,
 	return count;
 }
 
+static void bfq_end_raising_list(struct bfq_data *bfqd,
+				 struct list_head *head)
+{
+	struct bfq_queue *bfqq;
+
+	list_for_each_entry(bfqq, head, bfqq_list) {
+		if (bfqq->raising_coeff == 1)
+			continue;
+		bfq_raising_end(bfqd, bfqq);
+		bfqq->raising_cur_max_time = bfqd->bfq_raising_max_time;
+		bfqq->last_rais_start_finish = jiffies;
+		bfqq->entity.ioprio_changed = 1;
+	}
+}
+
+/*
+ * Switching low_latency off must not leave queues raised until their
+ * periods run out; the new weights apply at their next activation.
+ */
+static void bfq_end_raising(struct bfq_data *bfqd)
+{
+	spin_lock_irq(bfqd->queue->queue_lock);
+	bfq_end_raising_list(bfqd, &bfqd->active_list);
+	bfq_end_raising_list(bfqd, &bfqd->idle_list);
+	spin_unlock_irq(bfqd->queue->queue_lock);
+}
+
 static inline unsigned long bfq_estimated_max_budget(struct bfq_data *bfqd)
 {
-	u64 timeout = jiffies_to_msecs(bfqd->bfq_timeout[BLK_RW_SYNC]);
+	u64 timeout = div_u64(bfqd->bfq_timeout[BLK_RW_SYNC], NSEC_PER_MSEC);
 
 	if (bfqd->peak_rate_samples >= BFQ_PEAK_RATE_SAMPLES)
 		return bfq_calc_max_budget(bfqd->peak_rate, timeout);
@@ -2804,7 +3011,7 @@ static ssize_t bfq_timeout_sync_store(struct elevator_queue *e,
 	else if (__data > INT_MAX)
 		__data = INT_MAX;
 
-	bfqd->bfq_timeout[BLK_RW_SYNC] = msecs_to_jiffies(__data);
+	bfqd->bfq_timeout[BLK_RW_SYNC] = (u64)__data * NSEC_PER_MSEC;
 	if (bfqd->bfq_user_max_budget == 0)
 		bfqd->bfq_max_budget = bfq_estimated_max_budget(bfqd);
 
@@ -2820,11 +3027,51 @@ static ssize_t bfq_low_latency_store(struct elevator_queue *e,
 
 	if (__data > 1)
 		__data = 1;
+	if (__data == 0 && bfqd->low_latency != 0)
+		bfq_end_raising(bfqd);
 	bfqd->low_latency = __data;
 
 	return ret;
 }
 
+static ssize_t bfq_raising_stats_show(struct elevator_queue *e, char *page)
+{
+	struct bfq_data *bfqd = e->elevator_data;
+	struct bfq_queue *bfqq;
+	ssize_t num_char = 0;
+	int i;
+
+	spin_lock_irq(bfqd->queue->queue_lock);
+	num_char += sprintf(page + num_char, "started:");
+	for (i = 0; i < BFQ_RAISING_NR; i++)
+		num_char += sprintf(page + num_char, " %s %lu",
+				    bfq_raising_reasons[i],
+				    bfqd->raising_started[i]);
+	num_char += sprintf(page + num_char,
+			    "\nended: %lu\nlarge bursts: %lu, not raised %lu\n",
+			    bfqd->raising_ended, bfqd->large_bursts,
+			    bfqd->burst_not_raised);
+	list_for_each_entry(bfqq, &bfqd->active_list, bfqq_list) {
+		if (bfqq->raising_periods == 0)
+			continue;
+		if (num_char > PAGE_SIZE - 128)
+			break;
+		num_char += sprintf(page + num_char,
+			"pid%d: %s coeff %u %s dur %u/%u, periods %lu, "
+			"total %u\n",
+			bfqq->pid, bfq_bfqq_sync(bfqq) ? "sync" : "async",
+			bfqq->raising_coeff,
+			bfq_raising_reasons[bfqq->raising_reason],
+			jiffies_to_msecs(jiffies - bfqq->last_rais_start_finish),
+			jiffies_to_msecs(bfqq->raising_cur_max_time),
+			bfqq->raising_periods,
+			jiffies_to_msecs(bfqq->raising_time));
+	}
+	spin_unlock_irq(bfqd->queue->queue_lock);
+
+	return num_char;
+}
+
 #define BFQ_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, bfq_##name##_show, bfq_##name##_store)
 
@@ -2835,6 +3082,7 @@ static struct elv_fs_entry bfq_attrs[] = {
 	BFQ_ATTR(back_seek_max),
 	BFQ_ATTR(back_seek_penalty),
 	BFQ_ATTR(slice_idle),
+	BFQ_ATTR(slice_idle_us),
 	BFQ_ATTR(max_budget),
 	BFQ_ATTR(max_budget_async_rq),
 	BFQ_ATTR(timeout_sync),
@@ -2846,7 +3094,11 @@ static struct elv_fs_entry bfq_attrs[] = {
 	BFQ_ATTR(raising_min_idle_time),
 	BFQ_ATTR(raising_min_inter_arr_async),
 	BFQ_ATTR(raising_max_softrt_rate),
+	BFQ_ATTR(raising_async),
+	BFQ_ATTR(raising_burst_interval),
+	BFQ_ATTR(raising_large_burst),
 	BFQ_ATTR(weights),
+	__ATTR(raising_stats, S_IRUGO, bfq_raising_stats_show, NULL),
 	__ATTR_NULL
 };
 
@@ -2880,15 +3132,6 @@ static struct elevator_type iosched_bfq = {
 
 static int __init bfq_init(void)
 {
-	/*
-	 * Can be 0 on HZ < 1000 setups.
-	 */
-	if (bfq_slice_idle == 0)
-		bfq_slice_idle = 1;
-
-	if (bfq_timeout_async == 0)
-		bfq_timeout_async = 1;
-
 	if (bfq_slab_setup())
 		return -ENOMEM;
 
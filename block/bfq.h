@@ -158,6 +158,19 @@ struct bfq_entity {
 
 struct bfq_group;
 
+/*
+ * Why a queue was weight-raised: it was newly created (or had been idle
+ * for long), it looks soft real-time, or it is an async queue raised while
+ * the device was not idle.
+ */
+enum bfq_raising_reason {
+	BFQ_RAISING_NEW = 0,
+	BFQ_RAISING_IDLE,
+	BFQ_RAISING_SOFT_RT,
+	BFQ_RAISING_ASYNC,
+	BFQ_RAISING_NR,
+};
+
 /**
  * struct bfq_queue - leaf schedulable entity.
  * @ref: reference counter.
@@ -174,7 +187,7 @@ struct bfq_group;
  * @fifo: fifo list of requests in sort_list.
  * @entity: entity representing this queue in the scheduler.
  * @max_budget: maximum budget allowed from the feedback mechanism.
- * @budget_timeout: budget expiration (in jiffies).
+ * @budget_timeout: budget expiration (in ns, ktime_get() based).
  * @dispatched: number of requests on the dispatch list or inside driver.
  * @org_ioprio: saved ioprio during boosted periods.
  * @flags: status flags.
@@ -186,6 +199,11 @@ struct bfq_group;
  * @pid: pid of the process owning the queue, used for logging purposes.
  * @last_rais_start_time: last (idle -> weight-raised) transition attempt
  * @raising_cur_max_time: current max raising time for this queue
+ * @raising_reason: why the current or last weight-raising period started
+ * @raising_since: start of the current weight-raising period (jiffies)
+ * @raising_periods: number of weight-raising periods of the queue
+ * @raising_time: total time the queue has been weight-raised (jiffies)
+ * @burst_list_node: node in the burst list of the bfqd
  *
  * A bfq_queue is a leaf request queue; it can be associated to an io_context
  * or more (if it is an async one).  @cgroup holds a reference to the
@@ -213,7 +231,7 @@ struct bfq_queue {
 	struct bfq_entity entity;
 
 	unsigned long max_budget;
-	unsigned long budget_timeout;
+	u64 budget_timeout;
 
 	int dispatched;
 
@@ -234,20 +252,28 @@ struct bfq_queue {
 	unsigned int raising_cur_max_time;
 	u64 last_rais_start_finish, soft_rt_next_start;
 	unsigned int raising_coeff;
+
+	/* weight-raising statistics and burst detection */
+	enum bfq_raising_reason raising_reason;
+	unsigned long raising_since;
+	unsigned long raising_periods;
+	u64 raising_time;
+	struct hlist_node burst_list_node;
 };
 
 /**
- * struct bfq_ttime - per process thinktime stats.
+ * struct bfq_ttime - per process thinktime stats, all times in ns.
+ * @last_end_request: completion time of the last sync request
  * @ttime_total: total process thinktime
  * @ttime_samples: number of thinktime samples
  * @ttime_mean: average process thinktime
  */
 struct bfq_ttime {
-	unsigned long last_end_request;
+	u64 last_end_request;
 
-	unsigned long ttime_total;
+	u64 ttime_total;
 	unsigned long ttime_samples;
-	unsigned long ttime_mean;
+	u64 ttime_mean;
 };
 
 /**
@@ -279,8 +305,8 @@ struct bfq_io_cq {
  * @hw_tag_samples: nr of samples used to calculate hw_tag.
  * @hw_tag: flag set to one if the driver is showing a queueing behavior.
  * @budgets_assigned: number of budgets assigned.
- * @idle_slice_timer: timer set when idling for the next sequential request
- *                    from the queue under service.
+ * @idle_slice_timer: hrtimer set when idling for the next sequential
+ *                    request from the queue under service.
  * @unplug_work: delayed work to restart dispatching on the request queue.
  * @active_queue: bfq_queue under service.
  * @active_bic: bfq_io_cq (bic) associated with the @active_queue.
@@ -298,7 +324,7 @@ struct bfq_io_cq {
  *                   requests are served in fifo order.
  * @bfq_back_penalty: weight of backward seeks wrt forward ones.
  * @bfq_back_max: maximum allowed backward seek.
- * @bfq_slice_idle: maximum idling time.
+ * @bfq_slice_idle: maximum idling time (ns).
  * @bfq_user_max_budget: user-configured max budget value (0 for auto-tuning).
  * @bfq_max_budget_async_rq: maximum budget (in nr of requests) allotted to
  *                           async queues.
@@ -308,7 +334,7 @@ struct bfq_io_cq {
  *               receive guarantees in the service domain; after a timeout
  *               they are charged for the whole allocated budget, to try
  *               to preserve a behavior reasonably fair among them, but
- *               without service-domain guarantees).
+ *               without service-domain guarantees); in ns.
  * @bfq_raising_coeff: Maximum factor by which the weight of a boosted
  *                            queue is multiplied
  * @bfq_raising_max_time: maximum duration of a weight-raising period (jiffies)
@@ -321,6 +347,20 @@ struct bfq_io_cq {
  *				     (in jiffies)
  * @bfq_raising_max_softrt_rate: max service-rate for a soft real-time queue,
  *			         sectors per seconds
+ * @bfq_raising_async: whether busy async queues may be weight-raised
+ * @bfq_raising_burst_interval: maximum time between the creation of two
+ *				sync queues for them to be in the same burst
+ *				(in jiffies)
+ * @bfq_raising_large_burst: number of queues from which a burst is large;
+ *			     0 disables burst detection
+ * @burst_list: queues of the current burst, while it is not large
+ * @burst_size: number of queues in the current burst
+ * @large_burst: the current burst is large
+ * @last_ins_in_burst: creation of the last queue of the current burst
+ * @raising_started: weight-raising periods started, per reason
+ * @raising_ended: weight-raising periods ended
+ * @large_bursts: bursts found to be large
+ * @burst_not_raised: queues not raised because they were in a large burst
  * @oom_bfqq: fallback dummy bfqq for extreme OOM conditions
  *
  * All the fields are protected by the @queue lock.
@@ -343,7 +383,7 @@ struct bfq_data {
 
 	int budgets_assigned;
 
-	struct timer_list idle_slice_timer;
+	struct hrtimer idle_slice_timer;
 	struct work_struct unplug_work;
 
 	struct bfq_queue *active_queue;
@@ -365,12 +405,12 @@ struct bfq_data {
 	unsigned int bfq_fifo_expire[2];
 	unsigned int bfq_back_penalty;
 	unsigned int bfq_back_max;
-	unsigned int bfq_slice_idle;
+	u64 bfq_slice_idle;
 	u64 bfq_class_idle_last_service;
 
 	unsigned int bfq_user_max_budget;
 	unsigned int bfq_max_budget_async_rq;
-	unsigned int bfq_timeout[2];
+	u64 bfq_timeout[2];
 
 	bool low_latency;
 
@@ -381,6 +421,21 @@ struct bfq_data {
 	unsigned int bfq_raising_min_idle_time;
 	unsigned int bfq_raising_min_inter_arr_async;
 	unsigned int bfq_raising_max_softrt_rate;
+	bool bfq_raising_async;
+	unsigned int bfq_raising_burst_interval;
+	unsigned int bfq_raising_large_burst;
+
+	/* detection of bursts of queue creations */
+	struct hlist_head burst_list;
+	unsigned int burst_size;
+	bool large_burst;
+	unsigned long last_ins_in_burst;
+
+	/* weight-raising statistics */
+	unsigned long raising_started[BFQ_RAISING_NR];
+	unsigned long raising_ended;
+	unsigned long large_bursts;
+	unsigned long burst_not_raised;
 
 	struct bfq_queue oom_bfqq;
 };
@@ -397,6 +452,8 @@ enum bfqq_state_flags {
 	BFQ_BFQQ_FLAG_coop,		/* bfqq is shared */
 	BFQ_BFQQ_FLAG_split_coop,	/* shared bfqq will be splitted */
 	BFQ_BFQQ_FLAG_some_coop_idle,   /* some cooperator is inactive */
+	BFQ_BFQQ_FLAG_just_created,	/* sync queue never activated yet */
+	BFQ_BFQQ_FLAG_in_large_burst,	/* created in a large burst */
 };
 
 #define BFQ_BFQQ_FNS(name)						\
@@ -424,6 +481,8 @@ BFQ_BFQQ_FNS(budget_new);
 BFQ_BFQQ_FNS(coop);
 BFQ_BFQQ_FNS(split_coop);
 BFQ_BFQQ_FNS(some_coop_idle);
+BFQ_BFQQ_FNS(just_created);
+BFQ_BFQQ_FNS(in_large_burst);
 #undef BFQ_BFQQ_FNS
 
 /* Logging facilities. */
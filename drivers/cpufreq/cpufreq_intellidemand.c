@@ -53,6 +53,7 @@
 #define DEF_SAMPLING_RATE			(50000)
 #define BOOSTED_SAMPLING_RATE			(15000)
 #define DBS_INPUT_EVENT_MIN_FREQ		(1026000)
+#define DEF_INPUT_BOOST_MS			(200)
 #define DBS_SYNC_FREQ				(702000)
 #define DBS_OPTIMAL_FREQ			(1296000)
 
@@ -124,6 +125,8 @@ struct cpu_dbs_info_s {
 	unsigned int max_load;
 	int cpu;
 	unsigned int sample_type:1;
+	/* input boost floor active, protected by timer_mutex */
+	unsigned int input_boosted:1;
 	/*
 	 * percpu mutex that serializes governor limit change with
 	 * do_dbs_timer invocation. We do not want do_dbs_timer to run
@@ -169,6 +172,8 @@ static struct dbs_tuners {
 	unsigned int freq_boost_time;
 	unsigned int boostfreq;
 	unsigned int two_phase_freq;
+	unsigned int input_boost_freq;
+	unsigned int input_boost_ms;
 } dbs_tuners_ins = {
 	.up_threshold_multi_core = DEF_FREQUENCY_UP_THRESHOLD,
 	.up_threshold = DEF_FREQUENCY_UP_THRESHOLD,
@@ -182,8 +187,13 @@ static struct dbs_tuners {
 	.optimal_freq = DBS_OPTIMAL_FREQ,
 	.freq_boost_time = DEFAULT_FREQ_BOOST_TIME,
 	.two_phase_freq = 0,
+	.input_boost_freq = DBS_INPUT_EVENT_MIN_FREQ,
+	.input_boost_ms = DEF_INPUT_BOOST_MS,
 };
 
+/* end of the current input boost, ktime in uS */
+static u64 input_boost_end_time;
+
 static inline cputime64_t get_cpu_idle_time_jiffy(unsigned int cpu,
 							cputime64_t *wall)
 {
@@ -350,6 +360,8 @@ show_one(sync_freq, sync_freq);
 show_one(boostpulse, boosted);
 show_one(boosttime, freq_boost_time);
 show_one(boostfreq, boostfreq);
+show_one(input_boost_freq, input_boost_freq);
+show_one(input_boost_ms, input_boost_ms);
 show_one(two_phase_freq, two_phase_freq);
 
 #ifdef CONFIG_CPUFREQ_LIMIT_MAX_FREQ 
@@ -448,6 +460,32 @@ static ssize_t store_boostfreq(struct kobject *a, struct attribute *b,
 	return count;
 }
 
+static ssize_t store_input_boost_freq(struct kobject *a, struct attribute *b,
+				const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+	dbs_tuners_ins.input_boost_freq = input;
+	return count;
+}
+
+static ssize_t store_input_boost_ms(struct kobject *a, struct attribute *b,
+				const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+	dbs_tuners_ins.input_boost_ms = input;
+	return count;
+}
+
 /**
  * update_sampling_rate - update sampling rate effective immediately if needed.
  * @new_rate: new sampling rate
@@ -893,6 +931,8 @@ define_one_global_rw(sync_freq);
 define_one_global_rw(boostpulse);
 define_one_global_rw(boosttime);
 define_one_global_rw(boostfreq);
+define_one_global_rw(input_boost_freq);
+define_one_global_rw(input_boost_ms);
 define_one_global_rw(two_phase_freq);
 
 #ifdef CONFIG_CPUFREQ_LIMIT_MAX_FREQ
@@ -919,6 +959,8 @@ static struct attribute *dbs_attributes[] = {
 	&boostpulse.attr,
 	&boosttime.attr,
 	&boostfreq.attr,
+	&input_boost_freq.attr,
+	&input_boost_ms.attr,
 	&two_phase_freq.attr,
 #ifdef CONFIG_CPUFREQ_LIMIT_MAX_FREQ
 	&lmf_browser.attr,
@@ -978,6 +1020,13 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 		}
 	}
 
+	/* Input boost holds for input_boost_ms after the last event */
+	if (this_dbs_info->input_boosted &&
+	    ktime_to_us(ktime_get()) >= input_boost_end_time) {
+		this_dbs_info->input_boosted = 0;
+		cpufreq_stats_boost(policy->cpu, false);
+	}
+
 	/* Only core0 controls the timer_rate */
 	if (sampling_rate_boosted && policy->cpu == 0) {
 		if (ktime_to_us(ktime_get()) - sampling_rate_boosted_time >=
@@ -1181,6 +1230,10 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 			freq_next = dbs_tuners_ins.boostfreq;
 		}
 
+		if (this_dbs_info->input_boosted &&
+				freq_next < dbs_tuners_ins.input_boost_freq)
+			freq_next = dbs_tuners_ins.input_boost_freq;
+
 		/* No longer fully busy, reset rate_mult */
 		this_dbs_info->rate_mult = 1;
 
@@ -1558,7 +1611,9 @@ static void do_dbs_timer(struct work_struct *work)
 	dbs_info->sample_type = DBS_NORMAL_SAMPLE;
 	if (!dbs_tuners_ins.powersave_bias ||
 	    sample_type == DBS_NORMAL_SAMPLE) {
+		cpufreq_stats_decision(cpu, true);
 		dbs_check_cpu(dbs_info);
+		cpufreq_stats_decision(cpu, false);
 		if (dbs_info->freq_lo) {
 			/* Setup timer for SUB_SAMPLE */
 			dbs_info->sample_type = DBS_SUB_SAMPLE;
@@ -1632,7 +1687,7 @@ static void dbs_refresh_callback(struct work_struct *work)
 	struct cpufreq_policy *policy;
 	struct cpu_dbs_info_s *this_dbs_info;
 	struct dbs_work_struct *dbs_work;
-	unsigned int cpu;
+	unsigned int cpu, boost_freq;
 
 	dbs_work = container_of(work, struct dbs_work_struct, work);
 	cpu = dbs_work->cpu;
@@ -1649,19 +1704,32 @@ static void dbs_refresh_callback(struct work_struct *work)
 		goto bail_incorrect_governor;
 	}
 
-	if (policy->cur < DBS_INPUT_EVENT_MIN_FREQ) {
-		 //pr_info("%s: set cpufreq to DBS_INPUT_EVENT_MIN_FREQ(%d)
-		 //	directly due to input events!\n", __func__, DBS_INPUT_EVENT_MIN_FREQ);
+	boost_freq = min(dbs_tuners_ins.input_boost_freq, policy->max);
+
+	mutex_lock(&this_dbs_info->timer_mutex);
+	if (policy->cur < boost_freq) {
 		/*
 		 * Arch specific cpufreq driver may fail.
 		 * Don't update governor frequency upon failure.
 		 */
-		if (__cpufreq_driver_target(policy, DBS_INPUT_EVENT_MIN_FREQ,
-					CPUFREQ_RELATION_L) >= 0);
-			policy->cur = DBS_INPUT_EVENT_MIN_FREQ;
+		if (__cpufreq_driver_target(policy, boost_freq,
+					CPUFREQ_RELATION_L) >= 0)
+			policy->cur = boost_freq;
 		this_dbs_info->prev_cpu_idle = get_cpu_idle_time(cpu,
 				&this_dbs_info->prev_cpu_wall);
+		this_dbs_info->prev_cpu_iowait = get_cpu_iowait_time(cpu,
+				&this_dbs_info->prev_cpu_wall);
 	}
+	/*
+	 * Keep dbs_check_cpu from dropping below the boost frequency
+	 * until input_boost_ms after the last input event.
+	 */
+	if (dbs_tuners_ins.input_boost_ms && !this_dbs_info->input_boosted) {
+		this_dbs_info->input_boosted = 1;
+		cpufreq_stats_boost(policy->cpu, true);
+	}
+	mutex_unlock(&this_dbs_info->timer_mutex);
+
 bail_incorrect_governor:
 	unlock_policy_rwsem_write(cpu);
 
@@ -1690,6 +1758,9 @@ static void dbs_input_event(struct input_handle *handle, unsigned int type,
 			sampling_rate_boosted = 1;
 		}
 
+		input_boost_end_time = ktime_to_us(ktime_get()) +
+			dbs_tuners_ins.input_boost_ms * USEC_PER_MSEC;
+
 		for_each_online_cpu(i)
 			queue_work_on(i, input_wq, &per_cpu(dbs_refresh_work, i).work);
 	}
@@ -1844,6 +1915,13 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 	case CPUFREQ_GOV_STOP:
 		dbs_timer_exit(this_dbs_info);
 
+		mutex_lock(&this_dbs_info->timer_mutex);
+		if (this_dbs_info->input_boosted) {
+			this_dbs_info->input_boosted = 0;
+			cpufreq_stats_boost(cpu, false);
+		}
+		mutex_unlock(&this_dbs_info->timer_mutex);
+
 		mutex_lock(&dbs_mutex);
 		dbs_enable--;
 		/* If device is being removed, policy is no longer
@@ -20,6 +20,9 @@
 #include <linux/kobject.h>
 #include <linux/spinlock.h>
 #include <linux/notifier.h>
+#include <linux/hrtimer.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
 #include <asm/cputime.h>
 
 static spinlock_t cpufreq_stats_lock;
@@ -30,6 +33,21 @@ static struct freq_attr _attr_##_name = {\
 	.show = _show,\
 };
 
+/*
+ * Latency histograms use power of two buckets in uS: bucket 0 counts
+ * latencies below 2uS, bucket i those in [2^i, 2^(i+1)) uS and the last
+ * bucket everything from 2^(CPUFREQ_STATS_HIST_BUCKETS - 1) uS up.
+ */
+#define CPUFREQ_STATS_HIST_BUCKETS	20
+
+/* also the layout exported through debugfs, hence no implicit padding */
+struct cpufreq_stats_hist {
+	u64 total_us;
+	u32 samples;
+	u32 max_us;
+	u32 count[CPUFREQ_STATS_HIST_BUCKETS];
+};
+
 struct cpufreq_stats {
 	unsigned int cpu;
 	unsigned int total_trans;
@@ -42,6 +60,16 @@ struct cpufreq_stats {
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	unsigned int *trans_table;
 #endif
+	unsigned int boost_count;
+	bool boosted;
+	unsigned long long boost_start;
+	cputime64_t boost_time;
+	/* PRECHANGE to POSTCHANGE, i.e. the driver's PLL/regulator switch */
+	struct cpufreq_stats_hist trans_hist;
+	s64 trans_start_ns;
+	/* governor sample start to the new frequency being applied */
+	struct cpufreq_stats_hist decision_hist;
+	s64 decision_ns;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_stats *, cpufreq_stats_table);
@@ -92,6 +120,136 @@ static ssize_t show_time_in_state(struct cpufreq_policy *policy, char *buf)
 	return len;
 }
 
+static ssize_t show_boost_count(struct cpufreq_policy *policy, char *buf)
+{
+	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	if (!stat)
+		return 0;
+	return sprintf(buf, "%u\n", stat->boost_count);
+}
+
+static ssize_t show_boost_time(struct cpufreq_policy *policy, char *buf)
+{
+	cputime64_t boost_time;
+	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	if (!stat)
+		return 0;
+	spin_lock(&cpufreq_stats_lock);
+	boost_time = stat->boost_time;
+	if (stat->boosted)
+		boost_time += get_jiffies_64() - stat->boost_start;
+	spin_unlock(&cpufreq_stats_lock);
+	return sprintf(buf, "%llu\n",
+			(unsigned long long)cputime64_to_clock_t(boost_time));
+}
+
+/**
+ * cpufreq_stats_boost - account a governor frequency boost
+ * @cpu: cpu of the boosted policy
+ * @on: true when the boost starts, false when it ends
+ *
+ * Governors call this around input or other boosts so that boost_count
+ * and boost_time show how often and how long the policy was boosted.
+ */
+void cpufreq_stats_boost(unsigned int cpu, bool on)
+{
+	struct cpufreq_stats *stat;
+	unsigned long long cur_time = get_jiffies_64();
+
+	spin_lock(&cpufreq_stats_lock);
+	stat = per_cpu(cpufreq_stats_table, cpu);
+	if (stat && stat->boosted != on) {
+		if (on) {
+			stat->boost_count++;
+			stat->boost_start = cur_time;
+		} else {
+			stat->boost_time += cur_time - stat->boost_start;
+		}
+		stat->boosted = on;
+	}
+	spin_unlock(&cpufreq_stats_lock);
+}
+EXPORT_SYMBOL_GPL(cpufreq_stats_boost);
+
+static void cpufreq_stats_hist_add(struct cpufreq_stats_hist *hist, s64 ns)
+{
+	u32 us;
+	int bucket;
+
+	if (ns < 0)
+		ns = 0;
+	us = min_t(s64, div_s64(ns, NSEC_PER_USEC), UINT_MAX);
+
+	bucket = fls(us) - 1;
+	if (bucket < 0)
+		bucket = 0;
+	if (bucket >= CPUFREQ_STATS_HIST_BUCKETS)
+		bucket = CPUFREQ_STATS_HIST_BUCKETS - 1;
+
+	hist->count[bucket]++;
+	hist->samples++;
+	hist->total_us += us;
+	if (us > hist->max_us)
+		hist->max_us = us;
+}
+
+static ssize_t show_hist(const struct cpufreq_stats_hist *hist, char *buf)
+{
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < CPUFREQ_STATS_HIST_BUCKETS; i++)
+		len += sprintf(buf + len, "%u %u\n", i ? 1U << i : 0,
+			       hist->count[i]);
+	len += sprintf(buf + len, "max %u\n", hist->max_us);
+	return len;
+}
+
+static ssize_t show_trans_latency(struct cpufreq_policy *policy, char *buf)
+{
+	struct cpufreq_stats_hist hist;
+	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	if (!stat)
+		return 0;
+	spin_lock(&cpufreq_stats_lock);
+	hist = stat->trans_hist;
+	spin_unlock(&cpufreq_stats_lock);
+	return show_hist(&hist, buf);
+}
+
+static ssize_t show_decision_latency(struct cpufreq_policy *policy, char *buf)
+{
+	struct cpufreq_stats_hist hist;
+	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	if (!stat)
+		return 0;
+	spin_lock(&cpufreq_stats_lock);
+	hist = stat->decision_hist;
+	spin_unlock(&cpufreq_stats_lock);
+	return show_hist(&hist, buf);
+}
+
+/**
+ * cpufreq_stats_decision - bracket a governor sample
+ * @cpu: cpu of the policy being sampled
+ * @start: true before the governor evaluates the load, false after
+ *
+ * A frequency change completing on @cpu between the two calls is counted
+ * in decision_latency with the time elapsed since the sample started.
+ */
+void cpufreq_stats_decision(unsigned int cpu, bool start)
+{
+	struct cpufreq_stats *stat;
+	s64 now = start ? ktime_to_ns(ktime_get()) : 0;
+
+	spin_lock(&cpufreq_stats_lock);
+	stat = per_cpu(cpufreq_stats_table, cpu);
+	if (stat)
+		stat->decision_ns = now;
+	spin_unlock(&cpufreq_stats_lock);
+}
+EXPORT_SYMBOL_GPL(cpufreq_stats_decision);
+
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 static ssize_t show_trans_table(struct cpufreq_policy *policy, char *buf)
 {
@@ -141,10 +299,18 @@ CPUFREQ_STATDEVICE_ATTR(trans_table, 0444, show_trans_table);
 
 CPUFREQ_STATDEVICE_ATTR(total_trans, 0444, show_total_trans);
 CPUFREQ_STATDEVICE_ATTR(time_in_state, 0444, show_time_in_state);
+CPUFREQ_STATDEVICE_ATTR(boost_count, 0444, show_boost_count);
+CPUFREQ_STATDEVICE_ATTR(boost_time, 0444, show_boost_time);
+CPUFREQ_STATDEVICE_ATTR(trans_latency, 0444, show_trans_latency);
+CPUFREQ_STATDEVICE_ATTR(decision_latency, 0444, show_decision_latency);
 
 static struct attribute *default_attrs[] = {
 	&_attr_total_trans.attr,
 	&_attr_time_in_state.attr,
+	&_attr_boost_count.attr,
+	&_attr_boost_time.attr,
+	&_attr_trans_latency.attr,
+	&_attr_decision_latency.attr,
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	&_attr_trans_table.attr,
 #endif
@@ -169,12 +335,16 @@ static int freq_table_get_index(struct cpufreq_stats *stat, unsigned int freq)
  */
 static void cpufreq_stats_free_table(unsigned int cpu)
 {
-	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, cpu);
+	struct cpufreq_stats *stat;
+
+	spin_lock(&cpufreq_stats_lock);
+	stat = per_cpu(cpufreq_stats_table, cpu);
+	per_cpu(cpufreq_stats_table, cpu) = NULL;
+	spin_unlock(&cpufreq_stats_lock);
 	if (stat) {
 		kfree(stat->time_in_state);
 		kfree(stat);
 	}
-	per_cpu(cpufreq_stats_table, cpu) = NULL;
 }
 
 /* must be called early in the CPU removal sequence (before
@@ -286,14 +456,34 @@ static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
 	struct cpufreq_freqs *freq = data;
 	struct cpufreq_stats *stat;
 	int old_index, new_index;
+	s64 now;
 
-	if (val != CPUFREQ_POSTCHANGE)
+	if (val != CPUFREQ_PRECHANGE && val != CPUFREQ_POSTCHANGE)
 		return 0;
 
 	stat = per_cpu(cpufreq_stats_table, freq->cpu);
 	if (!stat)
 		return 0;
 
+	now = ktime_to_ns(ktime_get());
+	spin_lock(&cpufreq_stats_lock);
+	if (val == CPUFREQ_PRECHANGE) {
+		stat->trans_start_ns = now;
+		spin_unlock(&cpufreq_stats_lock);
+		return 0;
+	}
+	if (stat->trans_start_ns) {
+		cpufreq_stats_hist_add(&stat->trans_hist,
+				       now - stat->trans_start_ns);
+		stat->trans_start_ns = 0;
+	}
+	if (stat->decision_ns) {
+		cpufreq_stats_hist_add(&stat->decision_hist,
+				       now - stat->decision_ns);
+		stat->decision_ns = 0;
+	}
+	spin_unlock(&cpufreq_stats_lock);
+
 	old_index = stat->last_index;
 	new_index = freq_table_get_index(stat, freq->new);
 
@@ -316,6 +506,119 @@ static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
 	return 0;
 }
 
+#ifdef CONFIG_DEBUG_FS
+/*
+ * debugfs cpufreq_stats/latency_hist: a 16 byte struct
+ * cpufreq_stats_hist_header immediately followed by header.count struct
+ * cpufreq_stats_hist_record of header.record_size bytes, one per cpu with
+ * stats, snapshotted when the file is opened. Records are not padded to
+ * their natural alignment. All fields are native endian.
+ */
+struct cpufreq_stats_hist_header {
+	u32 version;
+	u32 record_size;
+	u32 count;
+	u32 nr_buckets;
+};
+
+struct cpufreq_stats_hist_record {
+	u32 cpu;
+	u32 cur_freq;			/* kHz, 0 if not in the table */
+	struct cpufreq_stats_hist trans;
+	struct cpufreq_stats_hist decision;
+};
+
+#define CPUFREQ_STATS_HIST_VERSION	1
+
+/* The file contents, packed into data[] */
+struct cpufreq_stats_hist_snapshot {
+	size_t size;
+	char data[sizeof(struct cpufreq_stats_hist_header) +
+		  NR_CPUS * sizeof(struct cpufreq_stats_hist_record)];
+};
+
+static struct dentry *cpufreq_stats_debugfs;
+
+static int latency_hist_open(struct inode *inode, struct file *file)
+{
+	struct cpufreq_stats_hist_snapshot *snap;
+	struct cpufreq_stats_hist_header hdr;
+	struct cpufreq_stats_hist_record rec;
+	struct cpufreq_stats *stat;
+	unsigned int cpu, n = 0;
+
+	snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+
+	spin_lock(&cpufreq_stats_lock);
+	for_each_possible_cpu(cpu) {
+		stat = per_cpu(cpufreq_stats_table, cpu);
+		if (!stat)
+			continue;
+		memset(&rec, 0, sizeof(rec));
+		rec.cpu = cpu;
+		if (stat->last_index < stat->state_num)
+			rec.cur_freq = stat->freq_table[stat->last_index];
+		rec.trans = stat->trans_hist;
+		rec.decision = stat->decision_hist;
+		memcpy(snap->data + sizeof(hdr) + n++ * sizeof(rec), &rec,
+		       sizeof(rec));
+	}
+	spin_unlock(&cpufreq_stats_lock);
+
+	hdr.version = CPUFREQ_STATS_HIST_VERSION;
+	hdr.record_size = sizeof(rec);
+	hdr.count = n;
+	hdr.nr_buckets = CPUFREQ_STATS_HIST_BUCKETS;
+	memcpy(snap->data, &hdr, sizeof(hdr));
+	snap->size = sizeof(hdr) + n * sizeof(rec);
+
+	file->private_data = snap;
+	return 0;
+}
+
+static ssize_t latency_hist_read(struct file *file, char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	struct cpufreq_stats_hist_snapshot *snap = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, snap->data,
+				       snap->size);
+}
+
+static int latency_hist_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations latency_hist_fops = {
+	.owner		= THIS_MODULE,
+	.open		= latency_hist_open,
+	.read		= latency_hist_read,
+	.llseek		= default_llseek,
+	.release	= latency_hist_release,
+};
+
+static void cpufreq_stats_debugfs_init(void)
+{
+	cpufreq_stats_debugfs = debugfs_create_dir("cpufreq_stats", NULL);
+	if (IS_ERR_OR_NULL(cpufreq_stats_debugfs))
+		return;
+	debugfs_create_file("latency_hist", 0444, cpufreq_stats_debugfs,
+			    NULL, &latency_hist_fops);
+}
+
+static void cpufreq_stats_debugfs_exit(void)
+{
+	debugfs_remove_recursive(cpufreq_stats_debugfs);
+}
+#else
+static inline void cpufreq_stats_debugfs_init(void) { }
+static inline void cpufreq_stats_debugfs_exit(void) { }
+#endif
+
 static int __cpuinit cpufreq_stat_cpu_callback(struct notifier_block *nfb,
 					       unsigned long action,
 					       void *hcpu)
@@ -376,12 +679,14 @@ static int __init cpufreq_stats_init(void)
 	for_each_online_cpu(cpu) {
 		cpufreq_update_policy(cpu);
 	}
+	cpufreq_stats_debugfs_init();
 	return 0;
 }
 static void __exit cpufreq_stats_exit(void)
 {
 	unsigned int cpu;
 
+	cpufreq_stats_debugfs_exit();
 	cpufreq_unregister_notifier(&notifier_policy_block,
 			CPUFREQ_POLICY_NOTIFIER);
 	cpufreq_unregister_notifier(&notifier_trans_block,
@@ -156,6 +156,7 @@ struct mmc_blk_data {
 	struct device_attribute power_ro_lock;
 	int	area_type;
 	struct device_attribute num_wr_reqs_to_start_packing;
+	struct device_attribute urgent_read_preempt;
 };
 
 static DEFINE_MUTEX(open_lock);
@@ -340,6 +341,34 @@ num_wr_reqs_to_start_packing_store(struct device *dev,
 	return count;
 }
 
+static ssize_t
+urgent_read_preempt_show(struct device *dev,
+			 struct device_attribute *attr, char *buf)
+{
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	int ret;
+
+	ret = snprintf(buf, PAGE_SIZE, "%d\n", md->queue.urgent_read_preempt);
+
+	mmc_blk_put(md);
+	return ret;
+}
+
+static ssize_t
+urgent_read_preempt_store(struct device *dev,
+			  struct device_attribute *attr,
+			  const char *buf, size_t count)
+{
+	int value;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+
+	if (sscanf(buf, "%d", &value) == 1)
+		md->queue.urgent_read_preempt = !!value;
+
+	mmc_blk_put(md);
+	return count;
+}
+
 static int mmc_blk_open(struct block_device *bdev, fmode_t mode)
 {
 	struct mmc_blk_data *md = mmc_blk_get(bdev->bd_disk);
@@ -1785,6 +1814,7 @@ void mmc_blk_init_packed_statistics(struct mmc_card *card)
 	       sizeof(*card->wr_pack_stats.packing_events));
 	memset(&card->wr_pack_stats.pack_stop_reason, 0,
 		sizeof(card->wr_pack_stats.pack_stop_reason));
+	card->wr_pack_stats.urgent_read_requeued = 0;
 	card->wr_pack_stats.enabled = true;
 	spin_unlock(&card->wr_pack_stats.lock);
 }
@@ -1843,6 +1873,11 @@ void print_mmc_packing_stats(struct mmc_card *card)
 		pr_info("%s: %d times: Threshold\n",
 			mmc_hostname(card->host),
 			card->wr_pack_stats.pack_stop_reason[THRESHOLD]);
+	if (card->wr_pack_stats.pack_stop_reason[URGENT_READ])
+		pr_info("%s: %d times: urgent read, %d reqs re-queued\n",
+			mmc_hostname(card->host),
+			card->wr_pack_stats.pack_stop_reason[URGENT_READ],
+			card->wr_pack_stats.urgent_read_requeued);
 
 	spin_unlock(&card->wr_pack_stats.lock);
 }
@@ -2121,6 +2156,68 @@ static int mmc_blk_end_packed_req(struct mmc_queue *mq,
 	return ret;
 }
 
+static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc);
+
+/*
+ * A packed write can take long enough on the bus for a read queued behind
+ * it to stall the reader visibly, and the transfer in flight cannot be cut
+ * short.  The boundary between two requests is safe though: before a
+ * freshly packed write is started, let the request in flight complete and,
+ * if a synchronous read is waiting by then, put the whole packed group
+ * back on the queue and issue the read in its place.  The packed write
+ * that follows is never preempted, so a stream of reads cannot starve
+ * writes.  Returns the request to issue.
+ */
+static struct request *mmc_blk_urgent_read(struct mmc_queue *mq,
+					   struct request *rqc, u8 *reqs)
+{
+	struct request_queue *q = mq->queue;
+	struct mmc_card *card = mq->card;
+	struct mmc_queue_req *mqrq = mq->mqrq_cur;
+	struct mmc_wr_pack_stats *stats = &card->wr_pack_stats;
+	struct request *next, *prq;
+
+	if (mq->wr_preempted) {
+		mq->wr_preempted = false;
+		return rqc;
+	}
+
+	if (card->host->areq)
+		mmc_blk_issue_rw_rq(mq, NULL);
+
+	spin_lock_irq(q->queue_lock);
+	next = blk_peek_request(q);
+	if (!next || rq_data_dir(next) != READ || !rq_is_sync(next) ||
+			next->cmd_flags & (REQ_DISCARD | REQ_FLUSH | REQ_RAHEAD)) {
+		spin_unlock_irq(q->queue_lock);
+		return rqc;
+	}
+	blk_start_request(next);
+
+	/* requeued at the head of the queue, so put back the last one first */
+	while (!list_empty(&mqrq->packed_list)) {
+		prq = list_entry_rq(mqrq->packed_list.prev);
+		list_del_init(&prq->queuelist);
+		blk_requeue_request(q, prq);
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	spin_lock(&stats->lock);
+	if (stats->enabled) {
+		stats->pack_stop_reason[URGENT_READ]++;
+		stats->urgent_read_requeued += *reqs;
+	}
+	spin_unlock(&stats->lock);
+
+	mmc_blk_clear_packed(mqrq);
+	mqrq->req = next;
+	*reqs = 0;
+	mq->wr_preempted = true;
+	mmc_blk_write_packing_control(mq, next);
+
+	return next;
+}
+
 static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 {
 	struct mmc_blk_data *md = mq->data;
@@ -2133,6 +2230,7 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 	struct mmc_async_req *areq;
 	const u8 packed_num = 2;
 	u8 reqs = 0;
+	ktime_t t;
 
 	if (!rqc && !mq->mqrq_prev->req)
 		return 0;
@@ -2140,13 +2238,18 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 	if (rqc)
 		reqs = mmc_blk_prep_packed_list(mq, rqc);
 
+	if (reqs >= packed_num && mq->urgent_read_preempt)
+		rqc = mmc_blk_urgent_read(mq, rqc, &reqs);
+
 	do {
 		if (rqc) {
+			t = mmc_perf_now(card->host);
 			if (reqs >= packed_num)
 				mmc_blk_packed_hdr_wrq_prep(mq->mqrq_cur,
 						card, mq);
 			else
 				mmc_blk_rw_rq_prep(mq->mqrq_cur, card, 0, mq);
+			mmc_perf_account(card->host, MMC_PERF_PREP, t);
 			areq = &mq->mqrq_cur->mmc_active;
 			if (mmc_card_mmc(card)) {
 				/*
@@ -2194,12 +2297,17 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 			 */
 			mmc_blk_reset_success(md, type);
 
+			t = mmc_perf_now(card->host);
 			if (mq_rq->packed_cmd != MMC_PACKED_NONE) {
 				ret = mmc_blk_end_packed_req(mq, mq_rq);
+				mmc_perf_account(card->host,
+						 MMC_PERF_COMPLETE, t);
 				break;
 			} else {
 				ret = blk_end_request(req, 0,
 						brq->data.bytes_xfered);
+				mmc_perf_account(card->host,
+						 MMC_PERF_COMPLETE, t);
 			}
 
 			/*
@@ -2932,6 +3040,8 @@ static void mmc_blk_remove_req(struct mmc_blk_data *md)
 		card = md->queue.card;
 		device_remove_file(disk_to_dev(md->disk),
 				   &md->num_wr_reqs_to_start_packing);
+		device_remove_file(disk_to_dev(md->disk),
+				   &md->urgent_read_preempt);
 		if (md->disk->flags & GENHD_FL_UP) {
 			device_remove_file(disk_to_dev(md->disk), &md->force_ro);
 			if ((md->area_type & MMC_BLK_DATA_AREA_BOOT) &&
@@ -3012,8 +3122,21 @@ static int mmc_add_disk(struct mmc_blk_data *md)
 	if (ret)
 		goto power_ro_lock_fail;
 
+	md->urgent_read_preempt.show = urgent_read_preempt_show;
+	md->urgent_read_preempt.store = urgent_read_preempt_store;
+	sysfs_attr_init(&md->urgent_read_preempt.attr);
+	md->urgent_read_preempt.attr.name = "urgent_read_preempt";
+	md->urgent_read_preempt.attr.mode = S_IRUGO | S_IWUSR;
+	ret = device_create_file(disk_to_dev(md->disk),
+				 &md->urgent_read_preempt);
+	if (ret)
+		goto urgent_read_preempt_fail;
+
 	return ret;
 
+urgent_read_preempt_fail:
+		device_remove_file(disk_to_dev(md->disk),
+				   &md->num_wr_reqs_to_start_packing);
 power_ro_lock_fail:
 		device_remove_file(disk_to_dev(md->disk), &md->force_ro);
 force_ro_fail:
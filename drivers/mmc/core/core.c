@@ -139,6 +139,34 @@ static inline void mmc_should_fail_request(struct mmc_host *host,
 
 #endif /* CONFIG_FAIL_MMC_REQUEST */
 
+#ifdef CONFIG_MMC_PERF_PROFILING
+/**
+ *	mmc_perf_account - account time spent in a stage of a request
+ *	@host: MMC host the request runs on
+ *	@stage: stage that just ended
+ *	@start: start of the stage, from mmc_perf_now()
+ *
+ *	Each stage is only accounted from one context, the queue thread or
+ *	the host completion, so no locking is needed.
+ */
+void mmc_perf_account(struct mmc_host *host, enum mmc_perf_stages stage,
+		      ktime_t start)
+{
+	struct mmc_perf_stage *st = &host->perf.stage[stage];
+	u64 ns;
+
+	if (!host->perf_enable || !start.tv64)
+		return;
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	st->count++;
+	st->total_ns += ns;
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+}
+EXPORT_SYMBOL(mmc_perf_account);
+#endif
+
 /**
  *	mmc_request_done - finish processing an MMC request
  *	@host: MMC host which completed request
@@ -180,6 +208,9 @@ void mmc_request_done(struct mmc_host *host, struct mmc_request *mrq)
 		if (mrq->data) {
 #ifdef CONFIG_MMC_PERF_PROFILING
 			if (host->perf_enable) {
+				mmc_perf_account(host, MMC_PERF_XFER,
+						 host->perf.start);
+				host->perf.last_done = ktime_get();
 				diff = ktime_sub(ktime_get(), host->perf.start);
 				if (mrq->data->flags == MMC_DATA_READ) {
 					host->perf.rbytes_drv +=
@@ -472,23 +503,31 @@ struct mmc_async_req *mmc_start_req(struct mmc_host *host,
 	int err = 0;
 	int start_err = 0;
 	struct mmc_async_req *data = host->areq;
+	ktime_t t;
 
 	/* Prepare a new request */
-	if (areq)
+	if (areq) {
+		t = mmc_perf_now(host);
 		mmc_pre_req(host, areq->mrq, !host->areq);
+		mmc_perf_account(host, MMC_PERF_PRE_REQ, t);
+	}
 
 	if (host->areq) {
 #ifdef CONFIG_MMC_PERF_PROFILING
 		ktime_t io_diff = ktime_get(), wait_diff = ktime_get(), wait_ready = ktime_get();
 #endif
+		t = mmc_perf_now(host);
 		mmc_wait_for_req_done(host, host->areq->mrq);
+		mmc_perf_account(host, MMC_PERF_WAIT, t);
 #ifdef CONFIG_MMC_PERF_PROFILING
 		if (mmc_card_sd(host->card)) {
 			io_diff = ktime_sub(ktime_get(), host->areq->rq_stime);
 			wait_ready = ktime_get();
 		}
 #endif
+		t = mmc_perf_now(host);
 		err = host->areq->err_check(host->card, host->areq);
+		mmc_perf_account(host, MMC_PERF_ERR_CHECK, t);
 #ifdef CONFIG_MMC_PERF_PROFILING
 		if (mmc_card_sd(host->card)) {
 			wait_diff = ktime_sub(ktime_get(), wait_ready);
@@ -504,11 +543,18 @@ struct mmc_async_req *mmc_start_req(struct mmc_host *host,
 #ifdef CONFIG_MMC_PERF_PROFILING
 		if (mmc_card_sd(host->card))
 			areq->rq_stime = ktime_get();
+		/* only back to back requests say something about overhead */
+		if (data)
+			mmc_perf_account(host, MMC_PERF_GAP,
+					 host->perf.last_done);
 #endif
 		start_err = __mmc_start_req(host, areq->mrq);
 	}
-	if (host->areq)
+	if (host->areq) {
+		t = mmc_perf_now(host);
 		mmc_post_req(host, host->areq->mrq, 0);
+		mmc_perf_account(host, MMC_PERF_POST_REQ, t);
+	}
 
 	/* Cancel a prepared request if it was not started. */
 	if ((err || start_err) && areq)
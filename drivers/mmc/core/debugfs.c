@@ -159,6 +159,77 @@ static const struct file_operations mmc_ios_fops = {
 	.release	= single_release,
 };
 
+#ifdef CONFIG_MMC_PERF_PROFILING
+static const char * const mmc_perf_stage_names[MMC_PERF_NR_STAGES] = {
+	[MMC_PERF_PREP] = "prep",
+	[MMC_PERF_PRE_REQ] = "pre_req",
+	[MMC_PERF_GAP] = "gap",
+	[MMC_PERF_XFER] = "xfer",
+	[MMC_PERF_WAIT] = "wait",
+	[MMC_PERF_ERR_CHECK] = "err_check",
+	[MMC_PERF_POST_REQ] = "post_req",
+	[MMC_PERF_COMPLETE] = "complete",
+};
+
+/*
+ * Per-stage timing of data requests: xfer is controller time, gap the
+ * time the controller sat idle between two back to back requests, the
+ * other stages are host overhead.  Only the stages outside of the
+ * pre_req/xfer overlap delay the next request.
+ */
+static int mmc_pipeline_show(struct seq_file *s, void *data)
+{
+	struct mmc_host *host = s->private;
+	struct mmc_perf_stage *st;
+	int i;
+
+	if (!host->perf_enable) {
+		seq_printf(s, "profiling disabled, write 1 to perf\n");
+		return 0;
+	}
+
+	seq_printf(s, "%-10s %10s %12s %10s %10s\n",
+		   "stage", "count", "total_us", "avg_us", "max_us");
+	for (i = 0; i < MMC_PERF_NR_STAGES; i++) {
+		st = &host->perf.stage[i];
+		seq_printf(s, "%-10s %10lu %12llu %10llu %10llu\n",
+			   mmc_perf_stage_names[i], st->count,
+			   div_u64(st->total_ns, NSEC_PER_USEC),
+			   st->count ? div_u64(div_u64(st->total_ns,
+						       NSEC_PER_USEC),
+					       st->count) : 0,
+			   div_u64(st->max_ns, NSEC_PER_USEC));
+	}
+
+	return 0;
+}
+
+static int mmc_pipeline_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mmc_pipeline_show, inode->i_private);
+}
+
+static ssize_t mmc_pipeline_write(struct file *file, const char __user *ubuf,
+				  size_t cnt, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct mmc_host *host = s->private;
+
+	memset(host->perf.stage, 0, sizeof(host->perf.stage));
+	host->perf.last_done = ktime_set(0, 0);
+
+	return cnt;
+}
+
+static const struct file_operations mmc_pipeline_fops = {
+	.open		= mmc_pipeline_open,
+	.read		= seq_read,
+	.write		= mmc_pipeline_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
 static int mmc_clock_opt_get(void *data, u64 *val)
 {
 	struct mmc_host *host = data;
@@ -208,6 +279,11 @@ void mmc_add_host_debugfs(struct mmc_host *host)
 			&mmc_clock_fops))
 		goto err_node;
 
+#ifdef CONFIG_MMC_PERF_PROFILING
+	if (!debugfs_create_file("pipeline", S_IRUSR | S_IWUSR, root, host,
+				 &mmc_pipeline_fops))
+		goto err_node;
+#endif
 #ifdef CONFIG_MMC_CLKGATE
 	if (!debugfs_create_u32("clk_delay", (S_IRUSR | S_IWUSR),
 				root, &host->clk_delay))
@@ -432,6 +508,14 @@ static ssize_t mmc_wr_pack_stats_read(struct file *filp, char __user *ubuf,
 			pack_stats->pack_stop_reason[THRESHOLD]);
 		strlcat(ubuf, temp_buf, cnt);
 	}
+	if (pack_stats->pack_stop_reason[URGENT_READ]) {
+		snprintf(temp_buf, TEMP_BUF_SIZE,
+			 "%s: %d times: urgent read, %d reqs re-queued\n",
+			mmc_hostname(card->host),
+			pack_stats->pack_stop_reason[URGENT_READ],
+			pack_stats->urgent_read_requeued);
+		strlcat(ubuf, temp_buf, cnt);
+	}
 
 	spin_unlock(&pack_stats->lock);
 
@@ -0,0 +1,92 @@
+/* binder_trace.h
+ *
+ * Android IPC Subsystem tracepoints
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_BINDER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BINDER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Priorities are kernel priorities: 0..99 are real-time, 100..139 map to
+ * nice -20..19.
+ */
+TRACE_EVENT(binder_set_priority,
+	TP_PROTO(int proc, int thread, unsigned int old_prio,
+		 unsigned int desired_prio, unsigned int new_prio),
+	TP_ARGS(proc, thread, old_prio, desired_prio, new_prio),
+
+	TP_STRUCT__entry(
+		__field(int, proc)
+		__field(int, thread)
+		__field(unsigned int, old_prio)
+		__field(unsigned int, new_prio)
+		__field(unsigned int, desired_prio)
+	),
+	TP_fast_assign(
+		__entry->proc = proc;
+		__entry->thread = thread;
+		__entry->old_prio = old_prio;
+		__entry->new_prio = new_prio;
+		__entry->desired_prio = desired_prio;
+	),
+	TP_printk("proc=%d thread=%d old=%d => new=%d desired=%d",
+		  __entry->proc, __entry->thread, __entry->old_prio,
+		  __entry->new_prio, __entry->desired_prio)
+);
+
+/*
+ * A thread serving a synchronous transaction inherited the caller's
+ * priority. wait_ns is how long the transaction was pending at the lower
+ * priority before that happened.
+ */
+TRACE_EVENT(binder_priority_inversion,
+	TP_PROTO(int debug_id, int from_thread, int to_thread,
+		 unsigned int caller_prio, unsigned int thread_prio,
+		 s64 wait_ns),
+	TP_ARGS(debug_id, from_thread, to_thread, caller_prio, thread_prio,
+		wait_ns),
+
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, from_thread)
+		__field(int, to_thread)
+		__field(unsigned int, caller_prio)
+		__field(unsigned int, thread_prio)
+		__field(s64, wait_ns)
+	),
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->from_thread = from_thread;
+		__entry->to_thread = to_thread;
+		__entry->caller_prio = caller_prio;
+		__entry->thread_prio = thread_prio;
+		__entry->wait_ns = wait_ns;
+	),
+	TP_printk("transaction=%d from %d prio=%u to %d prio=%u waited=%lld ns",
+		  __entry->debug_id, __entry->from_thread,
+		  __entry->caller_prio, __entry->to_thread,
+		  __entry->thread_prio, __entry->wait_ns)
+);
+
+#endif /* _BINDER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE binder_trace
+#include <trace/define_trace.h>
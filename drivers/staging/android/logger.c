@@ -25,6 +25,11 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
+#include <linux/workqueue.h>
+#include <linux/lzo.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -33,19 +38,48 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Offsets into the log are free running and only reduced modulo the size of
+ * the buffer by logger_offset() when the buffer is accessed. Writers never
+ * take 'mutex', which only serializes readers against each other. A writer
+ * reserves its entry under 'lock', evicting whatever entries it is about to
+ * overwrite, then copies its payload without any lock while other writers do
+ * the same, and finally publishes it by advancing 'commit' in reservation
+ * order. Readers only look at entries before 'commit' and detect being lapped
+ * from 'w_off' instead of being fixed up by every writer.
  */
 struct logger_log {
 	unsigned char		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
+	struct mutex		mutex;	/* protects the readers */
+	spinlock_t		lock;	/* serializes reservations */
+	size_t			w_off;	/* end of last reservation */
+	size_t			commit;	/* entries before are complete */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	size_t			woken;	/* 'commit' at last wakeup */
+	struct timer_list	wake_timer; /* wakes readers of a quiet log */
+	struct logger_archive	*archive; /* compressed history, or NULL */
+};
+
+/*
+ * Readers are woken once this many bytes have been committed since the last
+ * wakeup, or after logger_wake_delay_ms for a log that is written slowly.
+ */
+static unsigned int logger_wake_bytes = 4096;
+static unsigned int logger_wake_delay_ms = 20;
+module_param_named(wake_bytes, logger_wake_bytes, uint, S_IRUGO | S_IWUSR);
+module_param_named(wake_delay_ms, logger_wake_delay_ms, uint,
+		   S_IRUGO | S_IWUSR);
+
+/* payloads are copied in here before a writer reserves its entry */
+struct logger_scratch {
+	unsigned char buf[LOGGER_ENTRY_MAX_PAYLOAD];
 };
+static DEFINE_PER_CPU(struct logger_scratch, logger_scratch);
 
 /*
  * struct logger_reader - a logging device open for reading
@@ -56,11 +90,21 @@ struct logger_log {
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	size_t			r_off;	/* next entry to read */
 	bool			r_all;	/* reader can read all entries */
 	int			r_ver;	/* reader ABI version */
+	unsigned char		*chunk_buf; /* last archived chunk read */
+	size_t			chunk_start; /* its first entry */
+	size_t			chunk_end; /* end of its last entry */
 };
 
+/* reader_in_chunk - is the reader's next entry in its decompressed chunk? */
+static inline bool reader_in_chunk(struct logger_reader *reader)
+{
+	return reader->r_off - reader->chunk_start <
+		reader->chunk_end - reader->chunk_start;
+}
+
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 size_t logger_offset(struct logger_log *log, size_t n)
 {
@@ -92,43 +136,44 @@ static inline struct logger_log *file_get_log(struct file *file)
 }
 
 /*
- * get_entry_header - returns a pointer to the logger_entry header within
- * 'log' starting at offset 'off'. A temporary logger_entry 'scratch' must
- * be provided. Typically the return value will be a pointer within
- * 'logger->buf'.  However, a pointer to 'scratch' may be returned if
- * the log entry spans the end and beginning of the circular buffer.
+ * logger_lapped - have writers reserved the space of the entry at 'off'?
+ *
+ * Once they have, its contents may be overwritten at any moment. Callers
+ * check after copying an entry out of the log, with a read barrier between
+ * the copy and the check; writers update w_off before writing.
  */
-static struct logger_entry *get_entry_header(struct logger_log *log,
-		size_t off, struct logger_entry *scratch)
-{
-	size_t len = min(sizeof(struct logger_entry), log->size - off);
-	if (len != sizeof(struct logger_entry)) {
-		memcpy(((void *) scratch), log->buffer + off, len);
-		memcpy(((void *) scratch) + len, log->buffer,
-			sizeof(struct logger_entry) - len);
-		return scratch;
-	}
-
-	return (struct logger_entry *) (log->buffer + off);
+static inline bool logger_lapped(struct logger_log *log, size_t off)
+{
+	return ACCESS_ONCE(log->w_off) - off > log->size;
 }
 
 /*
- * get_entry_msg_len - Grabs the length of the message of the entry
- * starting from from 'off'.
- *
- * An entry length is 2 bytes (16 bits) in host endian order.
- * In the log, the length does not include the size of the log entry structure.
- * This function returns the size including the log entry structure.
- *
- * Caller needs to hold log->mutex.
+ * copy_from_log - copies 'count' bytes starting at 'off' out of 'log',
+ * wrapping around the end of the ring.
  */
-static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
+static void copy_from_log(struct logger_log *log, void *buf, size_t off,
+			  size_t count)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
+	size_t len;
 
-	entry = get_entry_header(log, off, &scratch);
-	return entry->len;
+	off = logger_offset(log, off);
+	len = min(count, log->size - off);
+	memcpy(buf, log->buffer + off, len);
+	if (count != len)
+		memcpy(buf + len, log->buffer, count - len);
+}
+
+/*
+ * read_entry_header - copies the header of the entry at 'off' into 'entry'.
+ * Returns false if writers lapped the entry meanwhile, in which case the
+ * copy may be torn.
+ */
+static bool read_entry_header(struct logger_log *log, size_t off,
+			      struct logger_entry *entry)
+{
+	copy_from_log(log, entry, off, sizeof(struct logger_entry));
+	smp_rmb();
+	return !logger_lapped(log, off);
 }
 
 static size_t get_user_hdr_len(int ver)
@@ -163,19 +208,405 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 	return copy_to_user(buf, hdr, hdr_len);
 }
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+
+/*
+ * In compressed mode the ring of each log only gets a quarter of its
+ * buffer. As soon as LOGGER_CHUNK_SIZE bytes of entries have been
+ * committed, a worker copies them out of the ring, seals them into a chunk
+ * and stores the chunk LZO compressed in the rest of the buffer, the arena.
+ * Chunks are laid out in the arena in the order they were sealed and the
+ * oldest ones are dropped to make room. Readers lapped by the ring carry on
+ * with the archived chunks, each of which they decompress once into a
+ * private buffer.
+ */
+static bool logger_compress = true;
+module_param_named(compress, logger_compress, bool, S_IRUGO);
+
+#define LOGGER_CHUNK_SIZE	(16 * 1024)
+#define LOGGER_ARCHIVE_CHUNKS	256
+
+struct logger_chunk {
+	size_t		start;		/* offset of the first entry */
+	size_t		end;		/* end of the last entry */
+	size_t		arena_off;	/* where the chunk is stored */
+	size_t		len;		/* bytes stored */
+	bool		raw;		/* stored uncompressed */
+};
+
+/*
+ * struct logger_archive - the compressed history of a log
+ *
+ * The chunks and the arena are protected by log->mutex. 'off' is only used
+ * by the worker.
+ */
+struct logger_archive {
+	struct logger_log	*log;
+	struct work_struct	work;	/* seals and compresses chunks */
+	unsigned char		*arena;
+	size_t			arena_size;
+	size_t			tail;	/* arena offset of the next chunk */
+	struct logger_chunk	chunks[LOGGER_ARCHIVE_CHUNKS];
+	unsigned int		first;	/* oldest chunk */
+	unsigned int		nr;	/* number of chunks */
+	unsigned int		gen;	/* bumped by LOGGER_FLUSH_LOG */
+	size_t			off;	/* next entry to archive */
+};
+
+/* the worker's buffers, shared by all logs */
+static DEFINE_MUTEX(logger_archive_mutex);
+static unsigned char *logger_plain;
+static unsigned char *logger_packed;
+static void *logger_wrkmem;
+
+static inline struct logger_chunk *archive_chunk(struct logger_archive *a,
+						 unsigned int i)
+{
+	return &a->chunks[(a->first + i) % LOGGER_ARCHIVE_CHUNKS];
+}
+
+static inline void archive_drop_oldest(struct logger_archive *a)
+{
+	a->first = (a->first + 1) % LOGGER_ARCHIVE_CHUNKS;
+	a->nr--;
+}
+
+/*
+ * archive_store - stores a chunk of 'len' bytes covering the entries from
+ * 'start' to 'end', making room for it by dropping the oldest chunks.
+ *
+ * Caller must hold log->mutex.
+ */
+static void archive_store(struct logger_archive *a, size_t start, size_t end,
+			  const unsigned char *buf, size_t len, bool raw)
+{
+	struct logger_chunk *c;
+	size_t pos = a->tail;
+
+	if (a->nr == LOGGER_ARCHIVE_CHUNKS)
+		archive_drop_oldest(a);
+
+	if (pos + len > a->arena_size) {
+		/*
+		 * The chunks past the tail are the oldest ones; they go
+		 * along with the end of the arena, which is left unused.
+		 */
+		while (a->nr && archive_chunk(a, 0)->arena_off >= pos)
+			archive_drop_oldest(a);
+		pos = 0;
+	}
+	while (a->nr) {
+		c = archive_chunk(a, 0);
+		if (c->arena_off >= pos + len || c->arena_off + c->len <= pos)
+			break;
+		archive_drop_oldest(a);
+	}
+
+	memcpy(a->arena + pos, buf, len);
+	c = archive_chunk(a, a->nr++);
+	c->start = start;
+	c->end = end;
+	c->arena_off = pos;
+	c->len = len;
+	c->raw = raw;
+	a->tail = pos + len;
+}
+
+/*
+ * archive_seal - copies the committed entries from 'start' on, up to
+ * LOGGER_CHUNK_SIZE bytes of them, into logger_plain. Returns the offset
+ * after the last entry copied, or 'start' if the ring lapped the entries
+ * meanwhile.
+ */
+static size_t archive_seal(struct logger_log *log, size_t start,
+			   size_t commit)
+{
+	struct logger_entry entry;
+	size_t off = start;
+	size_t len;
+
+	while ((long)(commit - off) > 0) {
+		if (!read_entry_header(log, off, &entry))
+			return start;
+		len = sizeof(struct logger_entry) + entry.len;
+		if (off - start + len > LOGGER_CHUNK_SIZE)
+			break;
+		copy_from_log(log, logger_plain + off - start, off, len);
+		off += len;
+	}
+
+	smp_rmb();
+	if (logger_lapped(log, start))
+		return start;
+	return off;
+}
+
+static void logger_archive_work(struct work_struct *work)
+{
+	struct logger_archive *a = container_of(work, struct logger_archive,
+						work);
+	struct logger_log *log = a->log;
+	size_t start, end, commit, len;
+	unsigned int gen;
+	bool raw;
+
+	mutex_lock(&logger_archive_mutex);
+	for (;;) {
+		gen = ACCESS_ONCE(a->gen);
+		smp_rmb();
+		/* whatever the head has passed was evicted or flushed */
+		start = a->off;
+		if ((long)(ACCESS_ONCE(log->head) - start) > 0)
+			start = ACCESS_ONCE(log->head);
+		a->off = start;
+
+		commit = ACCESS_ONCE(log->commit);
+		if ((long)(commit - start) < LOGGER_CHUNK_SIZE)
+			break;
+		/* pairs with the barrier before the commit in logger_commit */
+		smp_rmb();
+
+		end = archive_seal(log, start, commit);
+		if (end == start)
+			continue;
+
+		len = lzo1x_worst_compress(LOGGER_CHUNK_SIZE);
+		raw = lzo1x_1_compress(logger_plain, end - start, logger_packed,
+				       &len, logger_wrkmem) != LZO_E_OK ||
+			len >= end - start;
+		if (raw)
+			len = end - start;
+
+		mutex_lock(&log->mutex);
+		if (a->gen == gen)
+			archive_store(a, start, end,
+				      raw ? logger_plain : logger_packed,
+				      len, raw);
+		mutex_unlock(&log->mutex);
+
+		a->off = end;
+	}
+	mutex_unlock(&logger_archive_mutex);
+}
+
+/*
+ * logger_archive_kick - has a chunk worth of entries been committed since
+ * the last one was sealed? Called by writers after their commit.
+ */
+static void logger_archive_kick(struct logger_log *log)
+{
+	struct logger_archive *a = log->archive;
+
+	if (a && (long)(ACCESS_ONCE(log->commit) - ACCESS_ONCE(a->off)) >=
+	    LOGGER_CHUNK_SIZE && !work_pending(&a->work))
+		schedule_work(&a->work);
+}
+
+/*
+ * logger_archive_load - decompresses the first archived chunk holding
+ * entries at or after the reader's offset into the reader's chunk buffer,
+ * moving the reader up to that chunk. Returns false if there is none.
+ * This is on the way to sleeping in logger_read(), so it must not allocate.
+ *
+ * Caller must hold log->mutex.
+ */
+static bool logger_archive_load(struct logger_log *log,
+				struct logger_reader *reader)
+{
+	struct logger_archive *a = log->archive;
+	struct logger_chunk *c = NULL;
+	size_t len = LOGGER_CHUNK_SIZE;
+	unsigned int i;
+
+	if (!a)
+		return false;
+
+	for (i = 0; i < a->nr; i++) {
+		c = archive_chunk(a, i);
+		if ((long)(c->end - reader->r_off) > 0)
+			break;
+	}
+	if (i == a->nr)
+		return false;
+
+	reader->chunk_end = reader->chunk_start = 0;
+	if (c->raw) {
+		memcpy(reader->chunk_buf, a->arena + c->arena_off, c->len);
+		len = c->len;
+	} else if (lzo1x_decompress_safe(a->arena + c->arena_off, c->len,
+					 reader->chunk_buf, &len) != LZO_E_OK ||
+		   len != c->end - c->start) {
+		printk(KERN_ERR "logger: corrupt chunk in log '%s'\n",
+		       log->misc.name);
+		return false;
+	}
+	reader->chunk_start = c->start;
+	reader->chunk_end = c->end;
+
+	if ((long)(c->start - reader->r_off) > 0)
+		reader->r_off = c->start;
+	return true;
+}
+
+/*
+ * logger_first - where a new reader starts: the oldest entry still archived
+ * or in the ring.
+ *
+ * Caller must hold log->mutex.
+ */
+static size_t logger_first(struct logger_log *log)
+{
+	struct logger_archive *a = log->archive;
+	size_t head = ACCESS_ONCE(log->head);
+
+	if (a && a->nr && (long)(head - archive_chunk(a, 0)->start) > 0)
+		return archive_chunk(a, 0)->start;
+	return head;
+}
+
+/*
+ * logger_buf_size - the size reported for the log: the ring plus the arena
+ * its history is compressed into, or the history held if that is more, so
+ * that no reader is ever behind by more than the log size.
+ *
+ * Caller must hold log->mutex.
+ */
+static size_t logger_buf_size(struct logger_log *log)
+{
+	size_t size = log->size, held;
+
+	if (!log->archive)
+		return size;
+
+	size += log->archive->arena_size;
+	held = ACCESS_ONCE(log->commit) - logger_first(log);
+	return max(size, held);
+}
+
+/*
+ * logger_archive_reader_init - gives a new reader of a compressed log the
+ * buffer its archived chunks are decompressed into.
+ */
+static int logger_archive_reader_init(struct logger_log *log,
+				      struct logger_reader *reader)
+{
+	reader->chunk_buf = NULL;
+	if (!log->archive)
+		return 0;
+
+	reader->chunk_buf = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+	return reader->chunk_buf ? 0 : -ENOMEM;
+}
+
+/*
+ * logger_archive_flush - drops the archive along with the ring.
+ *
+ * Caller must hold log->mutex.
+ */
+static void logger_archive_flush(struct logger_log *log)
+{
+	struct logger_archive *a = log->archive;
+
+	if (!a)
+		return;
+	a->first = a->nr = 0;
+	a->tail = 0;
+	a->gen++;
+}
+
+static int __init logger_archive_init(struct logger_log *log)
+{
+	struct logger_archive *a;
+
+	if (!logger_compress)
+		return 0;
+
+	if (!logger_plain) {
+		logger_plain = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+		logger_packed = kmalloc(lzo1x_worst_compress(LOGGER_CHUNK_SIZE),
+					GFP_KERNEL);
+		logger_wrkmem = kmalloc(LZO1X_1_MEM_COMPRESS, GFP_KERNEL);
+		if (!logger_plain || !logger_packed || !logger_wrkmem)
+			goto nomem;
+	}
+
+	a = kzalloc(sizeof(struct logger_archive), GFP_KERNEL);
+	if (!a)
+		goto nomem;
+	a->log = log;
+	INIT_WORK(&a->work, logger_archive_work);
+
+	/* nothing has been written yet, so the ring can still shrink */
+	log->size /= 4;
+	a->arena = log->buffer + log->size;
+	a->arena_size = log->size * 3;
+	log->archive = a;
+	return 0;
+
+nomem:
+	kfree(logger_plain);
+	kfree(logger_packed);
+	kfree(logger_wrkmem);
+	logger_plain = logger_packed = logger_wrkmem = NULL;
+	logger_compress = false;
+	return -ENOMEM;
+}
+
+#else
+
+static inline void logger_archive_kick(struct logger_log *log)
+{
+}
+
+static inline bool logger_archive_load(struct logger_log *log,
+				       struct logger_reader *reader)
+{
+	return false;
+}
+
+static inline size_t logger_first(struct logger_log *log)
+{
+	return log->head;
+}
+
+static inline size_t logger_buf_size(struct logger_log *log)
+{
+	return log->size;
+}
+
+static inline int logger_archive_reader_init(struct logger_log *log,
+					     struct logger_reader *reader)
+{
+	reader->chunk_buf = NULL;
+	return 0;
+}
+
+static inline void logger_archive_flush(struct logger_log *log)
+{
+}
+
+static inline int logger_archive_init(struct logger_log *log)
+{
+	return 0;
+}
+
+#endif /* CONFIG_ANDROID_LOGGER_COMPRESS */
+
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * do_read_log_to_user - reads exactly 'count' bytes of the entry at the
+ * reader's offset, whose header is 'entry', into the user-space buffer 'buf'.
+ * Returns 'count' on success and -EAGAIN if writers lapped the reader during
+ * the copy, in which case the user buffer holds garbage and the caller needs
+ * to start over.
  *
  * Caller must hold log->mutex.
  */
 static ssize_t do_read_log_to_user(struct logger_log *log,
 				   struct logger_reader *reader,
+				   struct logger_entry *entry,
 				   char __user *buf,
 				   size_t count)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
 	size_t len;
 	size_t msg_start;
 
@@ -183,12 +614,21 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * First, copy the header to userspace, using the version of
 	 * the header requested
 	 */
-	entry = get_entry_header(log, reader->r_off, &scratch);
 	if (copy_header_to_user(reader->r_ver, entry, buf))
 		return -EFAULT;
 
 	count -= get_user_hdr_len(reader->r_ver);
 	buf += get_user_hdr_len(reader->r_ver);
+
+	/* archived entries never change once decompressed */
+	if (reader_in_chunk(reader)) {
+		if (copy_to_user(buf, reader->chunk_buf + reader->r_off -
+				 reader->chunk_start +
+				 sizeof(struct logger_entry), count))
+			return -EFAULT;
+		goto out;
+	}
+
 	msg_start = logger_offset(log,
 		reader->r_off + sizeof(struct logger_entry));
 
@@ -209,34 +649,54 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(log, reader->r_off +
-		sizeof(struct logger_entry) + count);
+	smp_rmb();
+	if (logger_lapped(log, reader->r_off))
+		return -EAGAIN;
+
+out:
+	reader->r_off += sizeof(struct logger_entry) + count;
 
 	return count + get_user_hdr_len(reader->r_ver);
 }
 
 /*
- * get_next_entry_by_uid - Starting at 'off', returns an offset into
- * 'log->buffer' which contains the first entry readable by 'euid'
+ * reader_next_entry - finds the next entry 'reader' may read, skipping those
+ * of other users unless it may read everything, and copies its header into
+ * 'entry'. A reader lapped by the writers carries on in the archive, if
+ * there is one, and otherwise restarts at the oldest entry of the ring.
+ * Returns false if there is nothing to read.
+ *
+ * Caller must hold log->mutex.
  */
-static size_t get_next_entry_by_uid(struct logger_log *log,
-		size_t off, uid_t euid)
+static bool reader_next_entry(struct logger_log *log,
+			      struct logger_reader *reader,
+			      struct logger_entry *entry)
 {
-	while (off != log->w_off) {
-		struct logger_entry *entry;
-		struct logger_entry scratch;
-		size_t next_len;
-
-		entry = get_entry_header(log, off, &scratch);
-
-		if (entry->euid == euid)
-			return off;
-
-		next_len = sizeof(struct logger_entry) + entry->len;
-		off = logger_offset(log, off + next_len);
+	for (;;) {
+		if (reader_in_chunk(reader)) {
+			memcpy(entry, reader->chunk_buf +
+			       reader->r_off - reader->chunk_start,
+			       sizeof(struct logger_entry));
+		} else if (logger_lapped(log, reader->r_off)) {
+			if (!logger_archive_load(log, reader))
+				reader->r_off = ACCESS_ONCE(log->head);
+			continue;
+		} else {
+			if ((long)(ACCESS_ONCE(log->commit) -
+				   reader->r_off) <= 0)
+				return false;
+			/*
+			 * pairs with the barrier before the commit in
+			 * logger_commit
+			 */
+			smp_rmb();
+			if (!read_entry_header(log, reader->r_off, entry))
+				continue;
+		}
+		if (reader->r_all || entry->euid == current_euid())
+			return true;
+		reader->r_off += sizeof(struct logger_entry) + entry->len;
 	}
-
-	return off;
 }
 
 /*
@@ -256,6 +716,7 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	struct logger_entry entry;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -265,7 +726,7 @@ start:
 
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		ret = (log->w_off == reader->r_off);
+		ret = !reader_next_entry(log, reader, &entry);
 		mutex_unlock(&log->mutex);
 		if (!ret)
 			break;
@@ -289,26 +750,27 @@ start:
 
 	mutex_lock(&log->mutex);
 
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
+	if (unlikely(!reader_next_entry(log, reader, &entry))) {
 		mutex_unlock(&log->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
+	ret = get_user_hdr_len(reader->r_ver) + entry.len;
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
 	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	ret = do_read_log_to_user(log, reader, &entry, buf, ret);
+
+	/* lapped while copying: what we copied may be torn, start over */
+	if (unlikely(ret == -EAGAIN)) {
+		mutex_unlock(&log->mutex);
+		goto start;
+	}
 
 out:
 	mutex_unlock(&log->mutex);
@@ -317,140 +779,152 @@ out:
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
- *
- * Caller must hold log->mutex.
+ * copy_to_log - copies 'count' bytes from 'buf' into 'log' at 'off',
+ * wrapping around the end of the ring.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static void copy_to_log(struct logger_log *log, size_t off, const void *buf,
+			size_t count)
 {
-	size_t count = 0;
-
-	do {
-		size_t nr = sizeof(struct logger_entry) +
-			get_entry_msg_len(log, off);
-		off = logger_offset(log, off + nr);
-		count += nr;
-	} while (count < len);
+	size_t len;
 
-	return off;
+	off = logger_offset(log, off);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
+	if (count != len)
+		memcpy(log->buffer, buf + len, count - len);
 }
 
 /*
- * is_between - is a < c < b, accounting for wrapping of a, b, and c
- *    positions in the buffer
- *
- * That is, if a<b, check for c between a and b
- * and if a>b, check for c outside (not between) a and b
- *
- * |------- a xxxxxxxx b --------|
- *               c^
+ * logger_reserve - reserves room for an entry of 'count' bytes, header
+ * included, and writes its header. Returns the offset of the entry.
  *
- * |xxxxx b --------- a xxxxxxxxx|
- *    c^
- *  or                    c^
+ * Entries the reservation overwrites are dropped by moving the head past
+ * them; their headers are always valid since they are written here under
+ * the lock. Readers that were still on them notice on their own through
+ * logger_lapped().
  */
-static inline int is_between(size_t a, size_t b, size_t c)
+static size_t logger_reserve(struct logger_log *log,
+			     struct logger_entry *header, size_t count)
 {
-	if (a < b) {
-		/* is c between a and b? */
-		if (a < c && c <= b)
-			return 1;
-	} else {
-		/* is c outside of b through a? */
-		if (c <= b || a < c)
-			return 1;
+	struct logger_entry old;
+	size_t start;
+
+	spin_lock(&log->lock);
+	start = log->w_off;
+	while ((long)(start + count - log->size - log->head) > 0) {
+		copy_from_log(log, &old, log->head, sizeof(old));
+		log->head += sizeof(struct logger_entry) + old.len;
 	}
+	log->w_off = start + count;
+	/* readers must see the new w_off before any of the new contents */
+	smp_wmb();
+	copy_to_log(log, start, header, sizeof(struct logger_entry));
+	spin_unlock(&log->lock);
 
-	return 0;
+	return start;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * logger_commit - publishes the entry of 'count' bytes reserved at 'start'.
  *
- * The caller needs to hold log->mutex.
+ * Entries are published in the order they were reserved, so this waits for
+ * the writers that reserved before us. They all run with preemption
+ * disabled from reservation to commit and copy at most one entry from
+ * kernel memory, so the wait is short.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void logger_commit(struct logger_log *log, size_t start, size_t count)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(log, old + len);
-	struct logger_reader *reader;
+	while (ACCESS_ONCE(log->commit) != start)
+		cpu_relax();
+	/* pairs with the barrier in reader_next_entry */
+	smp_wmb();
+	ACCESS_ONCE(log->commit) = start + count;
+}
 
-	if (is_between(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+static void logger_wake_timer(unsigned long data)
+{
+	struct logger_log *log = (struct logger_log *)data;
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (is_between(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	log->woken = ACCESS_ONCE(log->commit);
+	wake_up_interruptible(&log->wq);
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
- *
- * The caller needs to hold log->mutex.
+ * logger_wake_readers - wakes up blocked readers once enough has been
+ * written since they were last woken, and otherwise leaves it to the wake
+ * timer, so that a chatty log wakes its readers once per batch of entries
+ * rather than on every write.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void logger_wake_readers(struct logger_log *log)
 {
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
-
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log, log->w_off + count);
-
+	size_t commit;
+
+	/* pairs with the barrier in prepare_to_wait() */
+	smp_mb();
+	if (!waitqueue_active(&log->wq))
+		return;
+
+	commit = ACCESS_ONCE(log->commit);
+	if (commit - ACCESS_ONCE(log->woken) >= logger_wake_bytes) {
+		log->woken = commit;
+		wake_up_interruptible(&log->wq);
+	} else if (!timer_pending(&log->wake_timer))
+		mod_timer(&log->wake_timer,
+			  jiffies + msecs_to_jiffies(logger_wake_delay_ms));
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
+ * copy_payload - gathers 'count' bytes of the user-space iovec into 'buf'.
+ * With 'atomic' set no fault is taken, so this can run with preemption
+ * disabled, and -EFAULT is also returned if a page was not present.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static ssize_t copy_payload(void *buf, const struct iovec *iov,
+			    unsigned long nr_segs, size_t count, bool atomic)
 {
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
-
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			/*
-			 * Note that by not updating w_off, this abandons the
-			 * portion of the new entry that *was* successfully
-			 * copied, just above.  This is intentional to avoid
-			 * message corruption from missing fragments.
-			 */
+	size_t done = 0;
+
+	while (nr_segs-- > 0 && done < count) {
+		size_t len = min_t(size_t, iov->iov_len, count - done);
+		unsigned long left;
+
+		if (atomic) {
+			if (!access_ok(VERIFY_READ, iov->iov_base, len))
+				return -EFAULT;
+			pagefault_disable();
+			left = __copy_from_user_inatomic(buf + done,
+							 iov->iov_base, len);
+			pagefault_enable();
+		} else
+			left = copy_from_user(buf + done, iov->iov_base, len);
+		if (left)
 			return -EFAULT;
 
-	log->w_off = logger_offset(log, log->w_off + count);
+		iov++;
+		done += len;
+	}
 
-	return count;
+	return done;
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The payload is copied from userspace before anything is reserved, so that
+ * a fault never leaves a hole in the log and writers on other CPUs never
+ * wait for one; only the reservation itself is serialized.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
-	ssize_t ret = 0;
+	unsigned char *payload;
+	unsigned char *slow = NULL;
+	size_t start, count;
+	ssize_t ret;
 
 	now = current_kernel_time();
 
@@ -466,43 +940,39 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
-
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
-
-		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+	payload = get_cpu_var(logger_scratch).buf;
+	ret = copy_payload(payload, iov, nr_segs, header.len, true);
+	if (unlikely(ret < 0)) {
+		/* the payload is not resident, copy it the slow way */
+		put_cpu_var(logger_scratch);
+		slow = kmalloc(header.len, GFP_KERNEL);
+		if (!slow)
+			return -ENOMEM;
+		ret = copy_payload(slow, iov, nr_segs, header.len, false);
+		if (ret < 0) {
+			kfree(slow);
+			return ret;
 		}
-
-		iov++;
-		ret += nr;
+		payload = slow;
+		preempt_disable();
 	}
 
-	mutex_unlock(&log->mutex);
+	count = sizeof(struct logger_entry) + header.len;
+	start = logger_reserve(log, &header, count);
+	copy_to_log(log, start + sizeof(struct logger_entry), payload,
+		    header.len);
+	logger_commit(log, start, count);
 
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	if (slow) {
+		preempt_enable();
+		kfree(slow);
+	} else
+		put_cpu_var(logger_scratch);
 
-	return ret;
+	logger_wake_readers(log);
+	logger_archive_kick(log);
+
+	return header.len;
 }
 
 static struct logger_log *get_log_from_minor(int);
@@ -531,16 +1001,21 @@ static int logger_open(struct inode *inode, struct file *file)
 		reader = kmalloc(sizeof(struct logger_reader), GFP_KERNEL);
 		if (!reader)
 			return -ENOMEM;
+		if (logger_archive_reader_init(log, reader)) {
+			kfree(reader);
+			return -ENOMEM;
+		}
 
 		reader->log = log;
 		reader->r_ver = 1;
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
+		reader->chunk_start = reader->chunk_end = 0;
 
 		INIT_LIST_HEAD(&reader->list);
 
 		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
+		reader->r_off = logger_first(log);
 		list_add_tail(&reader->list, &log->readers);
 		mutex_unlock(&log->mutex);
 
@@ -566,6 +1041,7 @@ static int logger_release(struct inode *ignored, struct file *file)
 		list_del(&reader->list);
 		mutex_unlock(&log->mutex);
 
+		kfree(reader->chunk_buf);
 		kfree(reader);
 	}
 
@@ -585,6 +1061,7 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 {
 	struct logger_reader *reader;
 	struct logger_log *log;
+	struct logger_entry entry;
 	unsigned int ret = POLLOUT | POLLWRNORM;
 
 	if (!(file->f_mode & FMODE_READ))
@@ -596,11 +1073,7 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
-	if (log->w_off != reader->r_off)
+	if (reader_next_entry(log, reader, &entry))
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
 
@@ -624,6 +1097,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_entry entry;
+	size_t off;
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
 
@@ -631,7 +1106,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
-		ret = log->size;
+		ret = logger_buf_size(log);
 		break;
 	case LOGGER_GET_LOG_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -639,10 +1114,11 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		off = reader->r_off;
+		if (!reader_in_chunk(reader) && logger_lapped(log, off) &&
+		    (long)(logger_first(log) - off) > 0)
+			off = logger_first(log);
+		ret = ACCESS_ONCE(log->commit) - off;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -651,13 +1127,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		}
 		reader = file->private_data;
 
-		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
-
-		if (log->w_off != reader->r_off)
-			ret = get_user_hdr_len(reader->r_ver) +
-				get_entry_msg_len(log, reader->r_off);
+		if (reader_next_entry(log, reader, &entry))
+			ret = get_user_hdr_len(reader->r_ver) + entry.len;
 		else
 			ret = 0;
 		break;
@@ -666,9 +1137,13 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
+		/* entries still being copied in are flushed as well */
+		spin_lock(&log->lock);
 		log->head = log->w_off;
+		spin_unlock(&log->lock);
+		logger_archive_flush(log);
+		list_for_each_entry(reader, &log->readers, list)
+			reader->r_off = log->head;
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -723,9 +1198,14 @@ static struct logger_log VAR = { \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
+	.commit = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	.woken = 0, \
+	.wake_timer = TIMER_INITIALIZER(logger_wake_timer, 0, \
+				       (unsigned long)&VAR), \
 };
 
 DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 256*1024)
@@ -750,6 +1230,11 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	ret = logger_archive_init(log);
+	if (unlikely(ret))
+		printk(KERN_WARNING "logger: no memory to compress log '%s'\n",
+		       log->misc.name);
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
@@ -757,8 +1242,9 @@ static int __init init_log(struct logger_log *log)
 		return ret;
 	}
 
-	printk(KERN_INFO "logger: created %luK log '%s'\n",
-	       (unsigned long) log->size >> 10, log->misc.name);
+	printk(KERN_INFO "logger: created %luK log '%s'%s\n",
+	       (unsigned long) log->size >> 10, log->misc.name,
+	       log->archive ? " with compressed history" : "");
 
 	return 0;
 }
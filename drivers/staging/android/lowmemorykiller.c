@@ -17,6 +17,18 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Victims are taken from the highest oom_score_adj down, largest RSS plus
+ * swap first. When free memory is far below the threshold several of them
+ * (at most /sys/module/lowmemorykiller/parameters/kill_max) are killed in the
+ * same pass. /sys/module/lowmemorykiller/parameters/stats reports the number
+ * of kills, of shrink passes that wanted to kill, and the time from entering
+ * the shrinker to sending the signal.
+ *
+ * With /sys/module/lowmemorykiller/parameters/vmpressure set, the reclaim
+ * pressure reported by mm/vmpressure.c refines the decision: while reclaim
+ * is still efficient only the lowest minfree level kills, and once it is
+ * critical page cache no longer counts as free memory.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -39,6 +51,10 @@
 #include <linux/notifier.h>
 #include <linux/mutex.h>
 #include <linux/delay.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/vmpressure.h>
 
 static uint32_t lowmem_debug_level = 1;
 static int lowmem_adj[6] = {
@@ -58,6 +74,29 @@ static int lowmem_minfree_size = 4;
 
 static unsigned long lowmem_deathpending_timeout;
 
+/* most tasks killed in one pass, however large the deficit */
+static int lowmem_kill_max = 4;
+
+/*
+ * Candidates looked at in one pass: every thread group at the highest
+ * qualifying oom_score_adj, up to LOWMEM_SCAN_MAX, then lower ones until
+ * there are LOWMEM_SCAN_BATCH.
+ */
+#define LOWMEM_SCAN_BATCH 16
+#define LOWMEM_SCAN_MAX 128
+
+/* last level reported by vmpressure, trusted for a second */
+static bool lowmem_use_vmpressure = true;
+static enum vmpressure_levels lowmem_vmpressure_level;
+static unsigned long lowmem_vmpressure_stamp;
+
+static struct {
+	unsigned int scans;
+	unsigned int kills;
+	u64 kill_latency_us_total;
+	unsigned int kill_latency_us_max;
+} lowmem_stats;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -139,22 +178,164 @@ static int test_task_flag(struct task_struct *p, int flag)
 	return 0;
 }
 
+/*
+ * Thread groups sorted by oom_score_adj, so that a shrink pass starts from
+ * the most killable processes instead of walking the whole task list. The
+ * tree is updated on fork, on release of the group leader and whenever
+ * oom_score_adj is written; those callers hold siglock or tasklist_lock with
+ * interrupts disabled, so the lock is always taken irq-safe.
+ */
+static DEFINE_SPINLOCK(lowmem_adj_lock);
+static struct rb_root lowmem_adj_tree = RB_ROOT;
+
+static void __lowmem_adj_tree_add(struct signal_struct *sig)
+{
+	struct rb_node **link = &lowmem_adj_tree.rb_node;
+	struct rb_node *parent = NULL;
+	struct signal_struct *entry;
+
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct signal_struct, adj_node);
+		if (sig->oom_score_adj < entry->oom_score_adj)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&sig->adj_node, parent, link);
+	rb_insert_color(&sig->adj_node, &lowmem_adj_tree);
+}
+
+static void __lowmem_adj_tree_del(struct signal_struct *sig)
+{
+	if (RB_EMPTY_NODE(&sig->adj_node))
+		return;
+	rb_erase(&sig->adj_node, &lowmem_adj_tree);
+	RB_CLEAR_NODE(&sig->adj_node);
+}
+
+void lowmem_adj_tree_add(struct task_struct *task)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	__lowmem_adj_tree_add(task->signal);
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+}
+
+void lowmem_adj_tree_del(struct task_struct *task)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	__lowmem_adj_tree_del(task->signal);
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+}
+
+void lowmem_adj_tree_update(struct task_struct *task)
+{
+	struct signal_struct *sig = task->signal;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	if (!RB_EMPTY_NODE(&sig->adj_node)) {
+		__lowmem_adj_tree_del(sig);
+		__lowmem_adj_tree_add(sig);
+	}
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+}
+
+struct lowmem_victim {
+	struct task_struct *task;
+	int oom_score_adj;
+	int size;
+};
+
+/*
+ * Whether any thread of the group still has an mm. Only a hint, taken
+ * without task_lock; find_lock_task_mm() has the final word.
+ */
+static bool lowmem_has_mm(struct task_struct *p)
+{
+	struct task_struct *t = p;
+
+	do {
+		if (ACCESS_ONCE(t->mm))
+			return true;
+	} while_each_thread(p, t);
+
+	return false;
+}
+
+/*
+ * Take a reference on the thread groups with oom_score_adj >=
+ * min_score_adj, highest first: all of those at the highest adj, then
+ * lower ones up to LOWMEM_SCAN_BATCH. Groups without memory left, such as
+ * zombies, are skipped. The tasks are examined after the tree lock is
+ * dropped because task_lock nests outside it.
+ */
+static int lowmem_collect(struct task_struct **tasks, int min_score_adj)
+{
+	struct rb_node *node;
+	int top_adj = OOM_SCORE_ADJ_MAX + 1;
+	int n = 0;
+
+	rcu_read_lock();
+	spin_lock_irq(&lowmem_adj_lock);
+	for (node = rb_last(&lowmem_adj_tree); node && n < LOWMEM_SCAN_MAX;
+	     node = rb_prev(node)) {
+		struct signal_struct *sig;
+		struct task_struct *tsk;
+
+		sig = rb_entry(node, struct signal_struct, adj_node);
+		if (sig->oom_score_adj < min_score_adj)
+			break;
+		if (n >= LOWMEM_SCAN_BATCH && sig->oom_score_adj < top_adj)
+			break;
+		tsk = sig->curr_target;
+		if (!tsk || (tsk->flags & PF_KTHREAD) || !lowmem_has_mm(tsk))
+			continue;
+		if (!n)
+			top_adj = sig->oom_score_adj;
+		get_task_struct(tsk);
+		tasks[n++] = tsk;
+	}
+	spin_unlock_irq(&lowmem_adj_lock);
+	rcu_read_unlock();
+
+	return n;
+}
+
+/* highest oom_score_adj first, then most memory released by the kill */
+static int lowmem_victim_before(struct lowmem_victim *a,
+				struct lowmem_victim *b)
+{
+	if (a->oom_score_adj != b->oom_score_adj)
+		return a->oom_score_adj > b->oom_score_adj;
+	return a->size > b->size;
+}
+
 static DEFINE_MUTEX(scan_mutex);
 
+/* too large for the stack, protected by scan_mutex */
+static struct task_struct *lowmem_tasks[LOWMEM_SCAN_MAX];
+static struct lowmem_victim lowmem_victims[LOWMEM_SCAN_MAX];
+
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct task_struct *tsk;
-	struct task_struct *selected = NULL;
+	struct task_struct **tasks = lowmem_tasks;
+	struct lowmem_victim *victims = lowmem_victims;
+	int nr_tasks, nr_victims = 0;
 	int rem = 0;
-	int tasksize;
-	int i;
+	int i, j;
 	int min_score_adj = OOM_SCORE_ADJ_MAX + 1;
-	int selected_tasksize = 0;
-	int selected_oom_score_adj;
+	int minfree = 0;
+	int deficit, freed = 0, killed = 0;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free;
 	int other_file;
 	unsigned long nr_to_scan = sc->nr_to_scan;
+	ktime_t start = ktime_get();
 
 	if (nr_to_scan > 0) {
 		if (mutex_lock_interruptible(&scan_mutex) < 0)
@@ -182,6 +363,31 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		if (other_free < lowmem_minfree[i] &&
 		    other_file < lowmem_minfree[i]) {
 			min_score_adj = lowmem_adj[i];
+			minfree = lowmem_minfree[i];
+			break;
+		}
+	}
+	if (lowmem_use_vmpressure && lowmem_vmpressure_stamp &&
+	    time_before(jiffies, lowmem_vmpressure_stamp + HZ)) {
+		switch (lowmem_vmpressure_level) {
+		case VMPRESSURE_LOW:
+			/* reclaim keeps up with the cache: spare cached apps */
+			if (i > 0) {
+				min_score_adj = OOM_SCORE_ADJ_MAX + 1;
+				minfree = 0;
+			}
+			break;
+		case VMPRESSURE_CRITICAL:
+			/* thrashing: the file cache is not coming back */
+			for (i = 0; i < array_size; i++) {
+				if (other_free < lowmem_minfree[i]) {
+					min_score_adj = lowmem_adj[i];
+					minfree = lowmem_minfree[i];
+					break;
+				}
+			}
+			break;
+		default:
 			break;
 		}
 	}
@@ -202,69 +408,92 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 
 		return rem;
 	}
-	selected_oom_score_adj = min_score_adj;
+	lowmem_stats.scans++;
+	deficit = minfree - other_free;
 
-	rcu_read_lock();
-	for_each_process(tsk) {
+	nr_tasks = lowmem_collect(tasks, min_score_adj);
+	for (i = 0; i < nr_tasks; i++) {
+		struct task_struct *tsk = tasks[i];
 		struct task_struct *p;
-		int oom_score_adj;
-
-		if (tsk->flags & PF_KTHREAD)
-			continue;
+		struct lowmem_victim v;
 
+		rcu_read_lock();
 		/* if task no longer has any memory ignore it */
-		if (test_task_flag(tsk, TIF_MM_RELEASED))
+		if (test_task_flag(tsk, TIF_MM_RELEASED)) {
+			rcu_read_unlock();
 			continue;
+		}
 
-		if (time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			if (test_task_flag(tsk, TIF_MEMDIE)) {
-				rcu_read_unlock();
-				/* give the system time to free up the memory */
-				msleep_interruptible(20);
-				mutex_unlock(&scan_mutex);
-				return 0;
-			}
+		if (time_before_eq(jiffies, lowmem_deathpending_timeout) &&
+		    test_task_flag(tsk, TIF_MEMDIE)) {
+			rcu_read_unlock();
+			for (j = 0; j < nr_tasks; j++)
+				put_task_struct(tasks[j]);
+			for (j = 0; j < nr_victims; j++)
+				put_task_struct(victims[j].task);
+			/* give the system time to free up the memory */
+			msleep_interruptible(20);
+			mutex_unlock(&scan_mutex);
+			return 0;
 		}
 
 		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
-
-		oom_score_adj = p->signal->oom_score_adj;
-		if (oom_score_adj < min_score_adj) {
-			task_unlock(p);
+		if (!p) {
+			rcu_read_unlock();
 			continue;
 		}
-		tasksize = get_mm_rss(p->mm);
+		v.oom_score_adj = p->signal->oom_score_adj;
+		/* swapped out (zram) pages are released by the kill as well */
+		v.size = get_mm_rss(p->mm) +
+			 get_mm_counter(p->mm, MM_SWAPENTS);
+		get_task_struct(p);
 		task_unlock(p);
-		if (tasksize <= 0)
+		rcu_read_unlock();
+		if (v.oom_score_adj < min_score_adj || v.size <= 0) {
+			put_task_struct(p);
 			continue;
-		if (selected) {
-			if (oom_score_adj < selected_oom_score_adj)
-				continue;
-			if (oom_score_adj == selected_oom_score_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_score_adj = oom_score_adj;
+		v.task = p;
+
+		for (j = nr_victims; j > 0 &&
+		     lowmem_victim_before(&v, &victims[j - 1]); j--)
+			victims[j] = victims[j - 1];
+		victims[j] = v;
+		nr_victims++;
 		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_score_adj, tasksize);
+			     p->pid, p->comm, v.oom_score_adj, v.size);
+	}
+	for (i = 0; i < nr_tasks; i++)
+		put_task_struct(tasks[i]);
+
+	for (i = 0; i < nr_victims; i++) {
+		struct lowmem_victim *v = &victims[i];
+
+		if (killed < lowmem_kill_max && (!killed || freed < deficit)) {
+			unsigned int us;
+
+			lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
+				     v->task->pid, v->task->comm,
+				     v->oom_score_adj, v->size);
+			send_sig(SIGKILL, v->task, 0);
+			set_tsk_thread_flag(v->task, TIF_MEMDIE);
+			freed += v->size;
+			killed++;
+
+			us = ktime_to_us(ktime_sub(ktime_get(), start));
+			lowmem_stats.kills++;
+			lowmem_stats.kill_latency_us_total += us;
+			if (us > lowmem_stats.kill_latency_us_max)
+				lowmem_stats.kill_latency_us_max = us;
+		}
+		put_task_struct(v->task);
 	}
-	if (selected) {
-		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_score_adj, selected_tasksize);
+	if (killed) {
 		lowmem_deathpending_timeout = jiffies + HZ;
-		send_sig(SIGKILL, selected, 0);
-		set_tsk_thread_flag(selected, TIF_MEMDIE);
-		rem -= selected_tasksize;
-		rcu_read_unlock();
+		rem -= freed;
 		/* give the system time to free up the memory */
 		msleep_interruptible(20);
-	} else
-		rcu_read_unlock();
+	}
 
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     nr_to_scan, sc->gfp_mask, rem);
@@ -272,6 +501,20 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	return rem;
 }
 
+static int lowmem_vmpressure_notify(struct notifier_block *nb,
+				    unsigned long level, void *data)
+{
+	lowmem_vmpressure_level = level;
+	lowmem_vmpressure_stamp = jiffies;
+	lowmem_print(4, "vmpressure %lu (%lu%%)\n", level,
+		     *(unsigned long *)data);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_vmpressure_nb = {
+	.notifier_call = lowmem_vmpressure_notify,
+};
+
 static struct shrinker lowmem_shrinker = {
 	.shrink = lowmem_shrink,
 	.seeks = DEFAULT_SEEKS * 16
@@ -280,11 +523,13 @@ static struct shrinker lowmem_shrinker = {
 static int __init lowmem_init(void)
 {
 	register_shrinker(&lowmem_shrinker);
+	vmpressure_register_notifier(&lowmem_vmpressure_nb);
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	vmpressure_unregister_notifier(&lowmem_vmpressure_nb);
 	unregister_shrinker(&lowmem_shrinker);
 }
 
@@ -365,6 +610,25 @@ static const struct kparam_array __param_arr_adj = {
 };
 #endif
 
+static int lowmem_stats_get(char *buffer, const struct kernel_param *kp)
+{
+	unsigned int kills = lowmem_stats.kills;
+	u64 avg = lowmem_stats.kill_latency_us_total;
+
+	if (kills)
+		do_div(avg, kills);
+	return sprintf(buffer,
+		       "kills %u scans %u scans_per_kill %u kill_latency_us avg %llu max %u\n",
+		       kills, lowmem_stats.scans,
+		       kills ? lowmem_stats.scans / kills : 0,
+		       (unsigned long long)avg,
+		       lowmem_stats.kill_latency_us_max);
+}
+
+static struct kernel_param_ops lowmem_stats_ops = {
+	.get = lowmem_stats_get,
+};
+
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
 #ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER_AUTODETECT_OOM_ADJ_VALUES
 __module_param_call(MODULE_PARAM_PREFIX, adj,
@@ -379,6 +643,9 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(kill_max, lowmem_kill_max, int, S_IRUGO | S_IWUSR);
+module_param_named(vmpressure, lowmem_use_vmpressure, bool, S_IRUGO | S_IWUSR);
+module_param_cb(stats, &lowmem_stats_ops, NULL, S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -0,0 +1,85 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lzo.h>
+#ifdef CONFIG_ZRAM_LZ4_COMPRESS
+#include <linux/lz4.h>
+#endif
+
+#include "zram_drv.h"
+
+static int zram_lzo_compress(const unsigned char *src, unsigned char *dst,
+			     size_t *dst_len, void *workmem)
+{
+	return lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, workmem);
+}
+
+static int zram_lzo_decompress(const unsigned char *src, size_t src_len,
+			       unsigned char *dst)
+{
+	size_t dst_len = PAGE_SIZE;
+
+	return lzo1x_decompress_safe(src, src_len, dst, &dst_len);
+}
+
+#ifdef CONFIG_ZRAM_LZ4_COMPRESS
+static int zram_lz4_compress(const unsigned char *src, unsigned char *dst,
+			     size_t *dst_len, void *workmem)
+{
+	return lz4_compress(src, PAGE_SIZE, dst, dst_len, workmem);
+}
+
+static int zram_lz4_decompress(const unsigned char *src, size_t src_len,
+			       unsigned char *dst)
+{
+	size_t dst_len = PAGE_SIZE;
+
+	return lz4_decompress_unknownoutputsize(src, src_len, dst, &dst_len);
+}
+#endif
+
+/*
+ * Both compressors must fit their worst case output for a PAGE_SIZE
+ * input in a stream buffer (2 * PAGE_SIZE).
+ */
+const struct zram_backend zram_backends[__NR_ZRAM_COMP] = {
+	[ZRAM_COMP_LZO] = {
+		.name		= "lzo",
+		.workmem_size	= LZO1X_MEM_COMPRESS,
+		.compress	= zram_lzo_compress,
+		.decompress	= zram_lzo_decompress,
+	},
+#ifdef CONFIG_ZRAM_LZ4_COMPRESS
+	[ZRAM_COMP_LZ4] = {
+		.name		= "lz4",
+		.workmem_size	= LZ4_MEM_COMPRESS,
+		.compress	= zram_lz4_compress,
+		.decompress	= zram_lz4_decompress,
+	},
+#endif
+};
+
+const struct zram_backend *zram_find_backend(const char *name)
+{
+	int i;
+
+	for (i = 0; i < __NR_ZRAM_COMP; i++) {
+		if (sysfs_streq(name, zram_backends[i].name))
+			return &zram_backends[i];
+	}
+
+	return NULL;
+}
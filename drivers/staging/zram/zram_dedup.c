@@ -0,0 +1,234 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zram_drv.h"
+
+/*
+ * Same-page deduplication.
+ *
+ * With dedup enabled every compressed object has an entry in an rbtree
+ * keyed by the checksum of its uncompressed contents. A write whose
+ * checksum matches an existing entry is decompressed and compared and,
+ * if identical, the slot shares the existing zsmalloc handle instead
+ * of storing a new copy. The entry is freed, along with its handle,
+ * when the last slot referencing it is freed.
+ */
+struct zram_dedup_entry {
+	struct rb_node node;
+	u32 checksum;
+	u16 size;
+	int refcount;
+	void *handle;
+};
+
+u32 zram_dedup_checksum(void *mem)
+{
+	return jhash2(mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+/* Leftmost entry with the given checksum. Called with dedup_lock held. */
+static struct zram_dedup_entry *zram_dedup_first(struct zram *zram,
+						 u32 checksum)
+{
+	struct rb_node *node = zram->dedup_root.rb_node;
+	struct zram_dedup_entry *entry, *found = NULL;
+
+	while (node) {
+		entry = rb_entry(node, struct zram_dedup_entry, node);
+		if (checksum < entry->checksum) {
+			node = node->rb_left;
+		} else if (checksum > entry->checksum) {
+			node = node->rb_right;
+		} else {
+			found = entry;
+			node = node->rb_left;
+		}
+	}
+
+	return found;
+}
+
+static struct zram_dedup_entry *zram_dedup_next(struct zram_dedup_entry *entry)
+{
+	struct rb_node *node = rb_next(&entry->node);
+	struct zram_dedup_entry *next;
+
+	if (!node)
+		return NULL;
+
+	next = rb_entry(node, struct zram_dedup_entry, node);
+	return next->checksum == entry->checksum ? next : NULL;
+}
+
+static void zram_dedup_release(struct zram *zram,
+			       struct zram_dedup_entry *entry)
+{
+	zs_free(zram->mem_pool, entry->handle);
+	zram_stat64_sub(zram, &zram->stats.compr_size, entry->size);
+	kfree(entry);
+}
+
+/*
+ * Drop a reference to entry. Returns the entry if that was the last
+ * reference: it has been unlinked and must be released by the caller
+ * once dedup_lock is dropped.
+ */
+static struct zram_dedup_entry *__zram_dedup_put(struct zram *zram,
+						 struct zram_dedup_entry *entry)
+{
+	if (--entry->refcount)
+		return NULL;
+
+	rb_erase(&entry->node, &zram->dedup_root);
+	return entry;
+}
+
+static int zram_dedup_match(struct zram *zram, struct zram_dedup_entry *entry,
+			    void *mem, void *buf)
+{
+	int ret;
+	unsigned char *cmem;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle);
+	ret = zram_decompress(zram, cmem, entry->size, buf);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return !ret && !memcmp(mem, buf, PAGE_SIZE);
+}
+
+/*
+ * Look for a stored object with the same contents as mem, using buf
+ * (at least PAGE_SIZE) as scratch space. On a hit, a reference is taken
+ * on the object and its handle returned with *size set to its
+ * compressed size.
+ */
+void *zram_dedup_find(struct zram *zram, void *mem, u32 checksum,
+		      void *buf, size_t *size)
+{
+	struct zram_dedup_entry *entry, *next, *dead;
+
+	zram_stat64_inc(zram, &zram->stats.dedup_lookups);
+
+	spin_lock(&zram->dedup_lock);
+	entry = zram_dedup_first(zram, checksum);
+	while (entry) {
+		/* Pin the entry while it is compared without the lock */
+		entry->refcount++;
+		spin_unlock(&zram->dedup_lock);
+
+		if (zram_dedup_match(zram, entry, mem, buf)) {
+			*size = entry->size;
+			zram_stat64_inc(zram, &zram->stats.dedup_hits);
+			zram_stat64_add(zram, &zram->stats.dup_data_size,
+					entry->size);
+			return entry->handle;
+		}
+
+		spin_lock(&zram->dedup_lock);
+		next = zram_dedup_next(entry);
+		dead = __zram_dedup_put(zram, entry);
+		if (dead) {
+			spin_unlock(&zram->dedup_lock);
+			zram_dedup_release(zram, dead);
+			spin_lock(&zram->dedup_lock);
+			/* The tree may have changed: restart the walk */
+			next = zram_dedup_first(zram, checksum);
+		}
+		entry = next;
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return NULL;
+}
+
+/* Index a newly stored object, holding a single reference */
+int zram_dedup_insert(struct zram *zram, void *handle, u32 checksum,
+		      size_t size)
+{
+	struct rb_node **link, *parent = NULL;
+	struct zram_dedup_entry *entry, *cur;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return -ENOMEM;
+
+	entry->checksum = checksum;
+	entry->size = size;
+	entry->refcount = 1;
+	entry->handle = handle;
+
+	spin_lock(&zram->dedup_lock);
+	link = &zram->dedup_root.rb_node;
+	while (*link) {
+		parent = *link;
+		cur = rb_entry(parent, struct zram_dedup_entry, node);
+		if (checksum < cur->checksum)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&entry->node, parent, link);
+	rb_insert_color(&entry->node, &zram->dedup_root);
+	spin_unlock(&zram->dedup_lock);
+
+	return 0;
+}
+
+/*
+ * Drop the reference a slot holds on handle. The object is freed
+ * together with its entry when no other slot shares it.
+ */
+void zram_dedup_put(struct zram *zram, void *handle, u32 checksum)
+{
+	u16 size;
+	struct zram_dedup_entry *entry, *dead;
+
+	spin_lock(&zram->dedup_lock);
+	for (entry = zram_dedup_first(zram, checksum); entry;
+	     entry = zram_dedup_next(entry)) {
+		if (entry->handle == handle)
+			break;
+	}
+	BUG_ON(!entry);
+
+	size = entry->size;
+	dead = __zram_dedup_put(zram, entry);
+	spin_unlock(&zram->dedup_lock);
+
+	if (dead)
+		zram_dedup_release(zram, dead);
+	else
+		zram_stat64_sub(zram, &zram->stats.dup_data_size, size);
+}
+
+/* Free every indexed object. Only called on device reset. */
+void zram_dedup_reset(struct zram *zram)
+{
+	struct rb_node *node;
+
+	while ((node = rb_first(&zram->dedup_root))) {
+		struct zram_dedup_entry *entry;
+
+		entry = rb_entry(node, struct zram_dedup_entry, node);
+		rb_erase(node, &zram->dedup_root);
+		zs_free(zram->mem_pool, entry->handle);
+		kfree(entry);
+	}
+}
@@ -25,13 +25,18 @@
 #include <linux/bitops.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/cpu.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/kthread.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+#include <linux/sched.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
@@ -52,25 +57,6 @@ static void zram_stat_dec(u32 *v)
 	*v = *v - 1;
 }
 
-static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
-{
-	spin_lock(&zram->stat64_lock);
-	*v = *v + inc;
-	spin_unlock(&zram->stat64_lock);
-}
-
-static void zram_stat64_sub(struct zram *zram, u64 *v, u64 dec)
-{
-	spin_lock(&zram->stat64_lock);
-	*v = *v - dec;
-	spin_unlock(&zram->stat64_lock);
-}
-
-static void zram_stat64_inc(struct zram *zram, u64 *v)
-{
-	zram_stat64_add(zram, v, 1);
-}
-
 static int zram_test_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
 {
@@ -89,6 +75,84 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
+/* Sum up the per-CPU stats of compression algorithm id */
+void zram_comp_stats_read(struct zram *zram, int id,
+			  struct zram_comp_stats *cs)
+{
+	int cpu;
+	unsigned int start;
+
+	memset(cs, 0, sizeof(*cs));
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_pcpu_stats *pcs;
+		struct zram_comp_stats snap;
+
+		pcs = per_cpu_ptr(zram->comp_stats, cpu);
+		do {
+			start = u64_stats_fetch_begin(&pcs->syncp);
+			snap = pcs->stats[id];
+		} while (u64_stats_fetch_retry(&pcs->syncp, start));
+
+		cs->pages_compressed += snap.pages_compressed;
+		cs->compr_size += snap.compr_size;
+		cs->compress_ns += snap.compress_ns;
+		cs->pages_decompressed += snap.pages_decompressed;
+		cs->decompress_ns += snap.decompress_ns;
+	}
+}
+
+static int zram_compress(struct zram *zram, struct zram_comp_stream *zstrm,
+			 const unsigned char *src, size_t *clen)
+{
+	int ret;
+	u64 start, ns;
+	struct zram_comp_stats *cs;
+	struct zram_comp_pcpu_stats *pcs;
+
+	start = local_clock();
+	ret = zram->backend->compress(src, zstrm->buffer, clen,
+				      zstrm->workmem);
+	ns = local_clock() - start;
+
+	if (!ret) {
+		pcs = get_cpu_ptr(zram->comp_stats);
+		cs = &pcs->stats[zram->backend - zram_backends];
+		u64_stats_update_begin(&pcs->syncp);
+		cs->pages_compressed++;
+		cs->compr_size += *clen;
+		cs->compress_ns += ns;
+		u64_stats_update_end(&pcs->syncp);
+		put_cpu_ptr(zram->comp_stats);
+	}
+
+	return ret;
+}
+
+int zram_decompress(struct zram *zram, const unsigned char *src,
+		    size_t src_len, unsigned char *dst)
+{
+	int ret;
+	u64 start, ns;
+	struct zram_comp_stats *cs;
+	struct zram_comp_pcpu_stats *pcs;
+
+	start = local_clock();
+	ret = zram->backend->decompress(src, src_len, dst);
+	ns = local_clock() - start;
+
+	if (!ret) {
+		pcs = get_cpu_ptr(zram->comp_stats);
+		cs = &pcs->stats[zram->backend - zram_backends];
+		u64_stats_update_begin(&pcs->syncp);
+		cs->pages_decompressed++;
+		cs->decompress_ns += ns;
+		u64_stats_update_end(&pcs->syncp);
+		put_cpu_ptr(zram->comp_stats);
+	}
+
+	return ret;
+}
+
 static int page_zero_filled(void *ptr)
 {
 	unsigned int pos;
@@ -133,10 +197,135 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Interval between scans for pages to write back */
+#define ZRAM_WB_SCAN_SECS	30
+/* Minimum interval between scans started by incompressible writes */
+#define ZRAM_WB_KICK_SECS	1
+
+/*
+ * Backing device blocks are PAGE_SIZE. Block 0 is never handed out so
+ * that a written back slot always has a non-NULL handle.
+ */
+static unsigned long zram_alloc_block(struct zram *zram)
+{
+	unsigned long blk;
+
+	do {
+		blk = find_next_zero_bit(zram->bd_bitmap, zram->bd_nr_pages, 1);
+		if (blk >= zram->bd_nr_pages)
+			return 0;
+	} while (test_and_set_bit(blk, zram->bd_bitmap));
+
+	return blk;
+}
+
+static void zram_free_block(struct zram *zram, unsigned long blk)
+{
+	WARN_ON_ONCE(!test_and_clear_bit(blk, zram->bd_bitmap));
+}
+
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/* Synchronously read or write one block of the backing device */
+static int zram_bdev_rw(struct zram *zram, unsigned long blk,
+			struct page *page, int rw)
+{
+	int ret = 0;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+	bio_add_page(bio, page, PAGE_SIZE, 0);
+
+	submit_bio(rw, bio);
+	wait_for_completion(&done);
+
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		ret = -EIO;
+	bio_put(bio);
+
+	if (rw == READ)
+		zram_stat64_inc(zram, &zram->stats.bd_reads);
+	else
+		zram_stat64_inc(zram, &zram->stats.bd_writes);
+
+	return ret;
+}
+
+struct zram_bdev_read_work {
+	struct work_struct work;
+	struct zram *zram;
+	unsigned long blk;
+	struct page *page;
+	int ret;
+};
+
+static void zram_bdev_read_fn(struct work_struct *work)
+{
+	struct zram_bdev_read_work *rw;
+
+	rw = container_of(work, struct zram_bdev_read_work, work);
+	rw->ret = zram_bdev_rw(rw->zram, rw->blk, rw->page, READ);
+}
+
+/*
+ * Read a written back slot into mem. We may be called from within
+ * zram_make_request(), where a bio submitted to another device is only
+ * issued once we return, so do the I/O from a worker and wait for it.
+ */
+static int zram_read_from_bdev(struct zram *zram, unsigned long blk,
+			       void *mem)
+{
+	struct zram_bdev_read_work rw;
+
+	rw.page = alloc_page(GFP_NOIO);
+	if (!rw.page)
+		return -ENOMEM;
+
+	rw.zram = zram;
+	rw.blk = blk;
+
+	INIT_WORK_ONSTACK(&rw.work, zram_bdev_read_fn);
+	queue_work(system_unbound_wq, &rw.work);
+	flush_work(&rw.work);
+	destroy_work_on_stack(&rw.work);
+
+	if (!rw.ret)
+		memcpy(mem, page_address(rw.page), PAGE_SIZE);
+	__free_page(rw.page);
+
+	return rw.ret;
+}
+#endif
+
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	void *handle = zram->table[index].handle;
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Any change to the slot aborts a writeback in progress */
+	zram_clear_flag(zram, index, ZRAM_WB_PENDING);
+	zram_clear_flag(zram, index, ZRAM_FREE_PENDING);
+
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		zram_free_block(zram, (unsigned long)handle);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_stat_dec(&zram->stats.pages_wb);
+		goto out;
+	}
+#endif
+
 	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
@@ -153,17 +342,24 @@ static void zram_free_page(struct zram *zram, size_t index)
 		__free_page(handle);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
+		zram_stat64_sub(zram, &zram->stats.compr_size,
+				zram->table[index].size);
 		goto out;
 	}
 
-	zs_free(zram->mem_pool, handle);
+	if (zram->use_dedup) {
+		/* Accounts compr_size itself, the object may be shared */
+		zram_dedup_put(zram, handle, zram->table[index].checksum);
+	} else {
+		zs_free(zram->mem_pool, handle);
+		zram_stat64_sub(zram, &zram->stats.compr_size,
+				zram->table[index].size);
+	}
 
 	if (zram->table[index].size <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
 out:
-	zram_stat64_sub(zram, &zram->stats.compr_size,
-			zram->table[index].size);
 	zram_stat_dec(&zram->stats.pages_stored);
 
 	zram->table[index].handle = NULL;
@@ -203,17 +399,63 @@ static inline int is_partial_io(struct bio_vec *bvec)
 	return bvec->bv_len != PAGE_SIZE;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+/*
+ * Read a written back slot. Called with zram->lock held for read, which
+ * is dropped around the backing device I/O. Returns -EAGAIN if the slot
+ * changed meanwhile and has to be read again.
+ */
+static int zram_bvec_read_bdev(struct zram *zram, struct bio_vec *bvec,
+			       u32 index, int offset)
+{
+	int ret;
+	unsigned long blk;
+	unsigned char *user_mem, *uncmem;
+	struct page *page = bvec->bv_page;
+
+	uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
+	if (!uncmem)
+		return -ENOMEM;
+
+	blk = (unsigned long)zram->table[index].handle;
+	up_read(&zram->lock);
+	ret = zram_read_from_bdev(zram, blk, uncmem);
+	down_read(&zram->lock);
+
+	if (!zram_test_flag(zram, index, ZRAM_WB) ||
+	    (unsigned long)zram->table[index].handle != blk) {
+		/* Rewritten or freed, the block may hold other data now */
+		kfree(uncmem);
+		return -EAGAIN;
+	}
+
+	if (!ret) {
+		user_mem = kmap_atomic(page);
+		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
+		       bvec->bv_len);
+		kunmap_atomic(user_mem);
+		flush_dcache_page(page);
+	} else {
+		pr_err("Backing device read failed! err=%d, page=%u\n",
+		       ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+	}
+	kfree(uncmem);
+	return ret;
+}
+#endif
+
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
 	int ret;
-	size_t clen;
 	struct page *page;
 	struct zobj_header *zheader;
 	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
 
+again:
 	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
 		handle_zero_page(bvec);
 		return 0;
@@ -233,6 +475,18 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 		return 0;
 	}
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram->table[index].ac_time = get_seconds();
+
+	/* Page was written back, fault it in from the backing device */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		ret = zram_bvec_read_bdev(zram, bvec, index, offset);
+		if (ret == -EAGAIN)
+			goto again;
+		return ret;
+	}
+#endif
+
 	if (is_partial_io(bvec)) {
 		/* Use  a temporary buffer to decompress the page */
 		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
@@ -245,13 +499,11 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	user_mem = kmap_atomic(page);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
-	clen = PAGE_SIZE;
 
 	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    uncmem, &clen);
+	ret = zram_decompress(zram, cmem + sizeof(*zheader),
+			      zram->table[index].size, uncmem);
 
 	if (is_partial_io(bvec)) {
 		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
@@ -263,7 +515,7 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	kunmap_atomic(user_mem);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
 		return ret;
@@ -277,7 +529,6 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 {
 	int ret;
-	size_t clen = PAGE_SIZE;
 	struct zobj_header *zheader;
 	unsigned char *cmem;
 
@@ -287,22 +538,27 @@ static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 		return 0;
 	}
 
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB)))
+		return zram_read_from_bdev(zram,
+				(unsigned long)zram->table[index].handle, mem);
+#endif
 
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		cmem = kmap_atomic(zram->table[index].handle);
 		memcpy(mem, cmem, PAGE_SIZE);
 		kunmap_atomic(cmem);
 		return 0;
 	}
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    mem, &clen);
+	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
+	ret = zram_decompress(zram, cmem + sizeof(*zheader),
+			      zram->table[index].size, mem);
 	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
 		return ret;
@@ -311,31 +567,100 @@ static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 	return 0;
 }
 
+static struct zram_comp_stream *
+zram_comp_stream_alloc(const struct zram_backend *backend)
+{
+	struct zram_comp_stream *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_KERNEL);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->workmem = kzalloc(backend->workmem_size, GFP_KERNEL);
+	zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (!zstrm->workmem || !zstrm->buffer) {
+		kfree(zstrm->workmem);
+		free_pages((unsigned long)zstrm->buffer, 1);
+		kfree(zstrm);
+		return NULL;
+	}
+
+	INIT_LIST_HEAD(&zstrm->list);
+	return zstrm;
+}
+
+static void zram_comp_stream_free(struct zram_comp_stream *zstrm)
+{
+	kfree(zstrm->workmem);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+/*
+ * Get an idle compression stream, sleeping until one is released if
+ * every stream is busy. There is one stream per possible CPU, so a
+ * writer only waits here when it was preempted while compressing.
+ */
+static struct zram_comp_stream *zram_comp_stream_get(struct zram *zram)
+{
+	struct zram_comp_stream *zstrm;
+
+	while (1) {
+		spin_lock(&zram->strm_lock);
+		if (!list_empty(&zram->idle_strm)) {
+			zstrm = list_first_entry(&zram->idle_strm,
+					struct zram_comp_stream, list);
+			list_del(&zstrm->list);
+			spin_unlock(&zram->strm_lock);
+			return zstrm;
+		}
+		spin_unlock(&zram->strm_lock);
+
+		zram_stat64_inc(zram, &zram->stats.strm_waits);
+		wait_event(zram->strm_wait, !list_empty(&zram->idle_strm));
+	}
+}
+
+static void zram_comp_stream_put(struct zram *zram,
+				 struct zram_comp_stream *zstrm)
+{
+	spin_lock(&zram->strm_lock);
+	list_add(&zstrm->list, &zram->idle_strm);
+	spin_unlock(&zram->strm_lock);
+
+	wake_up(&zram->strm_wait);
+}
+
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
 	int ret;
-	u32 store_offset;
 	size_t clen;
 	void *handle;
+	u32 checksum = 0;
+	int uncompressed = 0, dedup_hit = 0, locked = 0;
 	struct zobj_header *zheader;
 	struct page *page, *page_store;
+	struct zram_comp_stream *zstrm = NULL;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
 
 	if (is_partial_io(bvec)) {
 		/*
 		 * This is a partial IO. We need to read the full page
-		 * before to write the changes.
+		 * before to write the changes. Keep zram->lock until the
+		 * table update so that a concurrent write to the rest of
+		 * the page is not lost.
 		 */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
 		if (!uncmem) {
 			pr_info("Error allocating temp memory!\n");
 			ret = -ENOMEM;
 			goto out;
 		}
+		down_write(&zram->lock);
+		locked = 1;
 		ret = zram_read_before_write(zram, uncmem, index);
 		if (ret) {
 			kfree(uncmem);
@@ -344,13 +669,10 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	}
 
 	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
+	 * Grab a compression stream before mapping the page: this may
+	 * sleep waiting for another writer to finish.
 	 */
-	if (zram->table[index].handle ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
-
+	zstrm = zram_comp_stream_get(zram);
 	user_mem = kmap_atomic(page);
 
 	if (is_partial_io(bvec))
@@ -363,20 +685,51 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		kunmap_atomic(user_mem);
 		if (is_partial_io(bvec))
 			kfree(uncmem);
+		zram_comp_stream_put(zram, zstrm);
+
+		if (!locked)
+			down_write(&zram->lock);
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector now.
+		 */
+		if (zram->table[index].handle ||
+		    zram_test_flag(zram, index, ZRAM_ZERO))
+			zram_free_page(zram, index);
 		zram_stat_inc(&zram->stats.pages_zero);
 		zram_set_flag(zram, index, ZRAM_ZERO);
-		ret = 0;
-		goto out;
+		up_write(&zram->lock);
+		return 0;
+	}
+
+	if (zram->use_dedup) {
+		/* The stream buffer is free until we compress */
+		checksum = zram_dedup_checksum(uncmem);
+		handle = zram_dedup_find(zram, uncmem, checksum,
+					 zstrm->buffer, &clen);
+		if (handle) {
+			kunmap_atomic(user_mem);
+			if (is_partial_io(bvec))
+				kfree(uncmem);
+			zram_comp_stream_put(zram, zstrm);
+			zstrm = NULL;
+			dedup_hit = 1;
+			goto update_table;
+		}
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
+	/*
+	 * Full page compression runs without zram->lock held, so writers
+	 * on different CPUs only serialize on the table update below.
+	 */
+	src = zstrm->buffer;
+	ret = zram_compress(zram, zstrm, uncmem, &clen);
 
 	kunmap_atomic(user_mem);
 	if (is_partial_io(bvec))
-			kfree(uncmem);
+		kfree(uncmem);
 
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Compression failed! err=%d\n", ret);
 		goto out;
 	}
@@ -396,9 +749,7 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			goto out;
 		}
 
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
+		uncompressed = 1;
 		handle = page_store;
 		src = kmap_atomic(page);
 		cmem = kmap_atomic(page_store);
@@ -417,7 +768,7 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 memstore:
 #if 0
 	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+	if (!uncompressed) {
 		zheader = (struct zobj_header *)cmem;
 		zheader->table_idx = index;
 		cmem += sizeof(*zheader);
@@ -426,25 +777,73 @@ memstore:
 
 	memcpy(cmem, src, clen);
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+	if (unlikely(uncompressed)) {
 		kunmap_atomic(cmem);
 		kunmap_atomic(src);
 	} else {
 		zs_unmap_object(zram->mem_pool, handle);
 	}
 
+	zram_comp_stream_put(zram, zstrm);
+	zstrm = NULL;
+
+	if (zram->use_dedup && !uncompressed) {
+		ret = zram_dedup_insert(zram, handle, checksum, clen);
+		if (ret) {
+			zs_free(zram->mem_pool, handle);
+			goto out;
+		}
+	}
+
+update_table:
+	if (!locked)
+		down_write(&zram->lock);
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	if (zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_ZERO))
+		zram_free_page(zram, index);
+
 	zram->table[index].handle = handle;
 	zram->table[index].size = clen;
+	zram->table[index].checksum = checksum;
 
 	/* Update stats */
-	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	if (unlikely(uncompressed)) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	}
+	/* A duplicate shares memory already accounted in compr_size */
+	if (!dedup_hit)
+		zram_stat64_add(zram, &zram->stats.compr_size, clen);
 	zram_stat_inc(&zram->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_inc(&zram->stats.good_compress);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram->table[index].ac_time = get_seconds();
+#endif
+	up_write(&zram->lock);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/*
+	 * Incompressible pages are written back soon, but each scan walks
+	 * the whole table so don't start one per write.
+	 */
+	if (unlikely(uncompressed) && zram->bdev &&
+	    time_after(jiffies, zram->wb_scan_time + ZRAM_WB_KICK_SECS * HZ) &&
+	    cancel_delayed_work(&zram->wb_work))
+		queue_delayed_work(system_freezable_wq, &zram->wb_work, 0);
+#endif
 
 	return 0;
 
 out:
+	if (locked)
+		up_write(&zram->lock);
+	if (zstrm)
+		zram_comp_stream_put(zram, zstrm);
 	if (ret)
 		zram_stat64_inc(zram, &zram->stats.failed_writes);
 	return ret;
@@ -460,14 +859,194 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
 		up_read(&zram->lock);
 	} else {
-		down_write(&zram->lock);
+		/* Takes zram->lock itself, only around the table update */
 		ret = zram_bvec_write(zram, bvec, index, offset);
+	}
+
+	return ret;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static int zram_wb_candidate(struct zram *zram, u32 index, unsigned long now)
+{
+	if (!zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_ZERO))
+		return 0;
+
+	if (zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))
+		return 1;
+
+	return zram->wb_idle_age &&
+		now - zram->table[index].ac_time >= zram->wb_idle_age;
+}
+
+/*
+ * End a writeback without switching the slot over, doing the free that
+ * swap asked for meanwhile. Called with zram->lock held for write.
+ */
+static void zram_writeback_abort(struct zram *zram, u32 index)
+{
+	spin_lock(&zram->wb_lock);
+	if (zram_test_flag(zram, index, ZRAM_FREE_PENDING))
+		zram_free_page(zram, index);
+	else
+		zram_clear_flag(zram, index, ZRAM_WB_PENDING);
+	spin_unlock(&zram->wb_lock);
+}
+
+/*
+ * Move one slot to the backing device. The slot is marked
+ * ZRAM_WB_PENDING and its contents copied out under zram->lock; it is
+ * only switched over to the written block if nothing changed it
+ * meanwhile. While the slot is pending, zram_slot_free_notify() leaves
+ * the free to us.
+ */
+static int zram_writeback_slot(struct zram *zram, u32 index,
+			       struct page *page, unsigned long now)
+{
+	int ret;
+	unsigned long blk;
+
+	down_write(&zram->lock);
+	spin_lock(&zram->wb_lock);
+	if (!zram_wb_candidate(zram, index, now)) {
+		spin_unlock(&zram->wb_lock);
+		up_write(&zram->lock);
+		return 0;
+	}
+	zram_set_flag(zram, index, ZRAM_WB_PENDING);
+	spin_unlock(&zram->wb_lock);
+
+	ret = zram_read_before_write(zram, page_address(page), index);
+	if (ret) {
+		zram_writeback_abort(zram, index);
 		up_write(&zram->lock);
+		return ret;
 	}
+	up_write(&zram->lock);
 
+	blk = zram_alloc_block(zram);
+	if (!blk) {
+		ret = -ENOSPC;
+		goto abort;
+	}
+
+	ret = zram_bdev_rw(zram, blk, page, WRITE);
+	if (ret) {
+		zram_free_block(zram, blk);
+		goto abort;
+	}
+
+	down_write(&zram->lock);
+	spin_lock(&zram->wb_lock);
+	if (zram_test_flag(zram, index, ZRAM_FREE_PENDING))
+		zram_free_page(zram, index);
+	if (!zram_test_flag(zram, index, ZRAM_WB_PENDING)) {
+		/* Rewritten or freed while we were writing it out */
+		spin_unlock(&zram->wb_lock);
+		up_write(&zram->lock);
+		zram_free_block(zram, blk);
+		return 0;
+	}
+
+	zram_free_page(zram, index);
+	zram->table[index].handle = (void *)blk;
+	zram_set_flag(zram, index, ZRAM_WB);
+	zram_stat_inc(&zram->stats.pages_wb);
+	zram_stat_inc(&zram->stats.pages_stored);
+	spin_unlock(&zram->wb_lock);
+	up_write(&zram->lock);
+
+	return 0;
+
+abort:
+	down_write(&zram->lock);
+	zram_writeback_abort(zram, index);
+	up_write(&zram->lock);
 	return ret;
 }
 
+static void zram_writeback_fn(struct work_struct *work)
+{
+	u32 index;
+	struct page *page;
+	unsigned long now = get_seconds();
+	struct zram *zram = container_of(to_delayed_work(work),
+					 struct zram, wb_work);
+
+	zram->wb_scan_time = jiffies;
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		goto out;
+
+	/* The table is only sampled here, each slot is rechecked locked */
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (!zram_wb_candidate(zram, index, now))
+			continue;
+		if (zram_writeback_slot(zram, index, page, now) == -ENOSPC)
+			break;
+		cond_resched();
+	}
+	__free_page(page);
+
+out:
+	queue_delayed_work(system_freezable_wq, &zram->wb_work,
+			   ZRAM_WB_SCAN_SECS * HZ);
+}
+
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	int ret;
+	struct block_device *bdev;
+	unsigned long nr_pages;
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				  zram);
+	if (IS_ERR(bdev))
+		return PTR_ERR(bdev);
+
+	ret = set_blocksize(bdev, PAGE_SIZE);
+	if (ret)
+		goto fail;
+
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_pages < 2) {
+		ret = -EINVAL;
+		goto fail;
+	}
+
+	zram->bd_bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!zram->bd_bitmap) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	strlcpy(zram->bd_path, path, sizeof(zram->bd_path));
+	zram->bd_nr_pages = nr_pages;
+	zram->bdev = bdev;
+
+	return 0;
+
+fail:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	return ret;
+}
+
+static void zram_reset_backing_dev(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	vfree(zram->bd_bitmap);
+	zram->bdev = NULL;
+	zram->bd_bitmap = NULL;
+	zram->bd_nr_pages = 0;
+	zram->bd_path[0] = '\0';
+}
+#endif
+
 static void update_position(u32 *index, int *offset, struct bio_vec *bvec)
 {
 	if (*offset + bvec->bv_len >= PAGE_SIZE)
@@ -583,12 +1162,21 @@ void __zram_reset_device(struct zram *zram)
 
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram->bdev)
+		cancel_delayed_work_sync(&zram->wb_work);
+#endif
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free the compression streams; all are idle at this point */
+	while (!list_empty(&zram->idle_strm)) {
+		struct zram_comp_stream *zstrm;
+
+		zstrm = list_first_entry(&zram->idle_strm,
+				struct zram_comp_stream, list);
+		list_del(&zstrm->list);
+		zram_comp_stream_free(zstrm);
+	}
+	zram->num_strm = 0;
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
@@ -596,18 +1184,27 @@ void __zram_reset_device(struct zram *zram)
 		if (!handle)
 			continue;
 
+		if (unlikely(zram_test_flag(zram, index, ZRAM_WB)))
+			continue;
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
 			__free_page(handle);
-		else
+		else if (!zram->use_dedup)
 			zs_free(zram->mem_pool, handle);
 	}
 
+	/* Shared objects are freed once, through the dedup index */
+	zram_dedup_reset(zram);
+
 	vfree(zram->table);
 	zram->table = NULL;
 
 	zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_reset_backing_dev(zram);
+#endif
+
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
@@ -623,7 +1220,7 @@ void zram_reset_device(struct zram *zram)
 
 int zram_init_device(struct zram *zram)
 {
-	int ret;
+	int i, ret;
 	size_t num_pages;
 
 	down_write(&zram->init_lock);
@@ -635,19 +1232,16 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail_no_table;
-	}
+	for (i = 0; i < num_possible_cpus(); i++) {
+		struct zram_comp_stream *zstrm = zram_comp_stream_alloc(zram->backend);
 
-	zram->compress_buffer =
-		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
-		goto fail_no_table;
+		if (!zstrm) {
+			pr_err("Error allocating compression stream!\n");
+			ret = -ENOMEM;
+			goto fail_no_table;
+		}
+		list_add(&zstrm->list, &zram->idle_strm);
+		zram->num_strm++;
 	}
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
@@ -663,7 +1257,8 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name,
+					GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -671,6 +1266,11 @@ int zram_init_device(struct zram *zram)
 	}
 
 	zram->init_done = 1;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram->bdev)
+		queue_delayed_work(system_freezable_wq, &zram->wb_work,
+				   ZRAM_WB_SCAN_SECS * HZ);
+#endif
 	up_write(&zram->init_lock);
 
 	pr_debug("Initialization done!\n");
@@ -686,13 +1286,137 @@ fail:
 	return ret;
 }
 
+#ifdef CONFIG_ZRAM_BENCH
+/* Duration of a single compression benchmark run */
+#define ZRAM_BENCH_MSECS	1000
+
+struct zram_bench_thread {
+	struct zram *zram;
+	void *src;
+	unsigned long deadline;
+	u64 pages;
+	struct completion done;
+};
+
+static int zram_bench_fn(void *data)
+{
+	struct zram_bench_thread *bt = data;
+	struct zram_comp_stream *zstrm;
+	size_t clen;
+
+	while (time_before(jiffies, bt->deadline)) {
+		zstrm = zram_comp_stream_get(bt->zram);
+		bt->zram->backend->compress(bt->src, zstrm->buffer, &clen,
+					    zstrm->workmem);
+		zram_comp_stream_put(bt->zram, zstrm);
+		bt->pages++;
+		cond_resched();
+	}
+
+	complete(&bt->done);
+	return 0;
+}
+
+/*
+ * Compress a synthetic, half compressible page through the device's
+ * stream pool from nr_threads kernel threads, each bound to its own
+ * online CPU, and record the aggregate compressed pages/sec.
+ */
+int zram_compr_bench(struct zram *zram, int nr_threads)
+{
+	int i, cpu, ret = 0;
+	void *src;
+	u64 pages = 0;
+	ktime_t start;
+	s64 elapsed_ns;
+	struct zram_bench_thread *bt;
+
+	if (nr_threads < 1 || nr_threads > num_online_cpus())
+		return -EINVAL;
+
+	src = (void *)__get_free_page(GFP_KERNEL);
+	bt = kcalloc(nr_threads, sizeof(*bt), GFP_KERNEL);
+	if (!src || !bt) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	get_random_bytes(src, PAGE_SIZE / 2);
+	memset(src + PAGE_SIZE / 2, 0x5a, PAGE_SIZE / 2);
+
+	down_read(&zram->init_lock);
+	if (!zram->init_done) {
+		ret = -ENXIO;
+		goto out_unlock;
+	}
+
+	get_online_cpus();
+	start = ktime_get();
+	i = 0;
+	for_each_online_cpu(cpu) {
+		struct task_struct *tsk;
+
+		if (i == nr_threads)
+			break;
+
+		bt[i].zram = zram;
+		bt[i].src = src;
+		bt[i].deadline = jiffies + msecs_to_jiffies(ZRAM_BENCH_MSECS);
+		init_completion(&bt[i].done);
+
+		tsk = kthread_create(zram_bench_fn, &bt[i], "zram_bench/%d",
+				     cpu);
+		if (IS_ERR(tsk)) {
+			ret = PTR_ERR(tsk);
+			break;
+		}
+		kthread_bind(tsk, cpu);
+		wake_up_process(tsk);
+		i++;
+	}
+	put_online_cpus();
+
+	while (i--) {
+		wait_for_completion(&bt[i].done);
+		pages += bt[i].pages;
+	}
+	elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (!ret && elapsed_ns > 0) {
+		zram->bench_threads = nr_threads;
+		zram->bench_pages_per_sec =
+			div64_u64(pages * NSEC_PER_SEC, elapsed_ns);
+	}
+
+out_unlock:
+	up_read(&zram->init_lock);
+out_free:
+	kfree(bt);
+	free_page((unsigned long)src);
+	return ret;
+}
+#endif
+
 static void zram_slot_free_notify(struct block_device *bdev,
 				unsigned long index)
 {
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/*
+	 * We are called under swap_lock without zram->lock, so a slot being
+	 * written back is only marked and freed by zram_writeback_slot().
+	 */
+	spin_lock(&zram->wb_lock);
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB_PENDING)))
+		zram_set_flag(zram, index, ZRAM_FREE_PENDING);
+	else
+		zram_free_page(zram, index);
+	spin_unlock(&zram->wb_lock);
+#else
 	zram_free_page(zram, index);
+#endif
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -708,11 +1432,28 @@ static int create_device(struct zram *zram, int device_id)
 	init_rwsem(&zram->lock);
 	init_rwsem(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	INIT_LIST_HEAD(&zram->idle_strm);
+	spin_lock_init(&zram->strm_lock);
+	init_waitqueue_head(&zram->strm_wait);
+	zram->backend = &zram_backends[ZRAM_COMP_LZO];
+	zram->dedup_root = RB_ROOT;
+	spin_lock_init(&zram->dedup_lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	INIT_DELAYED_WORK(&zram->wb_work, zram_writeback_fn);
+	spin_lock_init(&zram->wb_lock);
+#endif
+
+	zram->comp_stats = alloc_percpu(struct zram_comp_pcpu_stats);
+	if (!zram->comp_stats) {
+		ret = -ENOMEM;
+		goto out;
+	}
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
 		pr_err("Error allocating disk queue for device %d\n",
 			device_id);
+		free_percpu(zram->comp_stats);
 		ret = -ENOMEM;
 		goto out;
 	}
@@ -724,6 +1465,7 @@ static int create_device(struct zram *zram, int device_id)
 	zram->disk = alloc_disk(1);
 	if (!zram->disk) {
 		blk_cleanup_queue(zram->queue);
+		free_percpu(zram->comp_stats);
 		pr_warning("Error allocating disk structure for device %d\n",
 			device_id);
 		ret = -ENOMEM;
@@ -777,6 +1519,8 @@ static void destroy_device(struct zram *zram)
 
 	if (zram->queue)
 		blk_cleanup_queue(zram->queue);
+
+	free_percpu(zram->comp_stats);
 }
 
 unsigned int zram_get_num_devices(void)
@@ -17,6 +17,11 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/rwsem.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include "../zsmalloc/zsmalloc.h"
 
@@ -74,6 +79,15 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page was written to the backing device, handle is its block */
+	ZRAM_WB,
+
+	/* Page is being written to the backing device */
+	ZRAM_WB_PENDING,
+
+	/* Slot was freed by swap during writeback, the writer frees it */
+	ZRAM_FREE_PENDING,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
@@ -85,6 +99,10 @@ struct table {
 	u16 size;	/* object size (excluding header) */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
+	u32 checksum;	/* of uncompressed contents, with dedup enabled */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	u32 ac_time;	/* last access, in seconds */
+#endif
 } __attribute__((aligned(4)));
 
 struct zram_stats {
@@ -95,20 +113,82 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 strm_waits;		/* no. of writes that waited for a stream */
+	u64 dedup_lookups;	/* no. of writes checked for a duplicate */
+	u64 dedup_hits;		/* no. of writes stored as a duplicate */
+	u64 dup_data_size;	/* compressed size saved by dedup */
 	u32 pages_zero;		/* no. of zero filled pages */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	u32 pages_wb;		/* no. of pages on the backing device */
+	u64 bd_reads;		/* no. of backing device page reads */
+	u64 bd_writes;		/* no. of backing device page writes */
+#endif
+};
+
+/* Compression algorithms (zram->backend) */
+enum zram_comp_id {
+	ZRAM_COMP_LZO,
+#ifdef CONFIG_ZRAM_LZ4_COMPRESS
+	ZRAM_COMP_LZ4,
+#endif
+	__NR_ZRAM_COMP,
+};
+
+/*
+ * Compress and decompress a single page. compress() gets workmem_size
+ * bytes of working memory and a 2 * PAGE_SIZE output buffer. Both
+ * return 0 on success.
+ */
+struct zram_backend {
+	const char *name;
+	size_t workmem_size;
+	int (*compress)(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *workmem);
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			  unsigned char *dst);
+};
+
+/* Per-algorithm stats; these survive a device reset */
+struct zram_comp_stats {
+	u64 pages_compressed;
+	u64 compr_size;		/* total compressor output */
+	u64 compress_ns;
+	u64 pages_decompressed;
+	u64 decompress_ns;
+};
+
+/* Updated for every page, so kept per CPU and summed up when read */
+struct zram_comp_pcpu_stats {
+	struct zram_comp_stats stats[__NR_ZRAM_COMP];
+	struct u64_stats_sync syncp;
+};
+
+/*
+ * A compression stream: the working memory and output buffer needed
+ * to compress a single page. Each device keeps a pool of these so
+ * that writers on different CPUs can compress concurrently.
+ */
+struct zram_comp_stream {
+	void *workmem;
+	void *buffer;		/* compressed page, 2 * PAGE_SIZE */
+	struct list_head list;
 };
 
 struct zram {
 	struct zs_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	const struct zram_backend *backend;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	struct rw_semaphore lock; /* protect table against concurrent
+				   * read and writes */
+	/* Idle compression streams, one allocated per possible CPU */
+	struct list_head idle_strm;
+	spinlock_t strm_lock;	/* protect idle_strm */
+	wait_queue_head_t strm_wait;
+	int num_strm;
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -120,16 +200,88 @@ struct zram {
 	 */
 	u64 disksize;	/* bytes */
 
+	/* Same-page deduplication index, see zram_dedup.c */
+	int use_dedup;
+	struct rb_root dedup_root;
+	spinlock_t dedup_lock;
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/*
+	 * Optional backing device. Incompressible pages, and pages not
+	 * accessed for wb_idle_age seconds, are moved there by wb_work.
+	 */
+	struct block_device *bdev;
+	char bd_path[64];
+	unsigned long *bd_bitmap;	/* allocated blocks */
+	unsigned long bd_nr_pages;
+	unsigned int wb_idle_age;	/* seconds, 0 disables */
+	struct delayed_work wb_work;
+	unsigned long wb_scan_time;	/* jiffies, start of the last scan */
+	/*
+	 * Serializes the writeback state of a slot between wb_work and
+	 * swap_slot_free_notify, which is called without zram->lock.
+	 */
+	spinlock_t wb_lock;
+#endif
+
 	struct zram_stats stats;
+	struct zram_comp_pcpu_stats __percpu *comp_stats;
+#ifdef CONFIG_ZRAM_BENCH
+	/* Result of the last compression benchmark run */
+	int bench_threads;
+	u64 bench_pages_per_sec;
+#endif
 };
 
+static inline void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
+{
+	spin_lock(&zram->stat64_lock);
+	*v = *v + inc;
+	spin_unlock(&zram->stat64_lock);
+}
+
+static inline void zram_stat64_sub(struct zram *zram, u64 *v, u64 dec)
+{
+	spin_lock(&zram->stat64_lock);
+	*v = *v - dec;
+	spin_unlock(&zram->stat64_lock);
+}
+
+static inline void zram_stat64_inc(struct zram *zram, u64 *v)
+{
+	zram_stat64_add(zram, v, 1);
+}
+
 extern struct zram *zram_devices;
 unsigned int zram_get_num_devices(void);
 #ifdef CONFIG_SYSFS
 extern struct attribute_group zram_disk_attr_group;
 #endif
 
+extern const struct zram_backend zram_backends[__NR_ZRAM_COMP];
+extern const struct zram_backend *zram_find_backend(const char *name);
+
+extern void zram_comp_stats_read(struct zram *zram, int id,
+				 struct zram_comp_stats *cs);
+extern int zram_decompress(struct zram *zram, const unsigned char *src,
+			   size_t src_len, unsigned char *dst);
+
+extern u32 zram_dedup_checksum(void *mem);
+extern void *zram_dedup_find(struct zram *zram, void *mem, u32 checksum,
+			     void *buf, size_t *size);
+extern int zram_dedup_insert(struct zram *zram, void *handle, u32 checksum,
+			     size_t size);
+extern void zram_dedup_put(struct zram *zram, void *handle, u32 checksum);
+extern void zram_dedup_reset(struct zram *zram);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+#endif
+
 extern int zram_init_device(struct zram *zram);
 extern void __zram_reset_device(struct zram *zram);
+#ifdef CONFIG_ZRAM_BENCH
+extern int zram_compr_bench(struct zram *zram, int nr_threads);
+#endif
 
 #endif
@@ -17,10 +17,14 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/debugfs.h>
 #include <linux/errno.h>
 #include <linux/highmem.h>
 #include <linux/init.h>
+#include <linux/math64.h>
 #include <linux/string.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <asm/tlbflush.h>
 #include <asm/pgtable.h>
@@ -43,6 +47,9 @@
 /* per-cpu VM mapping areas for zspage accesses that cross page boundaries */
 static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
 
+/* Handles, see zsmalloc_int.h */
+static struct kmem_cache *zs_handle_cache;
+
 static int is_first_page(struct page *page)
 {
 	return test_bit(PG_private, &page->flags);
@@ -122,6 +129,7 @@ static void insert_zspage(struct page *page, struct size_class *class,
 		list_add_tail(&page->lru, &(*head)->lru);
 
 	*head = page;
+	class->nr_zspages[fullness]++;
 }
 
 static void remove_zspage(struct page *page, struct size_class *class,
@@ -143,6 +151,7 @@ static void remove_zspage(struct page *page, struct size_class *class,
 					struct page, lru);
 
 	list_del_init(&page->lru);
+	class->nr_zspages[fullness]--;
 }
 
 static enum fullness_group fix_fullness_group(struct zs_pool *pool,
@@ -230,30 +239,55 @@ static struct page *get_next_page(struct page *page)
 	return next;
 }
 
-/* Encode <page, obj_idx> as a single handle value */
-static void *obj_location_to_handle(struct page *page, unsigned long obj_idx)
+/* Encode <page, obj_idx> as a single obj value */
+static unsigned long location_to_obj(struct page *page, unsigned long obj_idx)
 {
-	unsigned long handle;
+	unsigned long obj;
 
 	if (!page) {
 		BUG_ON(obj_idx);
-		return NULL;
+		return 0;
 	}
 
-	handle = page_to_pfn(page) << OBJ_INDEX_BITS;
-	handle |= (obj_idx & OBJ_INDEX_MASK);
+	obj = page_to_pfn(page) << OBJ_INDEX_BITS;
+	obj |= (obj_idx & OBJ_INDEX_MASK);
 
-	return (void *)handle;
+	return obj << OBJ_TAG_BITS;
 }
 
-/* Decode <page, obj_idx> pair from the given object handle */
-static void obj_handle_to_location(void *handle, struct page **page,
+/* Decode <page, obj_idx> pair from the given obj value */
+static void obj_to_location(unsigned long obj, struct page **page,
 				unsigned long *obj_idx)
 {
-	unsigned long hval = (unsigned long)handle;
+	obj >>= OBJ_TAG_BITS;
+	*page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+	*obj_idx = obj & OBJ_INDEX_MASK;
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle & ~(1UL << HANDLE_PIN_BIT);
+}
 
-	*page = pfn_to_page(hval >> OBJ_INDEX_BITS);
-	*obj_idx = hval & OBJ_INDEX_MASK;
+/* Point handle at obj. Called with the handle pinned. */
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	*(unsigned long *)handle = obj | (1UL << HANDLE_PIN_BIT);
+}
+
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
 }
 
 static unsigned long obj_idx_to_offset(struct page *page,
@@ -330,7 +364,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		for (i = 1; i <= objs_on_page; i++) {
 			off += class->size;
 			if (off < PAGE_SIZE) {
-				link->next = obj_location_to_handle(page, i);
+				link->next = location_to_obj(page, i);
 				link += class->size / sizeof(*link);
 			}
 		}
@@ -341,7 +375,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		 * page (if present)
 		 */
 		next_page = get_next_page(page);
-		link->next = obj_location_to_handle(next_page, 0);
+		link->next = location_to_obj(next_page, 0);
 		kunmap_atomic(link);
 		page = next_page;
 		off = (off + class->size) % PAGE_SIZE;
@@ -396,7 +430,7 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 
 	init_zspage(first_page, class);
 
-	first_page->freelist = obj_location_to_handle(first_page, 0);
+	first_page->freelist = (void *)location_to_obj(first_page, 0);
 	/* Maximum number of objects we can store in this zspage */
 	first_page->objects = class->zspage_order * PAGE_SIZE / class->size;
 
@@ -457,6 +491,572 @@ static struct notifier_block zs_cpu_nb = {
 	.notifier_call = zs_cpu_notifier
 };
 
+/* Take a free object from the given zspage. Called with class->lock held. */
+static unsigned long obj_malloc(struct page *first_page,
+				struct size_class *class, unsigned long handle)
+{
+	unsigned long obj;
+	struct link_free *link;
+	struct page *m_page;
+	unsigned long m_objidx, m_offset;
+
+	obj = (unsigned long)first_page->freelist;
+	obj_to_location(obj, &m_page, &m_objidx);
+	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
+
+	link = (struct link_free *)((unsigned char *)kmap_atomic(m_page)
+							+ m_offset);
+	first_page->freelist = (void *)link->next;
+	link->handle = handle | OBJ_ALLOCATED_TAG;
+	kunmap_atomic(link);
+
+	first_page->inuse++;
+	class->objs_inuse++;
+
+	return obj;
+}
+
+/* Return an object to its zspage freelist. Called with class->lock held. */
+static void obj_free(struct size_class *class, unsigned long obj)
+{
+	struct link_free *link;
+	struct page *first_page, *f_page;
+	unsigned long f_objidx, f_offset;
+
+	obj_to_location(obj, &f_page, &f_objidx);
+	first_page = get_first_page(f_page);
+	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
+
+	/* Insert this object in containing zspage's freelist */
+	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
+							+ f_offset);
+	link->next = (unsigned long)first_page->freelist;
+	kunmap_atomic(link);
+	first_page->freelist = (void *)obj;
+
+	first_page->inuse--;
+	class->objs_inuse--;
+}
+
+static struct size_class *obj_to_class(struct zs_pool *pool,
+				       unsigned long obj)
+{
+	struct page *page;
+	unsigned long obj_idx;
+	unsigned int class_idx;
+	enum fullness_group fg;
+
+	obj_to_location(obj, &page, &obj_idx);
+	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
+
+	return &pool->size_class[class_idx];
+}
+
+static unsigned long cache_alloc_handle(struct zs_pool *pool)
+{
+	return (unsigned long)kmem_cache_alloc(zs_handle_cache,
+					pool->flags & ~__GFP_HIGHMEM);
+}
+
+static void cache_free_handle(unsigned long handle)
+{
+	kmem_cache_free(zs_handle_cache, (void *)handle);
+}
+
+static void __zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned long obj;
+	struct page *f_page;
+	unsigned long f_objidx;
+	struct page *first_page;
+	struct size_class *class;
+	enum fullness_group fullness;
+
+	/* Keep compaction from moving the object under us */
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &f_page, &f_objidx);
+	first_page = get_first_page(f_page);
+	class = obj_to_class(pool, obj);
+
+	spin_lock(&class->lock);
+	obj_free(class, obj);
+	fullness = fix_fullness_group(pool, first_page);
+	if (fullness == ZS_EMPTY)
+		class->pages_allocated -= class->zspage_order;
+	spin_unlock(&class->lock);
+	unpin_tag(handle);
+
+	cache_free_handle(handle);
+
+	if (fullness == ZS_EMPTY)
+		free_zspage(first_page);
+}
+
+/* Reuse an object this CPU freed recently, if any */
+static unsigned long zs_pcp_get(struct zs_pool *pool, struct size_class *class)
+{
+	struct zs_pcp *pcp;
+	struct zs_pcp_class *pc;
+	unsigned long handle = 0;
+
+	pcp = get_cpu_ptr(pool->pcp);
+	pc = &pcp->class[class->index];
+	spin_lock(&pcp->lock);
+	if (pc->count) {
+		handle = pc->handles[--pc->count];
+		pcp->bytes -= class->size;
+		pcp->hits++;
+	} else {
+		pcp->misses++;
+	}
+	spin_unlock(&pcp->lock);
+	put_cpu_ptr(pool->pcp);
+
+	return handle;
+}
+
+/* Keep a freed object in this CPU's cache. Returns 0 if it is full. */
+static int zs_pcp_put(struct zs_pool *pool, struct size_class *class,
+		      unsigned long handle)
+{
+	struct zs_pcp *pcp;
+	struct zs_pcp_class *pc;
+	int cached = 0;
+
+	pcp = get_cpu_ptr(pool->pcp);
+	pc = &pcp->class[class->index];
+	spin_lock(&pcp->lock);
+	if (pc->count < ZS_PCP_OBJS &&
+	    pcp->bytes + class->size <= ZS_PCP_MAX_BYTES) {
+		pc->handles[pc->count++] = handle;
+		pcp->bytes += class->size;
+		cached = 1;
+	}
+	spin_unlock(&pcp->lock);
+	put_cpu_ptr(pool->pcp);
+
+	return cached;
+}
+
+/* Really free every object held in the per-CPU caches */
+static void zs_pcp_drain(struct zs_pool *pool)
+{
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct zs_pcp *pcp = per_cpu_ptr(pool->pcp, cpu);
+
+		spin_lock(&pcp->lock);
+		for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+			struct zs_pcp_class *pc = &pcp->class[i];
+
+			while (pc->count)
+				__zs_free(pool, pc->handles[--pc->count]);
+		}
+		pcp->bytes = 0;
+		spin_unlock(&pcp->lock);
+	}
+}
+
+/*
+ * Copy an object between zspages. Either side may cross into the next
+ * page of its zspage.
+ */
+static void zs_object_copy(struct page *d_page, unsigned long d_off,
+			   struct page *s_page, unsigned long s_off, int size)
+{
+	void *s_addr, *d_addr;
+
+	while (size) {
+		int len = min_t(int, size, min(PAGE_SIZE - s_off,
+					       PAGE_SIZE - d_off));
+
+		s_addr = kmap_atomic(s_page);
+		d_addr = kmap_atomic(d_page);
+		memcpy(d_addr + d_off, s_addr + s_off, len);
+		kunmap_atomic(d_addr);
+		kunmap_atomic(s_addr);
+
+		size -= len;
+		s_off += len;
+		d_off += len;
+		if (s_off == PAGE_SIZE) {
+			s_page = get_next_page(s_page);
+			s_off = 0;
+		}
+		if (d_off == PAGE_SIZE) {
+			d_page = get_next_page(d_page);
+			d_off = 0;
+		}
+	}
+}
+
+/*
+ * Find the n-th object of a zspage. Returns its handle if it is
+ * allocated, 0 otherwise.
+ */
+static unsigned long zs_nth_object(struct page *first_page,
+				   struct size_class *class, int n,
+				   struct page **page, unsigned long *off)
+{
+	int i;
+	unsigned long pos = (unsigned long)n * class->size;
+	unsigned long word;
+	void *addr;
+
+	*page = first_page;
+	for (i = 0; i < pos / PAGE_SIZE; i++)
+		*page = get_next_page(*page);
+	*off = pos % PAGE_SIZE;
+
+	addr = kmap_atomic(*page);
+	word = *(unsigned long *)(addr + *off);
+	kunmap_atomic(addr);
+
+	return word & OBJ_ALLOCATED_TAG ? word & ~OBJ_ALLOCATED_TAG : 0;
+}
+
+/* Fullest zspage other than the one being emptied, to migrate into */
+static struct page *zs_compact_dst(struct size_class *class)
+{
+	if (class->fullness_list[ZS_ALMOST_FULL])
+		return class->fullness_list[ZS_ALMOST_FULL];
+
+	return class->fullness_list[ZS_ALMOST_EMPTY];
+}
+
+/*
+ * Move every object out of src, which has been taken off the fullness
+ * lists, into other zspages of the class. Objects that are mapped or
+ * being freed are left in place. Called with class->lock held.
+ */
+static void zs_migrate_zspage(struct zs_pool *pool, struct size_class *class,
+			      struct page *src)
+{
+	int n;
+
+	for (n = 0; n < src->objects && src->inuse; n++) {
+		struct page *dst, *s_page, *d_page;
+		unsigned long handle, s_off, used_obj, free_obj, d_idx;
+
+		handle = zs_nth_object(src, class, n, &s_page, &s_off);
+		if (!handle)
+			continue;
+
+		dst = zs_compact_dst(class);
+		if (!dst)
+			break;
+
+		if (!trypin_tag(handle))
+			continue;
+
+		used_obj = handle_to_obj(handle);
+		free_obj = obj_malloc(dst, class, handle);
+		obj_to_location(free_obj, &d_page, &d_idx);
+		zs_object_copy(d_page, obj_idx_to_offset(d_page, d_idx,
+							  class->size),
+			       s_page, s_off, class->size);
+		record_obj(handle, free_obj);
+		unpin_tag(handle);
+
+		obj_free(class, used_obj);
+		fix_fullness_group(pool, dst);
+		pool->objs_migrated++;
+	}
+}
+
+static unsigned long zs_compact_class(struct zs_pool *pool,
+				      struct size_class *class)
+{
+	int nr_src = 0;
+	unsigned long freed = 0;
+	struct page *src, *page, *tmp;
+	LIST_HEAD(free_pages);
+
+	spin_lock(&class->lock);
+	src = class->fullness_list[ZS_ALMOST_EMPTY];
+	if (src) {
+		nr_src = 1;
+		list_for_each_entry(page, &src->lru, lru)
+			nr_src++;
+	}
+
+	/* Try each sparsely used zspage once */
+	while (nr_src--) {
+		enum fullness_group fg;
+
+		src = class->fullness_list[ZS_ALMOST_EMPTY];
+		if (!src)
+			break;
+
+		remove_zspage(src, class, ZS_ALMOST_EMPTY);
+		zs_migrate_zspage(pool, class, src);
+
+		fg = get_fullness_group(src);
+		if (fg == ZS_EMPTY) {
+			class->pages_allocated -= class->zspage_order;
+			set_zspage_mapping(src, class->index, ZS_EMPTY);
+			list_add(&src->lru, &free_pages);
+			freed += class->zspage_order;
+			continue;
+		}
+
+		/* Put it back at the tail so the next src is a new one */
+		insert_zspage(src, class, fg);
+		set_zspage_mapping(src, class->index, fg);
+		if (fg < _ZS_NR_FULLNESS_GROUPS)
+			class->fullness_list[fg] = list_entry(src->lru.next,
+							struct page, lru);
+		if (!zs_compact_dst(class))
+			break;
+	}
+	spin_unlock(&class->lock);
+
+	list_for_each_entry_safe(page, tmp, &free_pages, lru) {
+		list_del_init(&page->lru);
+		free_zspage(page);
+	}
+
+	return freed;
+}
+
+static unsigned long __zs_compact(struct zs_pool *pool,
+				  unsigned long nr_to_free)
+{
+	int i;
+	unsigned long freed = 0;
+
+	zs_pcp_drain(pool);
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0 && freed < nr_to_free; i--) {
+		freed += zs_compact_class(pool, &pool->size_class[i]);
+		cond_resched();
+	}
+
+	pool->compactions++;
+	pool->pages_reclaimed += freed;
+
+	return freed;
+}
+
+/**
+ * zs_compact - consolidate sparsely used zspages
+ * @pool: pool to compact
+ *
+ * Migrates objects out of zspages that are at most 1/fullness_threshold_frac
+ * used into fuller zspages of the same size class and frees the zspages
+ * that end up empty. Objects cached per-CPU are freed first.
+ *
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed;
+
+	mutex_lock(&pool->compact_lock);
+	freed = __zs_compact(pool, ULONG_MAX);
+	mutex_unlock(&pool->compact_lock);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+/*
+ * Pages that compaction can free: only sparsely used zspages are
+ * emptied, and no more of them than the free objects elsewhere in the
+ * class can take in.
+ */
+static unsigned long zs_pages_freeable(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		unsigned long objs_per_zspage, zspages, needed, sparse;
+
+		spin_lock(&class->lock);
+		zspages = div_u64(class->pages_allocated, class->zspage_order);
+		needed = class->objs_inuse;
+		sparse = class->nr_zspages[ZS_ALMOST_EMPTY];
+		spin_unlock(&class->lock);
+
+		objs_per_zspage = class->zspage_order * PAGE_SIZE / class->size;
+		needed = DIV_ROUND_UP(needed, objs_per_zspage);
+		if (zspages <= needed)
+			continue;
+
+		pages += min(zspages - needed, sparse) * class->zspage_order;
+	}
+
+	return pages;
+}
+
+/*
+ * Once a pass frees nothing, report nothing freeable until the estimate
+ * grows past what it was then, so reclaim stops calling us in vain.
+ */
+static int zs_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	unsigned long freeable;
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+					    shrinker);
+
+	if (sc->nr_to_scan && mutex_trylock(&pool->compact_lock)) {
+		if (__zs_compact(pool, sc->nr_to_scan))
+			pool->shrink_stalled = 0;
+		else
+			pool->shrink_stalled = max(zs_pages_freeable(pool),
+						   1UL);
+		mutex_unlock(&pool->compact_lock);
+	}
+
+	freeable = zs_pages_freeable(pool);
+	if (pool->shrink_stalled && freeable <= pool->shrink_stalled)
+		return 0;
+
+	return freeable;
+}
+
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *zs_debugfs_root;
+
+static int zs_classes_show(struct seq_file *s, void *v)
+{
+	int i;
+	struct zs_pool *pool = s->private;
+	unsigned long total_objs = 0, total_used = 0, total_pages = 0;
+
+	seq_printf(s, "%5s %5s %8s %10s %10s %5s\n", "class", "size",
+		   "zspages", "obj_alloc", "obj_used", "util");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		unsigned long zspages, objs, used;
+
+		spin_lock(&class->lock);
+		zspages = div_u64(class->pages_allocated, class->zspage_order);
+		used = class->objs_inuse;
+		spin_unlock(&class->lock);
+
+		if (!zspages)
+			continue;
+
+		objs = zspages * (class->zspage_order * PAGE_SIZE /
+				  class->size);
+		seq_printf(s, "%5d %5d %8lu %10lu %10lu %4lu%%\n", i,
+			   class->size, zspages, objs, used,
+			   used * 100 / objs);
+
+		total_objs += objs;
+		total_used += used;
+		total_pages += zspages * class->zspage_order;
+	}
+
+	seq_printf(s, "total: %lu pages, %lu/%lu objects, %lu pages "
+		   "freeable\n", total_pages, total_used, total_objs,
+		   zs_pages_freeable(pool));
+
+	return 0;
+}
+
+static int zs_classes_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_classes_show, inode->i_private);
+}
+
+static const struct file_operations zs_classes_fops = {
+	.open		= zs_classes_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int zs_stats_show(struct seq_file *s, void *v)
+{
+	int cpu;
+	u64 hits = 0, misses = 0;
+	struct zs_pool *pool = s->private;
+
+	for_each_possible_cpu(cpu) {
+		struct zs_pcp *pcp = per_cpu_ptr(pool->pcp, cpu);
+
+		spin_lock(&pcp->lock);
+		hits += pcp->hits;
+		misses += pcp->misses;
+		spin_unlock(&pcp->lock);
+	}
+
+	mutex_lock(&pool->compact_lock);
+	seq_printf(s, "pcp_hits: %llu\n", hits);
+	seq_printf(s, "pcp_misses: %llu\n", misses);
+	seq_printf(s, "compactions: %llu\n", pool->compactions);
+	seq_printf(s, "objs_migrated: %llu\n", pool->objs_migrated);
+	seq_printf(s, "pages_reclaimed: %llu\n", pool->pages_reclaimed);
+	mutex_unlock(&pool->compact_lock);
+
+	return 0;
+}
+
+static int zs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_show, inode->i_private);
+}
+
+static const struct file_operations zs_stats_fops = {
+	.open		= zs_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int zs_compact_set(void *data, u64 val)
+{
+	if (val)
+		zs_compact(data);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zs_compact_fops, NULL, zs_compact_set, "%llu\n");
+
+static void zs_pool_debugfs_create(struct zs_pool *pool)
+{
+	if (!zs_debugfs_root)
+		return;
+
+	pool->debugfs_dir = debugfs_create_dir(pool->name, zs_debugfs_root);
+	if (!pool->debugfs_dir)
+		return;
+
+	debugfs_create_file("classes", S_IRUGO, pool->debugfs_dir, pool,
+			    &zs_classes_fops);
+	debugfs_create_file("stats", S_IRUGO, pool->debugfs_dir, pool,
+			    &zs_stats_fops);
+	debugfs_create_file("compact", S_IWUSR, pool->debugfs_dir, pool,
+			    &zs_compact_fops);
+}
+
+static void zs_pool_debugfs_remove(struct zs_pool *pool)
+{
+	debugfs_remove_recursive(pool->debugfs_dir);
+}
+
+static void zs_debugfs_init(void)
+{
+	zs_debugfs_root = debugfs_create_dir("zsmalloc", NULL);
+}
+
+static void zs_debugfs_exit(void)
+{
+	debugfs_remove_recursive(zs_debugfs_root);
+}
+#else
+static void zs_pool_debugfs_create(struct zs_pool *pool) { }
+static void zs_pool_debugfs_remove(struct zs_pool *pool) { }
+static void zs_debugfs_init(void) { }
+static void zs_debugfs_exit(void) { }
+#endif
+
 static void zs_exit(void)
 {
 	int cpu;
@@ -464,12 +1064,23 @@ static void zs_exit(void)
 	for_each_online_cpu(cpu)
 		zs_cpu_notifier(NULL, CPU_DEAD, (void *)(long)cpu);
 	unregister_cpu_notifier(&zs_cpu_nb);
+
+	zs_debugfs_exit();
+	if (zs_handle_cache)
+		kmem_cache_destroy(zs_handle_cache);
 }
 
 static int zs_init(void)
 {
 	int cpu, ret;
 
+	zs_handle_cache = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+					    0, 0, NULL);
+	if (!zs_handle_cache)
+		return -ENOMEM;
+
+	zs_debugfs_init();
+
 	register_cpu_notifier(&zs_cpu_nb);
 	for_each_online_cpu(cpu) {
 		ret = zs_cpu_notifier(NULL, CPU_UP_PREPARE, (void *)(long)cpu);
@@ -484,7 +1095,7 @@ fail:
 
 struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 {
-	int i, ovhd_size;
+	int i, cpu, ovhd_size;
 	struct zs_pool *pool;
 
 	if (!name)
@@ -495,6 +1106,14 @@ struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 	if (!pool)
 		return NULL;
 
+	pool->pcp = alloc_percpu(struct zs_pcp);
+	if (!pool->pcp) {
+		kfree(pool);
+		return NULL;
+	}
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(pool->pcp, cpu)->lock);
+
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		int size;
 		struct size_class *class;
@@ -514,6 +1133,13 @@ struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 	pool->flags = flags;
 	pool->name = name;
 
+	mutex_init(&pool->compact_lock);
+	pool->shrinker.shrink = zs_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	zs_pool_debugfs_create(pool);
+
 	return pool;
 }
 EXPORT_SYMBOL_GPL(zs_create_pool);
@@ -522,6 +1148,10 @@ void zs_destroy_pool(struct zs_pool *pool)
 {
 	int i;
 
+	zs_pool_debugfs_remove(pool);
+	unregister_shrinker(&pool->shrinker);
+	zs_pcp_drain(pool);
+
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		int fg;
 		struct size_class *class = &pool->size_class[i];
@@ -534,6 +1164,7 @@ void zs_destroy_pool(struct zs_pool *pool)
 			}
 		}
 	}
+	free_percpu(pool->pcp);
 	kfree(pool);
 }
 EXPORT_SYMBOL_GPL(zs_destroy_pool);
@@ -542,111 +1173,87 @@ EXPORT_SYMBOL_GPL(zs_destroy_pool);
  * zs_malloc - Allocate block of given size from pool.
  * @pool: pool to allocate from
  * @size: size of block to allocate
- * @page: page no. that holds the object
- * @offset: location of object within page
  *
- * On success, <page, offset> identifies block allocated
- * and 0 is returned. On failure, <page, offset> is set to
- * 0 and -ENOMEM is returned.
+ * On success, a handle to the allocated object is returned,
+ * otherwise NULL. The handle stays valid when compaction moves
+ * the object; use zs_map_object() to access it.
  *
- * Allocation requests with size > ZS_MAX_ALLOC_SIZE will fail.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * will fail.
  */
 void *zs_malloc(struct zs_pool *pool, size_t size)
 {
-	void *obj;
-	struct link_free *link;
+	unsigned long handle, obj;
 	int class_idx;
 	struct size_class *class;
+	struct page *first_page;
 
-	struct page *first_page, *m_page;
-	unsigned long m_objidx, m_offset;
-
-	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
 		return NULL;
 
+	/* The handle is stored in front of each object */
+	size += ZS_HANDLE_SIZE;
 	class_idx = get_size_class_index(size);
 	class = &pool->size_class[class_idx];
 	BUG_ON(class_idx != class->index);
 
+	handle = zs_pcp_get(pool, class);
+	if (handle)
+		return (void *)handle;
+
+	handle = cache_alloc_handle(pool);
+	if (!handle)
+		return NULL;
+
 	spin_lock(&class->lock);
 	first_page = find_get_zspage(class);
 
 	if (!first_page) {
 		spin_unlock(&class->lock);
 		first_page = alloc_zspage(class, pool->flags);
-		if (unlikely(!first_page))
+		if (unlikely(!first_page)) {
+			cache_free_handle(handle);
 			return NULL;
+		}
 
 		set_zspage_mapping(first_page, class->index, ZS_EMPTY);
 		spin_lock(&class->lock);
 		class->pages_allocated += class->zspage_order;
 	}
 
-	obj = first_page->freelist;
-	obj_handle_to_location(obj, &m_page, &m_objidx);
-	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
-
-	link = (struct link_free *)kmap_atomic(m_page) +
-					m_offset / sizeof(*link);
-	first_page->freelist = link->next;
-	memset(link, POISON_INUSE, sizeof(*link));
-	kunmap_atomic(link);
-
-	first_page->inuse++;
+	obj = obj_malloc(first_page, class, handle);
 	/* Now move the zspage to another fullness group, if required */
 	fix_fullness_group(pool, first_page);
+	*(unsigned long *)handle = obj;
 	spin_unlock(&class->lock);
 
-	return obj;
+	return (void *)handle;
 }
 EXPORT_SYMBOL_GPL(zs_malloc);
 
-void zs_free(struct zs_pool *pool, void *obj)
+void zs_free(struct zs_pool *pool, void *handle)
 {
-	struct link_free *link;
-	struct page *first_page, *f_page;
-	unsigned long f_objidx, f_offset;
-
-	int class_idx;
 	struct size_class *class;
-	enum fullness_group fullness;
 
-	if (unlikely(!obj))
+	if (unlikely(!handle))
 		return;
 
-	obj_handle_to_location(obj, &f_page, &f_objidx);
-	first_page = get_first_page(f_page);
+	/* Pinned so that the zspage can't be freed by compaction meanwhile */
+	pin_tag((unsigned long)handle);
+	class = obj_to_class(pool, handle_to_obj((unsigned long)handle));
+	unpin_tag((unsigned long)handle);
 
-	get_zspage_mapping(first_page, &class_idx, &fullness);
-	class = &pool->size_class[class_idx];
-	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
-
-	spin_lock(&class->lock);
-
-	/* Insert this object in containing zspage's freelist */
-	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
-							+ f_offset);
-	link->next = first_page->freelist;
-	kunmap_atomic(link);
-	first_page->freelist = obj;
-
-	first_page->inuse--;
-	fullness = fix_fullness_group(pool, first_page);
-
-	if (fullness == ZS_EMPTY)
-		class->pages_allocated -= class->zspage_order;
-
-	spin_unlock(&class->lock);
+	if (zs_pcp_put(pool, class, (unsigned long)handle))
+		return;
 
-	if (fullness == ZS_EMPTY)
-		free_zspage(first_page);
+	__zs_free(pool, (unsigned long)handle);
 }
 EXPORT_SYMBOL_GPL(zs_free);
 
 void *zs_map_object(struct zs_pool *pool, void *handle)
 {
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
@@ -655,7 +1262,11 @@ void *zs_map_object(struct zs_pool *pool, void *handle)
 
 	BUG_ON(!handle);
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	/* Pinned until zs_unmap_object(), so compaction leaves it alone */
+	pin_tag((unsigned long)handle);
+
+	obj = handle_to_obj((unsigned long)handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
@@ -679,14 +1290,14 @@ void *zs_map_object(struct zs_pool *pool, void *handle)
 		area->vm_addr = area->vm->addr;
 	}
 
-	return area->vm_addr + off;
+	return area->vm_addr + off + ZS_HANDLE_SIZE;
 }
 EXPORT_SYMBOL_GPL(zs_map_object);
 
 void zs_unmap_object(struct zs_pool *pool, void *handle)
 {
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
@@ -695,7 +1306,8 @@ void zs_unmap_object(struct zs_pool *pool, void *handle)
 
 	BUG_ON(!handle);
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	obj = handle_to_obj((unsigned long)handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
@@ -710,6 +1322,8 @@ void zs_unmap_object(struct zs_pool *pool, void *handle)
 		__flush_tlb_one((unsigned long)area->vm_addr + PAGE_SIZE);
 	}
 	put_cpu_var(zs_map_area);
+
+	unpin_tag((unsigned long)handle);
 }
 EXPORT_SYMBOL_GPL(zs_unmap_object);
 
@@ -14,6 +14,9 @@
 #define _ZS_MALLOC_INT_H_
 
 #include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
 
@@ -34,12 +37,22 @@
 
 /*
  * Object location (<PFN>, <obj_idx>) is encoded as
- * as single (void *) handle value.
+ * as single unsigned long 'obj' value, shifted left by OBJ_TAG_BITS.
  *
  * Note that object index <obj_idx> is relative to system
  * page <PFN> it is stored in, so for each sub-page belonging
  * to a zspage, obj_idx starts with 0.
  *
+ * Users get a handle instead of the obj value: a pointer to a word
+ * holding the current obj value. This indirection lets compaction
+ * move objects between zspages. Bit HANDLE_PIN_BIT of that word pins
+ * the object in place while it is mapped or being freed.
+ *
+ * The first word of every allocated object stores its handle, tagged
+ * with OBJ_ALLOCATED_TAG, so that compaction can find the handle to
+ * update. Free objects store the next free obj value there instead,
+ * which never has that bit set.
+ *
  * This is made more complicated by various memory models and PAE.
  */
 
@@ -55,9 +68,14 @@
 #endif
 #endif
 #define _PFN_BITS		(MAX_PHYSMEM_BITS - PAGE_SHIFT)
-#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS)
+#define OBJ_TAG_BITS	1
+#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
 #define OBJ_INDEX_MASK	((_AC(1, UL) << OBJ_INDEX_BITS) - 1)
 
+#define OBJ_ALLOCATED_TAG	1
+#define HANDLE_PIN_BIT		0
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+
 #define MAX(a, b) ((a) >= (b) ? (a) : (b))
 /* ZS_MIN_ALLOC_SIZE must be multiple of ZS_ALIGN */
 #define ZS_MIN_ALLOC_SIZE \
@@ -130,19 +148,48 @@ struct size_class {
 
 	/* stats */
 	u64 pages_allocated;
+	unsigned long objs_inuse;
 
 	struct page *fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	unsigned long nr_zspages[_ZS_NR_FULLNESS_GROUPS];
 };
 
 /*
  * Placed within free objects to form a singly linked list.
  * For every zspage, first_page->freelist gives head of this list.
+ * Allocated objects store their tagged handle in the same place.
  *
  * This must be power of 2 and less than or equal to ZS_ALIGN
  */
 struct link_free {
-	/* Handle of next free chunk (encodes <PFN, obj_idx>) */
-	void *next;
+	union {
+		/* obj value of next free chunk (encodes <PFN, obj_idx>) */
+		unsigned long next;
+		/* Handle of this allocated object | OBJ_ALLOCATED_TAG */
+		unsigned long handle;
+	};
+};
+
+/*
+ * Per-CPU cache of recently freed objects, ZS_PCP_OBJS per size class
+ * and at most ZS_PCP_MAX_BYTES in total. zs_malloc() reuses them
+ * without touching the class lock or the zspage freelists.
+ */
+#define ZS_PCP_OBJS		4
+#define ZS_PCP_MAX_BYTES	(16 * 1024)
+
+struct zs_pcp_class {
+	unsigned int count;
+	unsigned long handles[ZS_PCP_OBJS];
+};
+
+struct zs_pcp {
+	/* Only contended when compaction drains the cache */
+	spinlock_t lock;
+	unsigned int bytes;
+	u64 hits;
+	u64 misses;
+	struct zs_pcp_class class[ZS_SIZE_CLASSES];
 };
 
 struct zs_pool {
@@ -150,6 +197,19 @@ struct zs_pool {
 
 	gfp_t flags;	/* allocation flags used when growing pool */
 	const char *name;
+
+	struct zs_pcp __percpu *pcp;
+
+	/* Compaction, serialized by compact_lock */
+	struct mutex compact_lock;
+	struct shrinker shrinker;
+	u64 compactions;
+	u64 objs_migrated;
+	u64 pages_reclaimed;
+	/* Freeable estimate when a shrinker pass last freed nothing */
+	unsigned long shrink_stalled;
+
+	struct dentry *debugfs_dir;
 };
 
 #endif
@@ -1114,8 +1114,51 @@ static ssize_t mtp_debug_level_store(
 
 static DEVICE_ATTR(mtp_debug_level, S_IRUGO | S_IWUSR, mtp_debug_level_show,
 						    mtp_debug_level_store);
+
+static ssize_t mtp_xfer_stats_show(char *buf, const char *name,
+				   struct mtp_xfer_stats *stats)
+{
+	u64 us = max_t(u64, div_u64(stats->wall_ns, NSEC_PER_USEC), 1);
+	u32 rate = div64_u64(stats->bytes * 100, us);
+
+	return sprintf(buf, "%s: %lu files, %llu bytes, %llu ms, "
+		       "%u.%02u MB/s, cpu %llu%%\n", name, stats->files,
+		       stats->bytes, div_u64(stats->wall_ns, NSEC_PER_MSEC),
+		       rate / 100, rate % 100,
+		       div64_u64(stats->cpu_ns * 100,
+				 max_t(u64, stats->wall_ns, 1)));
+}
+
+static ssize_t mtp_perf_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	ssize_t len;
+
+	if (!_mtp_dev)
+		return -ENODEV;
+	len = mtp_xfer_stats_show(buf, "send", &_mtp_dev->send_stats);
+	len += mtp_xfer_stats_show(buf + len, "receive",
+				   &_mtp_dev->receive_stats);
+	return len;
+}
+
+static ssize_t mtp_perf_stats_store(
+		struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t size)
+{
+	if (_mtp_dev) {
+		memset(&_mtp_dev->send_stats, 0, sizeof(struct mtp_xfer_stats));
+		memset(&_mtp_dev->receive_stats, 0,
+		       sizeof(struct mtp_xfer_stats));
+	}
+	return size;
+}
+
+static DEVICE_ATTR(mtp_perf_stats, S_IRUGO | S_IWUSR, mtp_perf_stats_show,
+						    mtp_perf_stats_store);
 static struct device_attribute *mtp_function_attributes[] = {
 	&dev_attr_mtp_debug_level,
+	&dev_attr_mtp_perf_stats,
 	NULL
 };
 
@@ -28,6 +28,8 @@
 
 #include <linux/types.h>
 #include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/backing-dev.h>
 #include <linux/device.h>
 #include <linux/miscdevice.h>
 
@@ -50,8 +52,12 @@
 #define STATE_ERROR                 4   /* error from completion routine */
 
 /* number of tx and rx requests to allocate */
-#define TX_REQ_MAX 4
-#define RX_REQ_MAX 2
+/*
+ * The controller takes at most one 16K buffer per request, so keep enough
+ * of them queued to ride out a slow vfs_read() or vfs_write().
+ */
+#define TX_REQ_MAX 8
+#define RX_REQ_MAX 8
 #define INTR_REQ_MAX 5
 
 /* ID for Microsoft MTP OS String */
@@ -76,6 +82,14 @@ static int mtp_qos;
 
 static const char mtp_shortname[] = "mtp_usb";
 
+/* totals over the file transfers in one direction */
+struct mtp_xfer_stats {
+	unsigned long files;
+	u64 bytes;
+	u64 wall_ns;
+	u64 cpu_ns;
+};
+
 struct mtp_dev {
 	struct usb_function function;
 	struct usb_composite_dev *cdev;
@@ -121,8 +135,8 @@ struct mtp_dev {
 	struct timer_list perf_timer;
 	unsigned long timer_expired;
 #endif
-	struct timeval st0;
-	struct timeval st1;
+	struct mtp_xfer_stats send_stats;
+	struct mtp_xfer_stats receive_stats;
 };
 
 static struct usb_interface_descriptor mtp_interface_desc = {
@@ -696,6 +710,29 @@ static ssize_t mtp_write(struct file *fp, const char __user *buf,
 	return r;
 }
 
+static void mtp_account_xfer(struct mtp_xfer_stats *stats, const char *name,
+			     u64 bytes, ktime_t start, u64 cpu_start)
+{
+	u64 wall_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	u64 cpu_ns = current->se.sum_exec_runtime - cpu_start;
+
+	stats->files++;
+	stats->bytes += bytes;
+	stats->wall_ns += wall_ns;
+	stats->cpu_ns += cpu_ns;
+
+	if (htc_mtp_performance_debug) {
+		u64 us = max_t(u64, div_u64(wall_ns, NSEC_PER_USEC), 1);
+		u32 rate = div64_u64(bytes * 100, us);
+
+		printk(KERN_INFO "[USB][MTP]%s, total time:%llu, %llu bytes, "
+		       "%u.%02u MB/s, cpu %llu%%\n", name,
+		       div_u64(wall_ns, NSEC_PER_MSEC), bytes,
+		       rate / 100, rate % 100,
+		       div64_u64(cpu_ns * 100, max_t(u64, wall_ns, 1)));
+	}
+}
+
 /* read from a local file and write to USB */
 static void send_file_work(struct work_struct *data)
 {
@@ -710,7 +747,10 @@ static void send_file_work(struct work_struct *data)
 	int xfer, ret, hdr_size;
 	int r = 0;
 	int sendZLP = 0;
-	long diff = 0;
+	int64_t sent = 0;
+	ktime_t start = ktime_get();
+	u64 cpu_start = current->se.sum_exec_runtime;
+	struct backing_dev_info *bdi;
 
 	/* read our parameters */
 	smp_rmb();
@@ -720,6 +760,16 @@ static void send_file_work(struct work_struct *data)
 
 	DBG(cdev, "send_file_work(%lld %lld)\n", offset, count);
 
+	/*
+	 * Read ahead as for POSIX_FADV_SEQUENTIAL, so that vfs_read() finds
+	 * the page cache filled and the IN queue does not run dry.
+	 */
+	bdi = filp->f_mapping->backing_dev_info;
+	spin_lock(&filp->f_lock);
+	if (filp->f_ra.ra_pages < bdi->ra_pages * 2)
+		filp->f_ra.ra_pages = bdi->ra_pages * 2;
+	spin_unlock(&filp->f_lock);
+
 	if (dev->xfer_send_header) {
 		hdr_size = sizeof(struct mtp_data_header);
 		count += hdr_size;
@@ -733,8 +783,6 @@ static void send_file_work(struct work_struct *data)
 	if ((count & (dev->ep_in->maxpacket - 1)) == 0)
 		sendZLP = 1;
 
-	if (htc_mtp_performance_debug)
-		do_gettimeofday(&dev->st0);
 	while (count > 0 || sendZLP) {
 		/* so we exit after sending ZLP */
 		if (count == 0)
@@ -789,19 +837,17 @@ static void send_file_work(struct work_struct *data)
 		}
 
 		count -= xfer;
+		sent += xfer;
 
 		/* zero this so we don't try to free it on error exit */
 		req = 0;
 	}
-	if (htc_mtp_performance_debug) {
-		do_gettimeofday(&dev->st1);
-		diff = (dev->st1.tv_sec-dev->st0.tv_sec)*1000 + (dev->st1.tv_usec-dev->st0.tv_usec)/1000;
-		printk(KERN_INFO "[USB][MTP]%s, total time:%ld\n", __func__, diff);
-	}
 
 	if (req)
 		mtp_req_put(dev, &dev->tx_idle, req);
 
+	mtp_account_xfer(&dev->send_stats, __func__, sent, start, cpu_start);
+
 	DBG(cdev, "send_file_work returning %d\n", r);
 #ifdef CONFIG_PERFLOCK
 	mod_timer(&dev->perf_timer, MTP_TRANSFER_EXPIRED);
@@ -811,19 +857,27 @@ static void send_file_work(struct work_struct *data)
 	smp_wmb();
 }
 
-/* read from USB and write to a local file */
+/*
+ * read from USB and write to a local file
+ *
+ * All rx requests are kept queued as long as data is expected, and are
+ * written out in order as they complete, so the OUT endpoint keeps
+ * receiving while vfs_write() blocks.
+ */
 static void receive_file_work(struct work_struct *data)
 {
 	struct mtp_dev *dev = container_of(data, struct mtp_dev,
 						receive_file_work);
 	struct usb_composite_dev *cdev = dev->cdev;
-	struct usb_request *read_req = NULL, *write_req = NULL;
+	struct usb_request *req;
 	struct file *filp;
 	loff_t offset;
-	int64_t count;
-	int ret, cur_buf = 0;
+	int64_t count, to_queue, received = 0;
+	bool unknown_length, eof = false;
+	int ret, head = 0, queued = 0;
 	int r = 0;
-	long diff = 0;
+	ktime_t start = ktime_get();
+	u64 cpu_start = current->se.sum_exec_runtime;
 
 	/* read our parameters */
 	smp_rmb();
@@ -831,79 +885,97 @@ static void receive_file_work(struct work_struct *data)
 	offset = dev->xfer_file_offset;
 	count = dev->xfer_file_length;
 
-	DBG(cdev, "receive_file_work(%lld)\n", count);
-	if (htc_mtp_performance_debug)
-		do_gettimeofday(&dev->st0);
+	/* if xfer_file_length is 0xFFFFFFFF, then we read until
+	 * we get a zero length packet
+	 */
+	unknown_length = (count == 0xFFFFFFFF);
+	to_queue = count;
 
-	while (count > 0 || write_req) {
-		if (count > 0) {
-			/* queue a request */
-			read_req = dev->rx_req[cur_buf];
-			cur_buf = (cur_buf + 1) % RX_REQ_MAX;
+	DBG(cdev, "receive_file_work(%lld)\n", count);
 
-			read_req->length = (count > MTP_BULK_BUFFER_SIZE
-					? MTP_BULK_BUFFER_SIZE : count);
+	while (!eof) {
+		/* keep the OUT queue full */
+		while (queued < RX_REQ_MAX && (unknown_length || to_queue > 0)) {
+			req = dev->rx_req[(head + queued) % RX_REQ_MAX];
+			req->length = MTP_BULK_BUFFER_SIZE;
+			if (!unknown_length && to_queue < MTP_BULK_BUFFER_SIZE)
+				req->length = to_queue;
+			req->status = -EINPROGRESS;
 			dev->rx_done = 0;
-			ret = usb_ep_queue(dev->ep_out, read_req, GFP_KERNEL);
+			ret = usb_ep_queue(dev->ep_out, req, GFP_KERNEL);
 			if (ret < 0) {
 				INFO(cdev, "%s(%d) usb_ep_queue error, ret:%d\n",__func__, __LINE__, ret);
 				r = -EIO;
 				if (dev->state != STATE_OFFLINE)
 					dev->state = STATE_ERROR;
-				break;
+				goto out;
 			}
+			if (!unknown_length)
+				to_queue -= req->length;
+			queued++;
 		}
+		if (!queued)
+			break;
 
-		if (write_req) {
-			DBG(cdev, "rx %p %d\n", write_req, write_req->actual);
-			ret = vfs_write(filp, write_req->buf, write_req->actual,
-				&offset);
-			DBG(cdev, "vfs_write %d\n", ret);
-			if (ret != write_req->actual) {
-				r = -EIO;
-				INFO(cdev, "%s(%d) vfs_write error, ret:%d\n",__func__, __LINE__, ret);
-				if (dev->state != STATE_OFFLINE)
-					dev->state = STATE_ERROR;
-				break;
-			}
-			write_req = NULL;
+		/* wait for the oldest read to complete */
+		req = dev->rx_req[head];
+		ret = wait_event_interruptible(dev->read_wq,
+			req->status != -EINPROGRESS ||
+			dev->state != STATE_BUSY);
+		if (dev->state == STATE_CANCELED) {
+			r = -ECANCELED;
+			goto out;
+		}
+		if (ret < 0 || req->status == -EINPROGRESS) {
+			r = ret < 0 ? ret : -EIO;
+			goto out;
+		}
+		head = (head + 1) % RX_REQ_MAX;
+		queued--;
+		if (req->status != 0) {
+			r = -EIO;
+			goto out;
 		}
 
-		if (read_req) {
-			/* wait for our last read to complete */
-			ret = wait_event_interruptible(dev->read_wq,
-				dev->rx_done || dev->state != STATE_BUSY);
-			if (dev->state == STATE_CANCELED) {
-				r = -ECANCELED;
-				if (!dev->rx_done)
-					usb_ep_dequeue(dev->ep_out, read_req);
-				break;
-			}
-			/* if xfer_file_length is 0xFFFFFFFF, then we read until
-			 * we get a zero length packet
+		if (!unknown_length) {
+			count -= req->actual;
+			if (count <= 0)
+				eof = true;
+		}
+		if (req->actual < req->length) {
+			/*
+			 * short packet is used to signal EOF for
+			 * sizes > 4 gig
 			 */
-			if (count != 0xFFFFFFFF)
-				count -= read_req->actual;
-			if (read_req->actual < read_req->length) {
-				/*
-				 * short packet is used to signal EOF for
-				 * sizes > 4 gig
-				 */
-				DBG(cdev, "got short packet\n");
-				count = 0;
-			}
+			DBG(cdev, "got short packet\n");
+			eof = true;
+		}
 
-			write_req = read_req;
-			read_req = NULL;
+		DBG(cdev, "rx %p %d\n", req, req->actual);
+		ret = vfs_write(filp, req->buf, req->actual, &offset);
+		DBG(cdev, "vfs_write %d\n", ret);
+		if (ret != req->actual) {
+			r = -EIO;
+			INFO(cdev, "%s(%d) vfs_write error, ret:%d\n",__func__, __LINE__, ret);
+			if (dev->state != STATE_OFFLINE)
+				dev->state = STATE_ERROR;
+			goto out;
 		}
+		received += ret;
 	}
 
-	DBG(cdev, "receive_file_work returning %d\n", r);
-	if (htc_mtp_performance_debug) {
-		do_gettimeofday(&dev->st1);
-		diff = (dev->st1.tv_sec-dev->st0.tv_sec)*1000 + (dev->st1.tv_usec-dev->st0.tv_usec)/1000;
-		printk(KERN_INFO "[USB][MTP]%s, total time:%ld\n", __func__, diff);
+out:
+	/* reads queued past the end of the data must not eat the next one */
+	while (queued--) {
+		req = dev->rx_req[head];
+		if (req->status == -EINPROGRESS)
+			usb_ep_dequeue(dev->ep_out, req);
+		head = (head + 1) % RX_REQ_MAX;
 	}
+
+	DBG(cdev, "receive_file_work returning %d\n", r);
+	mtp_account_xfer(&dev->receive_stats, __func__, received, start,
+			 cpu_start);
 #ifdef CONFIG_PERFLOCK
 	mod_timer(&dev->perf_timer, MTP_TRANSFER_EXPIRED);
 #endif
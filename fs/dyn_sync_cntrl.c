@@ -19,10 +19,21 @@
 #include <linux/sysfs.h>
 #include <linux/earlysuspend.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/ktime.h>
 
 #include <linux/writeback.h>
 
-#define DYN_FSYNC_VERSION 1
+#if IS_BUILTIN(CONFIG_EXT4_FS)
+#include "ext4/ext4.h"
+#endif
+
+#define DYN_FSYNC_VERSION 2
 
 /*
  * fsync_mutex protects dyn_fsync_active during early suspend / lat resume transitions
@@ -32,6 +43,212 @@ static DEFINE_MUTEX(fsync_mutex);
 bool early_suspend_active = false;
 static bool dyn_fsync_active = true;
 
+/*
+ * Batched mode: instead of being skipped or run one at a time, fsync and
+ * fdatasync calls on the same filesystem that arrive within
+ * dyn_fsync_batch_window_us of each other are made durable together, by
+ * one journal commit and one device cache flush. Every caller first writes
+ * back and waits on its own file data, then joins the open batch of its
+ * filesystem, or opens one and becomes its leader. The leader sleeps
+ * through the window, closes the batch and syncs the filesystem for
+ * everyone in it; nobody returns before that sync has completed.
+ */
+bool dyn_fsync_batch = false;
+static unsigned int dyn_fsync_batch_window_us = 2000;
+
+/*
+ * Filesystems whose sync_fs commits the journal holding every metadata
+ * change made before it was called, which is what makes one sync_fs stand
+ * in for the fsync of each file in the batch. Others are synced one file at
+ * a time as usual.
+ */
+static const char * const dyn_fsync_batch_fs[] = {
+	"ext4",
+	NULL,
+};
+
+struct dyn_fsync_batch {
+	struct list_head list;		/* in dyn_fsync_batches while open */
+	struct super_block *sb;
+	atomic_t refs;			/* leader and waiters */
+	unsigned int nr;		/* fsyncs in the batch */
+	struct completion done;
+	int ret;
+};
+
+/* dyn_fsync_lock protects the open batches and the statistics */
+static DEFINE_SPINLOCK(dyn_fsync_lock);
+static LIST_HEAD(dyn_fsync_batches);
+
+static struct {
+	u64 calls;		/* fsyncs that were batched */
+	u64 batches;		/* filesystem syncs they took */
+	u64 errors;
+	u64 latency_ns;		/* total time spent in batched fsyncs */
+	u64 max_latency_ns;
+	unsigned int max_batch;
+} dyn_fsync_stats;
+
+static bool dyn_fsync_batchable(struct super_block *sb)
+{
+	int i;
+
+	if (!sb->s_bdev || !sb->s_op->sync_fs || (sb->s_flags & MS_RDONLY))
+		return false;
+	for (i = 0; dyn_fsync_batch_fs[i]; i++)
+		if (!strcmp(sb->s_type->name, dyn_fsync_batch_fs[i]))
+			return true;
+	return false;
+}
+
+static void dyn_fsync_batch_put(struct dyn_fsync_batch *b)
+{
+	if (atomic_dec_and_test(&b->refs))
+		kfree(b);
+}
+
+/*
+ * Whether the sync_fs of a batch must be followed by a device cache flush
+ * for data overwritten in place, decided as ext4_sync_file() does: not
+ * with barriers off (nobarrier), nor when the journal commit sync_fs waits
+ * for sends one anyway. Called before sync_fs.
+ */
+static bool dyn_fsync_needs_flush(struct super_block *sb)
+{
+#if IS_BUILTIN(CONFIG_EXT4_FS)
+	journal_t *journal;
+	tid_t tid;
+
+	if (strcmp(sb->s_type->name, "ext4"))
+		return true;
+
+	journal = EXT4_SB(sb)->s_journal;
+	if (!journal)
+		return test_opt(sb, BARRIER);
+	if (!(journal->j_flags & JBD2_BARRIER))
+		return false;
+
+	/* the newest transaction, sync_fs commits it if still open */
+	read_lock(&journal->j_state_lock);
+	tid = journal->j_transaction_sequence - 1;
+	read_unlock(&journal->j_state_lock);
+
+	return !jbd2_trans_will_send_data_barrier(journal, tid);
+#else
+	return true;
+#endif
+}
+
+/* syncs the filesystem of a batch once the window has passed */
+static void dyn_fsync_batch_lead(struct dyn_fsync_batch *b)
+{
+	struct super_block *sb = b->sb;
+	bool needs_flush;
+	int ret, err;
+
+	if (dyn_fsync_batch_window_us)
+		usleep_range(dyn_fsync_batch_window_us,
+			     dyn_fsync_batch_window_us +
+			     dyn_fsync_batch_window_us / 4);
+
+	/* callers arriving from now on may not be covered, close the batch */
+	spin_lock(&dyn_fsync_lock);
+	list_del(&b->list);
+	dyn_fsync_stats.batches++;
+	if (b->nr > dyn_fsync_stats.max_batch)
+		dyn_fsync_stats.max_batch = b->nr;
+	spin_unlock(&dyn_fsync_lock);
+
+	needs_flush = dyn_fsync_needs_flush(sb);
+	ret = sb->s_op->sync_fs(sb, 1);
+	/* data overwritten in place does not go through the journal */
+	if (needs_flush) {
+		err = blkdev_issue_flush(sb->s_bdev, GFP_KERNEL, NULL);
+		if (!ret && err != -EOPNOTSUPP)
+			ret = err;
+	}
+
+	b->ret = ret;
+	complete_all(&b->done);
+}
+
+/**
+ * dyn_fsync_batched - fsync or fdatasync @file as part of a batch
+ * @file:	file to sync
+ * @start:	offset in bytes of the beginning of data range to sync
+ * @end:	offset in bytes of the end of data range (inclusive)
+ * @datasync:	perform only datasync
+ *
+ * Called by vfs_fsync_range() in batched mode. Returns once the data
+ * and metadata of @file are as durable as its own fsync would have made
+ * them.
+ */
+int dyn_fsync_batched(struct file *file, loff_t start, loff_t end,
+		      int datasync)
+{
+	struct super_block *sb = file->f_mapping->host->i_sb;
+	struct dyn_fsync_batch *b, *new;
+	ktime_t begin;
+	u64 delta;
+	int ret;
+
+	if (!file->f_op || !file->f_op->fsync)
+		return -EINVAL;
+	if (!dyn_fsync_batchable(sb))
+		return file->f_op->fsync(file, start, end, datasync);
+
+	begin = ktime_get();
+
+	ret = filemap_write_and_wait_range(file->f_mapping, start, end);
+	if (ret)
+		goto out;
+
+	new = kmalloc(sizeof(*new), GFP_KERNEL);
+	if (!new) {
+		ret = file->f_op->fsync(file, start, end, datasync);
+		goto out;
+	}
+
+	spin_lock(&dyn_fsync_lock);
+	list_for_each_entry(b, &dyn_fsync_batches, list) {
+		if (b->sb == sb) {
+			atomic_inc(&b->refs);
+			b->nr++;
+			spin_unlock(&dyn_fsync_lock);
+			kfree(new);
+
+			wait_for_completion(&b->done);
+			ret = b->ret;
+			dyn_fsync_batch_put(b);
+			goto out;
+		}
+	}
+	b = new;
+	b->sb = sb;
+	atomic_set(&b->refs, 1);
+	b->nr = 1;
+	init_completion(&b->done);
+	list_add(&b->list, &dyn_fsync_batches);
+	spin_unlock(&dyn_fsync_lock);
+
+	dyn_fsync_batch_lead(b);
+	ret = b->ret;
+	dyn_fsync_batch_put(b);
+
+out:
+	delta = ktime_to_ns(ktime_sub(ktime_get(), begin));
+	spin_lock(&dyn_fsync_lock);
+	dyn_fsync_stats.calls++;
+	if (ret)
+		dyn_fsync_stats.errors++;
+	dyn_fsync_stats.latency_ns += delta;
+	if (delta > dyn_fsync_stats.max_latency_ns)
+		dyn_fsync_stats.max_latency_ns = delta;
+	spin_unlock(&dyn_fsync_lock);
+
+	return ret;
+}
+
 static ssize_t dyn_fsync_active_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
 {
 	return sprintf(buf, "%u\n", (dyn_fsync_active ? 1 : 0));
@@ -58,6 +275,75 @@ static ssize_t dyn_fsync_active_store(struct kobject *kobj, struct kobj_attribut
 	return count;
 }
 
+static ssize_t dyn_fsync_batch_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", (dyn_fsync_batch ? 1 : 0));
+}
+
+static ssize_t dyn_fsync_batch_store(struct kobject *kobj, struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int data;
+
+	if(sscanf(buf, "%u\n", &data) == 1) {
+		if (data == 1) {
+			pr_info("%s: batched fsync enabled\n", __FUNCTION__);
+			dyn_fsync_batch = true;
+		}
+		else if (data == 0) {
+			pr_info("%s: batched fsync disabled\n", __FUNCTION__);
+			dyn_fsync_batch = false;
+		}
+		else
+			pr_info("%s: bad value: %u\n", __FUNCTION__, data);
+	} else
+		pr_info("%s: unknown input!\n", __FUNCTION__);
+
+	return count;
+}
+
+static ssize_t dyn_fsync_batch_window_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", dyn_fsync_batch_window_us);
+}
+
+static ssize_t dyn_fsync_batch_window_store(struct kobject *kobj, struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int data;
+
+	if (sscanf(buf, "%u\n", &data) == 1 && data <= 100000)
+		dyn_fsync_batch_window_us = data;
+	else
+		pr_info("%s: bad value!\n", __FUNCTION__);
+
+	return count;
+}
+
+static ssize_t dyn_fsync_batch_stats_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+	u64 calls, batches, errors, latency, max_latency;
+	unsigned int max_batch;
+
+	spin_lock(&dyn_fsync_lock);
+	calls = dyn_fsync_stats.calls;
+	batches = dyn_fsync_stats.batches;
+	errors = dyn_fsync_stats.errors;
+	latency = dyn_fsync_stats.latency_ns;
+	max_latency = dyn_fsync_stats.max_latency_ns;
+	max_batch = dyn_fsync_stats.max_batch;
+	spin_unlock(&dyn_fsync_lock);
+
+	if (calls)
+		do_div(latency, calls);
+	do_div(latency, NSEC_PER_USEC);
+	do_div(max_latency, NSEC_PER_USEC);
+
+	return sprintf(buf, "calls: %llu\nbatches: %llu\ncoalesced: %llu\n"
+		       "max batch: %u\nerrors: %llu\n"
+		       "avg latency us: %llu\nmax latency us: %llu\n",
+		       calls, batches, calls - batches, max_batch, errors,
+		       latency, max_latency);
+}
+
 static ssize_t dyn_fsync_version_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
 {
 	return sprintf(buf, "version: %u\n", DYN_FSYNC_VERSION);
@@ -77,11 +363,23 @@ static struct kobj_attribute dyn_fsync_version_attribute =
 static struct kobj_attribute dyn_fsync_earlysuspend_attribute = 
 	__ATTR(Dyn_fsync_earlysuspend, 0444 , dyn_fsync_earlysuspend_show, NULL);
 
+static struct kobj_attribute dyn_fsync_batch_attribute =
+	__ATTR(Dyn_fsync_batch, 0644, dyn_fsync_batch_show, dyn_fsync_batch_store);
+
+static struct kobj_attribute dyn_fsync_batch_window_attribute =
+	__ATTR(Dyn_fsync_batch_window_us, 0644, dyn_fsync_batch_window_show, dyn_fsync_batch_window_store);
+
+static struct kobj_attribute dyn_fsync_batch_stats_attribute =
+	__ATTR(Dyn_fsync_batch_stats, 0444, dyn_fsync_batch_stats_show, NULL);
+
 static struct attribute *dyn_fsync_active_attrs[] =
 	{
 		&dyn_fsync_active_attribute.attr,
 		&dyn_fsync_version_attribute.attr,
 		&dyn_fsync_earlysuspend_attribute.attr,
+		&dyn_fsync_batch_attribute.attr,
+		&dyn_fsync_batch_window_attribute.attr,
+		&dyn_fsync_batch_stats_attribute.attr,
 		NULL,
 	};
 
@@ -19,6 +19,9 @@
 
 #ifdef CONFIG_DYNAMIC_FSYNC
 extern bool early_suspend_active;
+extern bool dyn_fsync_batch;
+extern int dyn_fsync_batched(struct file *file, loff_t start, loff_t end,
+			     int datasync);
 #endif
 
 #define VALID_FLAGS (SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE| \
@@ -169,6 +172,8 @@ SYSCALL_DEFINE1(syncfs, int, fd)
 int vfs_fsync_range(struct file *file, loff_t start, loff_t end, int datasync)
 {
 #ifdef CONFIG_DYNAMIC_FSYNC
+	if (dyn_fsync_batch)
+		return dyn_fsync_batched(file, start, end, datasync);
 	if (!early_suspend_active)
 		return 0;
 	else {
@@ -213,7 +218,7 @@ static int do_fsync(unsigned int fd, int datasync)
 SYSCALL_DEFINE1(fsync, unsigned int, fd)
 {
 #ifdef CONFIG_DYNAMIC_FSYNC
-	if (!early_suspend_active)
+	if (!early_suspend_active && !dyn_fsync_batch)
 		return 0;
 	else
 #endif
@@ -223,7 +228,7 @@ SYSCALL_DEFINE1(fsync, unsigned int, fd)
 SYSCALL_DEFINE1(fdatasync, unsigned int, fd)
 {
 #ifdef CONFIG_DYNAMIC_FSYNC
-	if (!early_suspend_active)
+	if (!early_suspend_active && !dyn_fsync_batch)
 		return 0;
 	else
 #endif
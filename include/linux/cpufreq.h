@@ -420,4 +420,16 @@ void cpufreq_frequency_table_get_attr(struct cpufreq_frequency_table *table,
 void cpufreq_frequency_table_put_attr(unsigned int cpu);
 
 
+/*********************************************************************
+ *                         STATISTICS                                *
+ *********************************************************************/
+
+#if defined(CONFIG_CPU_FREQ_STAT) || defined(CONFIG_CPU_FREQ_STAT_MODULE)
+void cpufreq_stats_boost(unsigned int cpu, bool on);
+void cpufreq_stats_decision(unsigned int cpu, bool start);
+#else
+static inline void cpufreq_stats_boost(unsigned int cpu, bool on) { }
+static inline void cpufreq_stats_decision(unsigned int cpu, bool start) { }
+#endif
+
 #endif /* _LINUX_CPUFREQ_H */
@@ -0,0 +1,50 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Kernel Interface
+ *
+ *  Copyright (C) 2011-2012, Yann Collet.
+ *  BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ *  The LZ4 format is documented at:
+ *  http://code.google.com/p/lz4/
+ */
+
+#define LZ4_MEM_COMPRESS	(4096 * sizeof(u32))
+#define LZ4_MAX_INPUT_SIZE	0x7E000000
+
+/*
+ * lz4_compressbound()
+ * Provides the maximum size that LZ4 may output in a "worst case" scenario
+ * (input data not compressible)
+ */
+static inline size_t lz4_compressbound(size_t isize)
+{
+	return isize + (isize / 255) + 16;
+}
+
+/*
+ * lz4_compress()
+ *	src	: source address of the original data
+ *	src_len	: size of the original data
+ *	dst	: output buffer address of the compressed data,
+ *		  must be at least lz4_compressbound(src_len) bytes
+ *	dst_len	: set to the size of the compressed data on return
+ *	wrkmem	: address of the working memory, LZ4_MEM_COMPRESS bytes
+ *	return	: 0 on success, < 0 on error
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * lz4_decompress_unknownoutputsize()
+ *	src	: source address of the compressed data
+ *	src_len	: size of the compressed data
+ *	dest	: output buffer address of the decompressed data
+ *	dest_len: in: size of dest, out: size of the decompressed data
+ *	return	: 0 on success, < 0 on malformed input or short dest
+ */
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len);
+
+#endif
@@ -242,12 +242,14 @@ enum mmc_packed_stop_reasons {
 	EMPTY_QUEUE,
 	REL_WRITE,
 	THRESHOLD,
+	URGENT_READ,
 	MAX_REASONS,
 };
 
 struct mmc_wr_pack_stats {
 	u32 *packing_events;
 	u32 pack_stop_reason[MAX_REASONS];
+	u32 urgent_read_requeued;	/* writes put back for a read */
 	spinlock_t lock;
 	bool enabled;
 	bool print_in_read;
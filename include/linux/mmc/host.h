@@ -165,6 +165,25 @@ struct mmc_hotplug {
 	void *handler_priv;
 };
 
+/* stages of a data request, timed with CONFIG_MMC_PERF_PROFILING */
+enum mmc_perf_stages {
+	MMC_PERF_PREP = 0,	/* map the block request, bounce copy */
+	MMC_PERF_PRE_REQ,	/* host DMA mapping and cache maintenance */
+	MMC_PERF_GAP,		/* controller idle between two requests */
+	MMC_PERF_XFER,		/* request on the controller */
+	MMC_PERF_WAIT,		/* queue thread blocked on the controller */
+	MMC_PERF_ERR_CHECK,	/* status check of the completed request */
+	MMC_PERF_POST_REQ,	/* host DMA unmapping */
+	MMC_PERF_COMPLETE,	/* ending the block requests */
+	MMC_PERF_NR_STAGES,
+};
+
+struct mmc_perf_stage {
+	unsigned long	count;
+	u64		total_ns;
+	u64		max_ns;
+};
+
 struct mmc_host {
 	struct device		*parent;
 	struct device		class_dev;
@@ -365,6 +384,8 @@ struct mmc_host {
 		ktime_t rtime_drv;	   /* Rd time  MMC Host  */
 		ktime_t wtime_drv;	   /* Wr time  MMC Host  */
 		ktime_t start;
+		ktime_t last_done;	   /* end of the last data request */
+		struct mmc_perf_stage stage[MMC_PERF_NR_STAGES];
 	} perf;
 	bool perf_enable;
 #endif
@@ -391,6 +412,26 @@ static inline void *mmc_priv(struct mmc_host *host)
 	return (void *)host->private;
 }
 
+#ifdef CONFIG_MMC_PERF_PROFILING
+extern void mmc_perf_account(struct mmc_host *host,
+			     enum mmc_perf_stages stage, ktime_t start);
+
+static inline ktime_t mmc_perf_now(struct mmc_host *host)
+{
+	return host->perf_enable ? ktime_get() : ktime_set(0, 0);
+}
+#else
+static inline void mmc_perf_account(struct mmc_host *host,
+				    enum mmc_perf_stages stage, ktime_t start)
+{
+}
+
+static inline ktime_t mmc_perf_now(struct mmc_host *host)
+{
+	return ktime_set(0, 0);
+}
+#endif
+
 #define mmc_host_is_spi(host)	((host)->caps & MMC_CAP_SPI)
 
 #define mmc_dev(x)	((x)->parent)
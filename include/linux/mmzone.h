@@ -412,6 +412,10 @@ struct zone {
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	unsigned long		flags;		   /* zone flags, see below */
 
+	/* reclaim efficiency window, see mm/vmpressure.c */
+	unsigned long		vmpressure_scanned;
+	unsigned long		vmpressure_reclaimed;
+
 	/* Zone statistics */
 	atomic_long_t		vm_stat[NR_VM_ZONE_STAT_ITEMS];
 
@@ -67,6 +67,24 @@ static inline void oom_killer_enable(void)
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_adj_tree_add(struct task_struct *task);
+extern void lowmem_adj_tree_del(struct task_struct *task);
+extern void lowmem_adj_tree_update(struct task_struct *task);
+#else
+static inline void lowmem_adj_tree_add(struct task_struct *task)
+{
+}
+
+static inline void lowmem_adj_tree_del(struct task_struct *task)
+{
+}
+
+static inline void lowmem_adj_tree_update(struct task_struct *task)
+{
+}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
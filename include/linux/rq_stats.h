@@ -10,6 +10,12 @@
  * GNU General Public License for more details.
  *
  */
+#ifndef _LINUX_RQ_STATS_H
+#define _LINUX_RQ_STATS_H
+
+#include <linux/errno.h>
+#include <linux/threads.h>
+#include <linux/types.h>
 
 struct rq_data {
 	unsigned int rq_avg;
@@ -29,3 +35,41 @@ struct rq_data {
 extern spinlock_t rq_lock;
 extern struct rq_data rq_info;
 extern struct workqueue_struct *rq_wq;
+
+/*
+ * Load history. Every tick, the per-cpu run-queue length and number of
+ * tasks in iowait are folded into exponentially weighted moving averages
+ * with the time constants below, and the result is appended to a ring of
+ * RQ_HIST_SIZE entries. Values are FSHIFT fixed point.
+ */
+#define RQ_EWMA_NR		3
+#define RQ_EWMA_SHIFTS		{ 2, 4, 6 }	/* ~4, 16 and 64 ticks */
+#define RQ_HIST_SIZE		64
+
+struct rq_hist_cpu {
+	u32 nr_run[RQ_EWMA_NR];
+	u32 iowait[RQ_EWMA_NR];
+};
+
+struct rq_hist_entry {
+	u32 seq;		/* private */
+	u32 jiffies;		/* low 32 bits of jiffies at the sample */
+	struct rq_hist_cpu cpu[NR_CPUS];
+};
+
+#ifdef CONFIG_MSM_RUN_QUEUE_STATS
+extern void rq_stats_update_history(void);
+extern int rq_stats_history(struct rq_hist_entry *buf, int n);
+extern int rq_stats_load(int cpu, struct rq_hist_cpu *load);
+#else
+static inline int rq_stats_history(struct rq_hist_entry *buf, int n)
+{
+	return 0;
+}
+static inline int rq_stats_load(int cpu, struct rq_hist_cpu *load)
+{
+	return -ENODEV;
+}
+#endif
+
+#endif /* _LINUX_RQ_STATS_H */
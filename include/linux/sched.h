@@ -140,7 +140,11 @@ extern unsigned long nr_running(void);
 extern unsigned long nr_uninterruptible(void);
 extern unsigned long nr_iowait(void);
 extern unsigned long avg_nr_running(void);
+#ifdef CONFIG_MSM_HOTPLUG
+extern void msm_hotplug_rq_spike(void);
+#endif
 extern unsigned long nr_iowait_cpu(int cpu);
+extern unsigned long nr_running_cpu(int cpu);
 extern unsigned long this_cpu_load(void);
 
 
@@ -665,6 +669,9 @@ struct signal_struct {
 	int oom_score_adj;	/* OOM kill score adjustment */
 	int oom_score_adj_min;	/* OOM kill score adjustment minimum value.
 				 * Only settable by CAP_SYS_RESOURCE. */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct rb_node adj_node;	/* lowmemorykiller victim tree */
+#endif
 
 	struct mutex cred_guard_mutex;	/* guard against foreign influences on
 					 * credential calculations
@@ -0,0 +1,31 @@
+#ifndef __LINUX_VMPRESSURE_H
+#define __LINUX_VMPRESSURE_H
+
+#include <linux/gfp.h>
+#include <linux/notifier.h>
+
+struct zone;
+
+/*
+ * How hard page reclaim has to work, from the ratio of pages reclaimed to
+ * pages scanned over a window of reclaim activity.
+ */
+enum vmpressure_levels {
+	VMPRESSURE_LOW = 0,
+	VMPRESSURE_MEDIUM,
+	VMPRESSURE_CRITICAL,
+	VMPRESSURE_NUM_LEVELS,
+};
+
+extern void vmpressure(struct zone *zone, gfp_t gfp, unsigned long scanned,
+		       unsigned long reclaimed);
+extern void vmpressure_prio(gfp_t gfp, int prio);
+
+/*
+ * Notifiers are called from process context with the new level as the
+ * action and a pointer to the pressure percentage (unsigned long) as data.
+ */
+extern int vmpressure_register_notifier(struct notifier_block *nb);
+extern int vmpressure_unregister_notifier(struct notifier_block *nb);
+
+#endif /* __LINUX_VMPRESSURE_H */
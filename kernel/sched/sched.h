@@ -950,6 +950,12 @@ static inline void inc_nr_running(struct rq *rq)
 	rq->nr_last_stamp = rq->clock_task;
 	rq->nr_running++;
 	write_seqcount_end(&rq->ave_seqcnt);
+
+#ifdef CONFIG_MSM_HOTPLUG
+	/* a task is now waiting behind another one on this cpu */
+	if (rq->nr_running > 1)
+		msm_hotplug_rq_spike();
+#endif
 }
 
 static inline void dec_nr_running(struct rq *rq)
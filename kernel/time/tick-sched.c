@@ -868,6 +868,13 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 			 */
 			update_rq_stats();
 
+#ifdef CONFIG_MSM_RUN_QUEUE_STATS
+			/*
+			 * fold this tick into the load history
+			 */
+			rq_stats_update_history();
+#endif
+
 			/*
 			 * wakeup user if needed
 			 */
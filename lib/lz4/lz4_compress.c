@@ -0,0 +1,139 @@
+/*
+ *  LZ4 - Fast LZ compression algorithm
+ *
+ *  Copyright (C) 2011-2012, Yann Collet.
+ *  BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ *  The LZ4 format is documented at:
+ *  http://code.google.com/p/lz4/
+ *
+ *  Single-pass block compressor for Linux kernel use.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)len;
+
+	return op;
+}
+
+static unsigned char *lz4_put_literals(unsigned char *op,
+				       const unsigned char *anchor,
+				       size_t lit_len, unsigned char **token)
+{
+	*token = op++;
+	if (lit_len >= RUN_MASK) {
+		**token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, lit_len - RUN_MASK);
+	} else {
+		**token = lit_len << ML_BITS;
+	}
+
+	memcpy(op, anchor, lit_len);
+	return op + lit_len;
+}
+
+/*
+ * Compress src_len bytes from src into dst. dst must be at least
+ * lz4_compressbound(src_len) bytes long. wrkmem must be
+ * LZ4_MEM_COMPRESS bytes.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *hash_table = wrkmem;
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst;
+	unsigned char *token;
+
+	if (src_len > LZ4_MAX_INPUT_SIZE)
+		return -1;
+
+	memset(hash_table, 0, LZ4_MEM_COMPRESS);
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	hash_table[lz4_hash(LZ4_READ32(ip))] = 0;
+	ip++;
+
+	for (;;) {
+		const unsigned char *ref;
+		const unsigned char *match_start;
+		size_t len;
+		u32 h;
+
+		/* Find a match */
+		for (;;) {
+			if (ip > mflimit)
+				goto last_literals;
+
+			h = lz4_hash(LZ4_READ32(ip));
+			ref = src + hash_table[h];
+			hash_table[h] = ip - src;
+
+			if (ref < ip && ip - ref <= MAX_DISTANCE &&
+			    LZ4_READ32(ref) == LZ4_READ32(ip))
+				break;
+			ip++;
+		}
+
+		/* Extend the match backwards over pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		op = lz4_put_literals(op, anchor, ip - anchor, &token);
+
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		/* Extend the match forwards */
+		match_start = ip;
+		ip += MINMATCH;
+		ref += MINMATCH;
+		while (ip < matchlimit && *ip == *ref) {
+			ip++;
+			ref++;
+		}
+
+		len = ip - match_start - MINMATCH;
+		if (len >= ML_MASK) {
+			*token += ML_MASK;
+			op = lz4_put_length(op, len - ML_MASK);
+		} else {
+			*token += len;
+		}
+
+		anchor = ip;
+		if (ip > mflimit)
+			break;
+
+		/* Prime the table with a position inside the match */
+		hash_table[lz4_hash(LZ4_READ32(ip - 2))] = ip - 2 - src;
+	}
+
+last_literals:
+	op = lz4_put_literals(op, anchor, iend - anchor, &token);
+	*dst_len = op - dst;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("LZ4 compressor");
@@ -0,0 +1,44 @@
+/*
+ *  lz4defs.h -- LZ4 block format constants and helpers
+ *
+ *  Copyright (C) 2011-2012, Yann Collet.
+ *  BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ *  The LZ4 format is documented at:
+ *  http://code.google.com/p/lz4/
+ */
+
+/*
+ * A compressed block is a series of sequences. Each sequence starts
+ * with a token byte: the high nibble is the literal run length, the
+ * low nibble the match length minus MINMATCH. A nibble of 15 means
+ * more length bytes follow (each adding up to 255). The literals come
+ * next, then a 2 byte little-endian match offset. The last sequence
+ * carries literals only.
+ */
+#define MINMATCH	4
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define MAX_DISTANCE	((1 << 16) - 1)
+
+/*
+ * The last LASTLITERALS bytes of a block are always literals and the
+ * last match must start at least MFLIMIT bytes before the end.
+ */
+#define LASTLITERALS	5
+#define MFLIMIT		(8 + MINMATCH)
+
+/* Hash table used by the compressor, stored in the caller's wrkmem */
+#define LZ4_HASHLOG	12
+#define LZ4_HASHSIZE	(1 << LZ4_HASHLOG)
+
+#define LZ4_READ32(p)	get_unaligned((const u32 *)(p))
+
+static inline u32 lz4_hash(u32 sequence)
+{
+	return (sequence * 2654435761U) >> (32 - LZ4_HASHLOG);
+}
@@ -0,0 +1,362 @@
+/*
+ * linux/mm/vmpressure.c
+ *
+ * Memory pressure levels derived from the efficiency of page reclaim.
+ *
+ * Global reclaim accounts the pages it scans and reclaims in each zone.
+ * Once a zone has scanned vmpressure_win pages, the share of them that
+ * could not be reclaimed is the pressure for that window: a hot page cache
+ * reclaims easily and reads as low pressure however little memory is free,
+ * while thrashing reclaims next to nothing. Falling to a low reclaim
+ * priority is reported as critical straight away.
+ *
+ * The level is passed to in-kernel notifiers and to userspace. A process
+ * subscribes by writing "<eventfd> <low|medium|critical>" to
+ * /sys/kernel/mm/vmpressure/event_control; the eventfd is signalled every
+ * time a window ends at or above that level and the subscription goes away
+ * when the eventfd is closed. /sys/kernel/mm/vmpressure/level shows the last
+ * level and pressure.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/eventfd.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/workqueue.h>
+#include <linux/vmpressure.h>
+
+/* pages a zone has to scan before its reclaim efficiency is evaluated */
+static const unsigned long vmpressure_win = SWAP_CLUSTER_MAX * 16;
+
+/* percentage of scanned pages not reclaimed at which each level starts */
+static const unsigned int vmpressure_level_med = 60;
+static const unsigned int vmpressure_level_critical = 95;
+
+/* reclaim priority at or below which memory is considered exhausted */
+static const int vmpressure_level_critical_prio = ilog2(100 / 10);
+
+static const char * const vmpressure_str_levels[] = {
+	[VMPRESSURE_LOW] = "low",
+	[VMPRESSURE_MEDIUM] = "medium",
+	[VMPRESSURE_CRITICAL] = "critical",
+};
+
+/* protects the zone windows and the pending report */
+static DEFINE_SPINLOCK(vmpressure_lock);
+static bool vmpressure_pending;
+static enum vmpressure_levels vmpressure_pending_level;
+static unsigned long vmpressure_pending_pressure;
+
+static enum vmpressure_levels vmpressure_last_level;
+static unsigned long vmpressure_last_pressure;
+
+static BLOCKING_NOTIFIER_HEAD(vmpressure_notifier);
+
+struct vmpressure_event {
+	struct eventfd_ctx *efd;
+	enum vmpressure_levels level;
+	struct list_head node;
+	/* needed to drop the event when the eventfd is closed */
+	poll_table pt;
+	wait_queue_head_t *wqh;
+	wait_queue_t wait;
+	struct work_struct remove;
+};
+
+static LIST_HEAD(vmpressure_events);
+static DEFINE_MUTEX(vmpressure_events_lock);
+
+static enum vmpressure_levels vmpressure_level(unsigned long pressure)
+{
+	if (pressure >= vmpressure_level_critical)
+		return VMPRESSURE_CRITICAL;
+	else if (pressure >= vmpressure_level_med)
+		return VMPRESSURE_MEDIUM;
+	return VMPRESSURE_LOW;
+}
+
+static unsigned long vmpressure_calc_pressure(unsigned long scanned,
+					      unsigned long reclaimed)
+{
+	/* slab and huge pages can make reclaimed exceed scanned */
+	if (reclaimed >= scanned)
+		return 0;
+	return (scanned - reclaimed) * 100 / scanned;
+}
+
+static void vmpressure_work_fn(struct work_struct *work)
+{
+	struct vmpressure_event *ev;
+	enum vmpressure_levels level;
+	unsigned long pressure;
+
+	spin_lock(&vmpressure_lock);
+	if (!vmpressure_pending) {
+		spin_unlock(&vmpressure_lock);
+		return;
+	}
+	level = vmpressure_pending_level;
+	pressure = vmpressure_pending_pressure;
+	vmpressure_pending = false;
+	spin_unlock(&vmpressure_lock);
+
+	vmpressure_last_level = level;
+	vmpressure_last_pressure = pressure;
+
+	blocking_notifier_call_chain(&vmpressure_notifier, level, &pressure);
+
+	mutex_lock(&vmpressure_events_lock);
+	list_for_each_entry(ev, &vmpressure_events, node) {
+		if (level >= ev->level)
+			eventfd_signal(ev->efd, 1);
+	}
+	mutex_unlock(&vmpressure_events_lock);
+}
+
+static DECLARE_WORK(vmpressure_work, vmpressure_work_fn);
+
+/*
+ * Queue a report; several windows ending before the work runs are
+ * reported once, at the worst level seen. Called with vmpressure_lock held.
+ */
+static void vmpressure_report(enum vmpressure_levels level,
+			      unsigned long pressure)
+{
+	if (!vmpressure_pending || level > vmpressure_pending_level) {
+		vmpressure_pending_level = level;
+		vmpressure_pending_pressure = pressure;
+	}
+	vmpressure_pending = true;
+}
+
+static bool vmpressure_gfp(gfp_t gfp)
+{
+	/*
+	 * Allocations that cannot touch highmem, movable pages, or do any
+	 * IO only scan a small part of memory and say nothing about overall
+	 * pressure.
+	 */
+	return gfp & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS);
+}
+
+/**
+ * vmpressure() - account reclaim efficiency for a zone
+ * @zone:	zone that was reclaimed from
+ * @gfp:	reclaimer's gfp mask
+ * @scanned:	number of pages scanned
+ * @reclaimed:	number of pages reclaimed
+ *
+ * Called from global reclaim after each pass over a zone. Notification
+ * happens from a workqueue, so this is cheap and does not sleep.
+ */
+void vmpressure(struct zone *zone, gfp_t gfp, unsigned long scanned,
+		unsigned long reclaimed)
+{
+	unsigned long pressure;
+
+	if (!vmpressure_gfp(gfp) || !scanned)
+		return;
+
+	spin_lock(&vmpressure_lock);
+	zone->vmpressure_scanned += scanned;
+	zone->vmpressure_reclaimed += reclaimed;
+	scanned = zone->vmpressure_scanned;
+	reclaimed = zone->vmpressure_reclaimed;
+	if (scanned < vmpressure_win) {
+		spin_unlock(&vmpressure_lock);
+		return;
+	}
+	zone->vmpressure_scanned = 0;
+	zone->vmpressure_reclaimed = 0;
+
+	pressure = vmpressure_calc_pressure(scanned, reclaimed);
+	vmpressure_report(vmpressure_level(pressure), pressure);
+	spin_unlock(&vmpressure_lock);
+
+	schedule_work(&vmpressure_work);
+}
+
+/**
+ * vmpressure_prio() - account reclaim priority
+ * @gfp:	reclaimer's gfp mask
+ * @prio:	reclaim priority about to be scanned at
+ *
+ * Reclaim that keeps raising its scan priority without meeting its target
+ * is about to fail, whatever the efficiency of the last window was.
+ */
+void vmpressure_prio(gfp_t gfp, int prio)
+{
+	if (prio > vmpressure_level_critical_prio || !vmpressure_gfp(gfp))
+		return;
+
+	spin_lock(&vmpressure_lock);
+	vmpressure_report(VMPRESSURE_CRITICAL, 100);
+	spin_unlock(&vmpressure_lock);
+
+	schedule_work(&vmpressure_work);
+}
+
+int vmpressure_register_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_register_notifier);
+
+int vmpressure_unregister_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_unregister_notifier);
+
+static void vmpressure_event_remove(struct work_struct *work)
+{
+	struct vmpressure_event *ev = container_of(work,
+			struct vmpressure_event, remove);
+
+	mutex_lock(&vmpressure_events_lock);
+	list_del(&ev->node);
+	mutex_unlock(&vmpressure_events_lock);
+
+	eventfd_ctx_put(ev->efd);
+	kfree(ev);
+}
+
+/*
+ * Gets called on POLLHUP on eventfd when user closes it.
+ *
+ * Called with wqh->lock held and interrupts disabled.
+ */
+static int vmpressure_event_wake(wait_queue_t *wait, unsigned mode,
+				 int sync, void *key)
+{
+	struct vmpressure_event *ev = container_of(wait,
+			struct vmpressure_event, wait);
+	unsigned long flags = (unsigned long)key;
+
+	if (flags & POLLHUP) {
+		__remove_wait_queue(ev->wqh, &ev->wait);
+		schedule_work(&ev->remove);
+	}
+
+	return 0;
+}
+
+static void vmpressure_event_ptable_queue_proc(struct file *file,
+		wait_queue_head_t *wqh, poll_table *pt)
+{
+	struct vmpressure_event *ev = container_of(pt,
+			struct vmpressure_event, pt);
+
+	ev->wqh = wqh;
+	add_wait_queue(wqh, &ev->wait);
+}
+
+static ssize_t level_show(struct kobject *kobj, struct kobj_attribute *attr,
+			  char *buf)
+{
+	return sprintf(buf, "%s %lu\n",
+		       vmpressure_str_levels[vmpressure_last_level],
+		       vmpressure_last_pressure);
+}
+
+/*
+ * Input must be in format '<event_fd> <level>', level being one of
+ * vmpressure_str_levels.
+ */
+static ssize_t event_control_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct vmpressure_event *ev;
+	struct file *efile;
+	unsigned int efd;
+	int level;
+	char *endp;
+	int ret;
+
+	efd = simple_strtoul(buf, &endp, 10);
+	if (*endp != ' ')
+		return -EINVAL;
+	endp++;
+
+	for (level = 0; level < VMPRESSURE_NUM_LEVELS; level++) {
+		if (sysfs_streq(endp, vmpressure_str_levels[level]))
+			break;
+	}
+	if (level == VMPRESSURE_NUM_LEVELS)
+		return -EINVAL;
+
+	ev = kzalloc(sizeof(*ev), GFP_KERNEL);
+	if (!ev)
+		return -ENOMEM;
+	ev->level = level;
+	INIT_LIST_HEAD(&ev->node);
+	init_poll_funcptr(&ev->pt, vmpressure_event_ptable_queue_proc);
+	init_waitqueue_func_entry(&ev->wait, vmpressure_event_wake);
+	INIT_WORK(&ev->remove, vmpressure_event_remove);
+
+	efile = eventfd_fget(efd);
+	if (IS_ERR(efile)) {
+		ret = PTR_ERR(efile);
+		goto fail;
+	}
+
+	ev->efd = eventfd_ctx_fileget(efile);
+	if (IS_ERR(ev->efd)) {
+		ret = PTR_ERR(ev->efd);
+		goto fail_fput;
+	}
+
+	/* a close racing with us must not run the removal before list_add */
+	mutex_lock(&vmpressure_events_lock);
+	if (efile->f_op->poll(efile, &ev->pt) & POLLHUP) {
+		mutex_unlock(&vmpressure_events_lock);
+		remove_wait_queue(ev->wqh, &ev->wait);
+		eventfd_ctx_put(ev->efd);
+		ret = -EBADF;
+		goto fail_fput;
+	}
+	list_add(&ev->node, &vmpressure_events);
+	mutex_unlock(&vmpressure_events_lock);
+
+	fput(efile);
+	return count;
+
+fail_fput:
+	fput(efile);
+fail:
+	kfree(ev);
+	return ret;
+}
+
+static struct kobj_attribute level_attr = __ATTR_RO(level);
+static struct kobj_attribute event_control_attr =
+	__ATTR(event_control, 0200, NULL, event_control_store);
+
+static struct attribute *vmpressure_attrs[] = {
+	&level_attr.attr,
+	&event_control_attr.attr,
+	NULL,
+};
+
+static struct attribute_group vmpressure_attr_group = {
+	.attrs = vmpressure_attrs,
+	.name = "vmpressure",
+};
+
+static int __init vmpressure_init(void)
+{
+	int err;
+
+	err = sysfs_create_group(mm_kobj, &vmpressure_attr_group);
+	if (err)
+		printk(KERN_ERR "vmpressure: register sysfs failed\n");
+	return err;
+}
+module_init(vmpressure_init);
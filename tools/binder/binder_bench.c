@@ -0,0 +1,574 @@
+/*
+ * binder_bench: binder transaction throughput and latency under contention
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * A server process publishes a binder object with the servicemanager and
+ * answers every transaction from a pool of looper threads with an empty
+ * reply. The client looks the object up and then, for 1, 2, 4, ... up to
+ * -t threads, has every thread send -n synchronous transactions of -s
+ * bytes to it as fast as it can. For each thread count the aggregate
+ * transaction rate and the round trip latency percentiles are printed.
+ *
+ * Needs a running servicemanager and must be run as root (or system) so
+ * that it may register a service.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define MAP_SIZE	(128 * 1024)
+#define SVC_MGR_NAME	"android.os.IServiceManager"
+#define SVC_NAME	"binder_bench"
+#define SVC_MGR_CHECK	2
+#define SVC_MGR_ADD	3
+#define BENCH_CODE	1
+#define WARMUP		100
+
+static unsigned int max_threads = 8;
+static unsigned int iterations = 10000;
+static unsigned int payload = 16;
+
+static int binder_fd;
+
+struct parcel {
+	uint8_t data[512];
+	size_t len;
+	size_t offs[4];
+	unsigned int noffs;
+};
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *parcel_alloc(struct parcel *p, size_t size)
+{
+	void *ptr;
+
+	size = (size + 3) & ~3;
+	if (p->len + size > sizeof(p->data)) {
+		fprintf(stderr, "parcel overflow\n");
+		exit(1);
+	}
+	ptr = p->data + p->len;
+	memset(ptr, 0, size);
+	p->len += size;
+	return ptr;
+}
+
+static void parcel_put_u32(struct parcel *p, uint32_t v)
+{
+	*(uint32_t *)parcel_alloc(p, sizeof(v)) = v;
+}
+
+static void parcel_put_string16(struct parcel *p, const char *s)
+{
+	size_t i, n = strlen(s);
+	uint16_t *d;
+
+	parcel_put_u32(p, n);
+	d = parcel_alloc(p, (n + 1) * sizeof(uint16_t));
+	for (i = 0; i < n; i++)
+		d[i] = s[i];
+}
+
+static void parcel_put_binder(struct parcel *p, void *binder)
+{
+	struct flat_binder_object *obj;
+
+	p->offs[p->noffs++] = p->len;
+	obj = parcel_alloc(p, sizeof(*obj));
+	obj->type = BINDER_TYPE_BINDER;
+	obj->flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+	obj->binder = binder;
+	obj->cookie = NULL;
+}
+
+static int binder_open_dev(void)
+{
+	struct binder_version vers;
+	void *map;
+	int fd;
+
+	fd = open("/dev/binder", O_RDWR);
+	if (fd < 0)
+		die("/dev/binder");
+	if (ioctl(fd, BINDER_VERSION, &vers) < 0)
+		die("BINDER_VERSION");
+	if (vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol %d, built for %d\n",
+			(int)vers.protocol_version,
+			BINDER_CURRENT_PROTOCOL_VERSION);
+		exit(1);
+	}
+	map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		die("mmap");
+	return fd;
+}
+
+static int binder_write_read(void *wbuf, size_t wsize,
+			     void *rbuf, size_t rsize, size_t *rconsumed)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.write_size = wsize;
+	bwr.write_consumed = 0;
+	bwr.read_buffer = (unsigned long)rbuf;
+	bwr.read_size = rsize;
+	bwr.read_consumed = 0;
+	do {
+		ret = ioctl(binder_fd, BINDER_WRITE_READ, &bwr);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+	if (rconsumed)
+		*rconsumed = bwr.read_consumed;
+	return 0;
+}
+
+/*
+ * Handles a reference count command from the driver. Returns the number of
+ * bytes consumed after the command or -1 if cmd is not one of them.
+ */
+static int handle_ref_cmd(uint32_t cmd, void **ptrs)
+{
+	struct {
+		uint32_t cmd;
+		void *ptr;
+		void *cookie;
+	} __attribute__((packed)) done;
+
+	switch (cmd) {
+	case BR_INCREFS:
+	case BR_ACQUIRE:
+		done.cmd = cmd == BR_INCREFS ? BC_INCREFS_DONE : BC_ACQUIRE_DONE;
+		done.ptr = ptrs[0];
+		done.cookie = ptrs[1];
+		if (binder_write_read(&done, sizeof(done), NULL, 0, NULL))
+			die("BC_*_DONE");
+		return 2 * sizeof(void *);
+	case BR_RELEASE:
+	case BR_DECREFS:
+		return 2 * sizeof(void *);
+	}
+	return -1;
+}
+
+/*
+ * Sends a transaction and waits for its reply. A buffer from the previous
+ * reply passed in *free_buf is released in the same ioctl; on return
+ * *free_buf is the new reply buffer, described by *reply.
+ */
+static int transact(uint32_t handle, uint32_t code,
+		    const void *data, size_t len,
+		    const size_t *offs, unsigned int noffs,
+		    void **free_buf, struct binder_transaction_data *reply)
+{
+	uint8_t wbuf[sizeof(uint32_t) * 2 + sizeof(void *) +
+		     sizeof(struct binder_transaction_data)];
+	uint32_t rbuf[64];
+	struct binder_transaction_data tr;
+	size_t wlen = 0, rlen;
+	uint32_t cmd;
+
+	if (*free_buf) {
+		cmd = BC_FREE_BUFFER;
+		memcpy(wbuf, &cmd, sizeof(cmd));
+		memcpy(wbuf + sizeof(cmd), free_buf, sizeof(void *));
+		wlen = sizeof(cmd) + sizeof(void *);
+		*free_buf = NULL;
+	}
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.data_size = len;
+	tr.offsets_size = noffs * sizeof(size_t);
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offs;
+	cmd = BC_TRANSACTION;
+	memcpy(wbuf + wlen, &cmd, sizeof(cmd));
+	memcpy(wbuf + wlen + sizeof(cmd), &tr, sizeof(tr));
+	wlen += sizeof(cmd) + sizeof(tr);
+
+	for (;;) {
+		uint8_t *p, *end;
+
+		if (binder_write_read(wbuf, wlen, rbuf, sizeof(rbuf), &rlen))
+			return -1;
+		wlen = 0;
+		p = (uint8_t *)rbuf;
+		end = p + rlen;
+		while (p < end) {
+			int n;
+
+			memcpy(&cmd, p, sizeof(cmd));
+			p += sizeof(cmd);
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_TRANSACTION_COMPLETE:
+			case BR_SPAWN_LOOPER:
+				break;
+			case BR_REPLY:
+				memcpy(reply, p, sizeof(*reply));
+				*free_buf = (void *)reply->data.ptr.buffer;
+				return 0;
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+				errno = EPIPE;
+				return -1;
+			default:
+				n = handle_ref_cmd(cmd, (void **)p);
+				if (n < 0) {
+					fprintf(stderr, "unexpected command %x\n",
+						cmd);
+					exit(1);
+				}
+				p += n;
+				break;
+			}
+		}
+	}
+}
+
+static void svcmgr_header(struct parcel *p)
+{
+	memset(p, 0, sizeof(*p));
+	parcel_put_u32(p, 0);	/* strict mode policy */
+	parcel_put_string16(p, SVC_MGR_NAME);
+	parcel_put_string16(p, SVC_NAME);
+}
+
+static void *server_loop(void *unused)
+{
+	uint32_t rbuf[64];
+	uint32_t cmd = BC_ENTER_LOOPER;
+
+	(void)unused;
+	if (binder_write_read(&cmd, sizeof(cmd), NULL, 0, NULL))
+		die("BC_ENTER_LOOPER");
+
+	for (;;) {
+		uint8_t *p, *end;
+		size_t rlen;
+
+		if (binder_write_read(NULL, 0, rbuf, sizeof(rbuf), &rlen))
+			die("server read");
+		p = (uint8_t *)rbuf;
+		end = p + rlen;
+		while (p < end) {
+			struct binder_transaction_data tr;
+			struct {
+				uint32_t free_cmd;
+				const void *buffer;
+				uint32_t reply_cmd;
+				struct binder_transaction_data tr;
+			} __attribute__((packed)) reply;
+			static const uint32_t status;
+			int n;
+
+			memcpy(&cmd, p, sizeof(cmd));
+			p += sizeof(cmd);
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_TRANSACTION_COMPLETE:
+			case BR_SPAWN_LOOPER:
+				break;
+			case BR_TRANSACTION:
+				memcpy(&tr, p, sizeof(tr));
+				p += sizeof(tr);
+				memset(&reply, 0, sizeof(reply));
+				reply.free_cmd = BC_FREE_BUFFER;
+				reply.buffer = tr.data.ptr.buffer;
+				reply.reply_cmd = BC_REPLY;
+				reply.tr.data_size = sizeof(status);
+				reply.tr.data.ptr.buffer = &status;
+				if (tr.flags & TF_ONE_WAY) {
+					/* free only, no reply */
+					n = sizeof(reply.free_cmd) +
+					    sizeof(reply.buffer);
+				} else
+					n = sizeof(reply);
+				if (binder_write_read(&reply, n, NULL, 0, NULL))
+					die("BC_REPLY");
+				break;
+			default:
+				n = handle_ref_cmd(cmd, (void **)p);
+				if (n < 0) {
+					fprintf(stderr, "server: unexpected "
+						"command %x\n", cmd);
+					exit(1);
+				}
+				p += n;
+				break;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void run_server(void)
+{
+	static int bench_object;
+	struct binder_transaction_data reply;
+	struct parcel p;
+	void *free_buf = NULL;
+	pthread_t tid;
+	unsigned int i;
+
+	binder_fd = binder_open_dev();
+
+	svcmgr_header(&p);
+	parcel_put_binder(&p, &bench_object);
+	parcel_put_u32(&p, 1);	/* allow isolated */
+	if (transact(0, SVC_MGR_ADD, p.data, p.len, p.offs, p.noffs,
+		     &free_buf, &reply))
+		die("add service");
+	if (reply.data_size < sizeof(uint32_t) ||
+	    *(const uint32_t *)reply.data.ptr.buffer != 0) {
+		fprintf(stderr, "servicemanager refused " SVC_NAME "\n");
+		exit(1);
+	}
+	{
+		struct {
+			uint32_t cmd;
+			void *ptr;
+		} __attribute__((packed)) fb = { BC_FREE_BUFFER, free_buf };
+
+		if (binder_write_read(&fb, sizeof(fb), NULL, 0, NULL))
+			die("BC_FREE_BUFFER");
+	}
+
+	for (i = 1; i < max_threads; i++) {
+		if (pthread_create(&tid, NULL, server_loop, NULL))
+			die("pthread_create");
+	}
+	server_loop(NULL);
+}
+
+static uint32_t lookup_service(void)
+{
+	struct binder_transaction_data reply;
+	const struct flat_binder_object *obj;
+	struct parcel p;
+	void *free_buf = NULL;
+	int tries;
+
+	for (tries = 0; tries < 50; tries++) {
+		svcmgr_header(&p);
+		if (transact(0, SVC_MGR_CHECK, p.data, p.len, NULL, 0,
+			     &free_buf, &reply))
+			die("check service");
+		obj = reply.data.ptr.buffer;
+		if (reply.offsets_size >= sizeof(size_t) &&
+		    reply.data_size >= sizeof(*obj) &&
+		    obj->type == BINDER_TYPE_HANDLE) {
+			struct {
+				uint32_t inc_cmd;
+				uint32_t inc_handle;
+				uint32_t acq_cmd;
+				uint32_t acq_handle;
+				uint32_t free_cmd;
+				void *free_ptr;
+			} __attribute__((packed)) cmds = {
+				BC_INCREFS, obj->handle,
+				BC_ACQUIRE, obj->handle,
+				BC_FREE_BUFFER, free_buf,
+			};
+
+			/* take our own reference before the reply's goes */
+			if (binder_write_read(&cmds, sizeof(cmds),
+					      NULL, 0, NULL))
+				die("BC_ACQUIRE");
+			return cmds.acq_handle;
+		}
+		usleep(100000);
+	}
+	fprintf(stderr, SVC_NAME " did not show up\n");
+	exit(1);
+}
+
+struct client {
+	pthread_t tid;
+	uint32_t handle;
+	uint64_t *lat;
+	int failed;
+};
+
+static void *client_loop(void *arg)
+{
+	struct client *c = arg;
+	struct binder_transaction_data reply;
+	void *free_buf = NULL;
+	uint8_t *data;
+	unsigned int i;
+
+	data = calloc(1, payload + sizeof(uint32_t));
+	if (!data)
+		die("calloc");
+
+	for (i = 0; i < WARMUP + iterations; i++) {
+		uint64_t start = now_ns();
+
+		if (transact(c->handle, BENCH_CODE, data,
+			     payload + sizeof(uint32_t), NULL, 0,
+			     &free_buf, &reply)) {
+			c->failed = errno;
+			break;
+		}
+		if (i >= WARMUP)
+			c->lat[i - WARMUP] = now_ns() - start;
+	}
+	if (free_buf) {
+		struct {
+			uint32_t cmd;
+			void *ptr;
+		} __attribute__((packed)) fb = { BC_FREE_BUFFER, free_buf };
+
+		binder_write_read(&fb, sizeof(fb), NULL, 0, NULL);
+	}
+	free(data);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int run_round(uint32_t handle, unsigned int nr_threads)
+{
+	struct client *clients;
+	uint64_t *lat, start, elapsed;
+	size_t total = (size_t)nr_threads * iterations;
+	unsigned int i;
+
+	clients = calloc(nr_threads, sizeof(*clients));
+	lat = malloc(total * sizeof(*lat));
+	if (!clients || !lat)
+		die("malloc");
+
+	start = now_ns();
+	for (i = 0; i < nr_threads; i++) {
+		clients[i].handle = handle;
+		clients[i].lat = lat + (size_t)i * iterations;
+		if (pthread_create(&clients[i].tid, NULL, client_loop,
+				   &clients[i]))
+			die("pthread_create");
+	}
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(clients[i].tid, NULL);
+		if (clients[i].failed) {
+			errno = clients[i].failed;
+			perror("transaction");
+			return -1;
+		}
+	}
+	elapsed = now_ns() - start;
+
+	qsort(lat, total, sizeof(*lat), cmp_u64);
+	printf("%7u %10.0f %9.1f %9.1f %9.1f\n", nr_threads,
+	       (double)nr_threads * (WARMUP + iterations) * 1e9 / elapsed,
+	       lat[total / 2] / 1e3, lat[total * 99 / 100] / 1e3,
+	       lat[total - 1] / 1e3);
+
+	free(lat);
+	free(clients);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -t <threads>  highest number of client threads (default %u)\n"
+		"  -n <count>    transactions per thread and round (default %u)\n"
+		"  -s <bytes>    payload per transaction (default %u)\n",
+		prog, max_threads, iterations, payload);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_threads;
+	uint32_t handle;
+	pid_t server;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "t:n:s:")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 's':
+			payload = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!max_threads || !iterations || payload > 64 * 1024)
+		usage(argv[0]);
+
+	server = fork();
+	if (server < 0)
+		die("fork");
+	if (server == 0) {
+		run_server();
+		return 0;
+	}
+
+	binder_fd = binder_open_dev();
+	handle = lookup_service();
+
+	printf("threads       tx/s   p50(us)   p99(us)   max(us)\n");
+	for (nr_threads = 1; nr_threads <= max_threads; nr_threads *= 2) {
+		ret = run_round(handle, nr_threads);
+		if (ret)
+			break;
+	}
+
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+	return ret ? 1 : 0;
+}
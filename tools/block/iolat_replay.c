@@ -0,0 +1,325 @@
+/*
+ * iolat_replay: replay the reads of a block trace and measure their latency
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Meant for comparing I/O scheduler changes on app launches: record the
+ * launch with blktrace and turn the issued requests into text with
+ *
+ *   blkparse -i <trace> -a issue -f "%p %T.%9t %d %S %n\n" > launch.txt
+ *
+ * then replay them on the same device, once per kernel or setting:
+ *
+ *   iolat_replay -d /dev/block/mmcblk0 [-b /data/local/tmp/bg] launch.txt
+ *
+ * Every process of the trace gets a replay thread of its own, so that the
+ * scheduler sees one queue per process as during the launch. Each thread
+ * issues its reads in trace order with O_DIRECT, none earlier than it was
+ * issued in the trace, and waits for each to complete as a process blocked
+ * on a page fault or read() would. Writes in the trace are not replayed.
+ * With -b, a thread keeps writing and fsyncing a file in the background,
+ * the way an app update does, while the reads are replayed. Read latency
+ * percentiles and the time the whole replay took are printed at the end.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#define SECTOR_SIZE	512
+#define ALIGN		4096
+#define BG_CHUNK	(1024 * 1024)
+#define BG_FILE_SIZE	(256ULL * 1024 * 1024)
+#define MAX_REQ_BYTES	(1024 * 1024)
+
+struct req {
+	uint64_t time_ns;	/* issue time relative to the first request */
+	uint64_t sector;
+	unsigned int bytes;
+	uint64_t lat_ns;
+};
+
+struct proc {
+	pthread_t tid;
+	int pid;
+	struct req *reqs;
+	unsigned int nr, alloc;
+	int failed;
+};
+
+static const char *dev_path;
+static const char *bg_path;
+static int dev_fd;
+static uint64_t start_ns;
+static volatile int bg_stop;
+
+static struct proc *procs;
+static unsigned int nr_procs;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct proc *find_proc(int pid)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_procs; i++)
+		if (procs[i].pid == pid)
+			return &procs[i];
+
+	procs = realloc(procs, (nr_procs + 1) * sizeof(*procs));
+	if (!procs)
+		die("realloc");
+	memset(&procs[nr_procs], 0, sizeof(*procs));
+	procs[nr_procs].pid = pid;
+	return &procs[nr_procs++];
+}
+
+static unsigned int load_trace(const char *path)
+{
+	char line[256], rwbs[16];
+	uint64_t first = 0, sector;
+	unsigned long sec, nsec;
+	unsigned int nsect, total = 0;
+	struct proc *p;
+	struct req *r;
+	FILE *f;
+	int pid;
+
+	f = fopen(path, "r");
+	if (!f)
+		die(path);
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%d %lu.%lu %15s %llu %u", &pid, &sec, &nsec,
+			   rwbs, (unsigned long long *)&sector, &nsect) != 6)
+			continue;
+		if (!strchr(rwbs, 'R') || !nsect)
+			continue;
+
+		p = find_proc(pid);
+		if (p->nr == p->alloc) {
+			p->alloc = p->alloc ? p->alloc * 2 : 64;
+			p->reqs = realloc(p->reqs, p->alloc * sizeof(*p->reqs));
+			if (!p->reqs)
+				die("realloc");
+		}
+		r = &p->reqs[p->nr++];
+		r->time_ns = (uint64_t)sec * 1000000000ULL + nsec;
+		if (!total || r->time_ns < first)
+			first = r->time_ns;
+		r->sector = sector;
+		r->bytes = nsect * SECTOR_SIZE;
+		if (r->bytes > MAX_REQ_BYTES)
+			r->bytes = MAX_REQ_BYTES;
+		total++;
+	}
+	fclose(f);
+
+	for (p = procs; p < procs + nr_procs; p++)
+		for (r = p->reqs; r < p->reqs + p->nr; r++)
+			r->time_ns -= first;
+	return total;
+}
+
+static void sleep_until(uint64_t when)
+{
+	struct timespec ts;
+	uint64_t now = now_ns();
+
+	if (now >= when)
+		return;
+	ts.tv_sec = (when - now) / 1000000000ULL;
+	ts.tv_nsec = (when - now) % 1000000000ULL;
+	nanosleep(&ts, NULL);
+}
+
+static void *replay_proc(void *arg)
+{
+	struct proc *p = arg;
+	unsigned int i;
+	void *buf;
+
+	if (posix_memalign(&buf, ALIGN, MAX_REQ_BYTES))
+		die("posix_memalign");
+
+	for (i = 0; i < p->nr; i++) {
+		struct req *r = &p->reqs[i];
+		uint64_t t;
+
+		sleep_until(start_ns + r->time_ns);
+		t = now_ns();
+		if (pread(dev_fd, buf, r->bytes,
+			  (off_t)r->sector * SECTOR_SIZE) < 0) {
+			p->failed = errno;
+			break;
+		}
+		r->lat_ns = now_ns() - t;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void *background_writer(void *arg)
+{
+	uint64_t off = 0;
+	char *buf;
+	int fd;
+
+	(void)arg;
+	buf = malloc(BG_CHUNK);
+	if (!buf)
+		die("malloc");
+	memset(buf, 0x5a, BG_CHUNK);
+
+	fd = open(bg_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		die(bg_path);
+
+	while (!bg_stop) {
+		if (pwrite(fd, buf, BG_CHUNK, off) < 0)
+			die("background write");
+		off += BG_CHUNK;
+		if (off >= BG_FILE_SIZE) {
+			fsync(fd);
+			off = 0;
+		}
+	}
+
+	close(fd);
+	unlink(bg_path);
+	free(buf);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s -d <device> [options] <trace.txt>\n"
+		"  -d <device>  block device to read from\n"
+		"  -b <file>    keep writing <file> in the background\n"
+		"  -w <secs>    let the background writer run first "
+		"(default 2)\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int total, i, j, n = 0;
+	unsigned int warmup = 2;
+	pthread_t bg;
+	uint64_t *lat, elapsed, sum = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:b:w:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev_path = optarg;
+			break;
+		case 'b':
+			bg_path = optarg;
+			break;
+		case 'w':
+			warmup = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!dev_path || optind != argc - 1)
+		usage(argv[0]);
+
+	total = load_trace(argv[optind]);
+	if (!total) {
+		fprintf(stderr, "no reads in %s\n", argv[optind]);
+		return 1;
+	}
+
+	dev_fd = open(dev_path, O_RDONLY | O_DIRECT);
+	if (dev_fd < 0)
+		die(dev_path);
+
+	if (bg_path) {
+		if (pthread_create(&bg, NULL, background_writer, NULL))
+			die("pthread_create");
+		sleep(warmup);
+	}
+
+	start_ns = now_ns();
+	for (i = 0; i < nr_procs; i++)
+		if (pthread_create(&procs[i].tid, NULL, replay_proc,
+				   &procs[i]))
+			die("pthread_create");
+	for (i = 0; i < nr_procs; i++) {
+		pthread_join(procs[i].tid, NULL);
+		if (procs[i].failed) {
+			errno = procs[i].failed;
+			perror("replay read");
+			return 1;
+		}
+	}
+	elapsed = now_ns() - start_ns;
+
+	if (bg_path) {
+		bg_stop = 1;
+		pthread_join(bg, NULL);
+	}
+
+	lat = malloc(total * sizeof(*lat));
+	if (!lat)
+		die("malloc");
+	for (i = 0; i < nr_procs; i++)
+		for (j = 0; j < procs[i].nr; j++) {
+			lat[n] = procs[i].reqs[j].lat_ns;
+			sum += lat[n++];
+		}
+	qsort(lat, n, sizeof(*lat), cmp_u64);
+
+	printf("%u reads from %u processes%s\n", n, nr_procs,
+	       bg_path ? " with background writes" : "");
+	printf("replay took %.1f ms\n", elapsed / 1e6);
+	printf("read latency (us): avg %.1f p50 %.1f p90 %.1f p99 %.1f "
+	       "max %.1f\n", sum / 1e3 / n, lat[n / 2] / 1e3,
+	       lat[n * 9 / 10] / 1e3, lat[n * 99 / 100] / 1e3,
+	       lat[n - 1] / 1e3);
+
+	free(lat);
+	close(dev_fd);
+	return 0;
+}
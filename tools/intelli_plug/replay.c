@@ -0,0 +1,277 @@
+/*
+ * replay: run intelli_plug's hotplug policy over a recorded trace
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * The trace is read from stdin, one "<time_us> <nr_running>" pair per line
+ * giving the total number of runnable threads from that time on, e.g. as
+ * reconstructed from sched_switch/sched_wakeup events. Lines starting with
+ * '#' are ignored. The policy code is the driver's own
+ * (arch/arm/mach-msm/intelli_plug_policy.h); the run-queue average, the
+ * poll timer and the rate-limited event path are simulated around it.
+ *
+ * Every hotplug decision is printed, followed by a summary with the
+ * residency per number of online cores and how long runnable threads
+ * waited for a core to be plugged.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <getopt.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#include "intelli_plug_policy.h"
+
+/* kernel/sched/sched.h */
+#define NR_AVE_PERIOD_EXP	27
+#define NR_AVE_PERIOD		(1LL << NR_AVE_PERIOD_EXP)
+
+static unsigned int sampling_ms = 50;
+static unsigned int event_min_interval_ms = 20;
+static unsigned int event_delay_ms = 10;	/* irq_work runs on the next tick */
+static int event_mode = 1;
+static int quiet;
+
+static struct ip_tunables tun = {
+	.eco_mode = 0,
+	.event_hold_samples = DEF_EVENT_HOLD_SAMPLES,
+};
+static struct ip_state st;
+
+/* simulated state */
+static int64_t now_us;
+static unsigned int nr;
+static int64_t ave;		/* FSHIFT fixed point */
+static unsigned int online = 1;
+
+/* statistics */
+static int64_t online_us[IP_NR_CORES + 1];
+static int64_t starved_us;
+static int64_t starve_start = -1, starve_max;
+static unsigned int starve_events;
+static unsigned int plugs, unplugs, poll_decisions, event_decisions;
+static unsigned int events_fired, events_limited;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] < trace\n"
+		"  -e          eco mode (at most 2 cores)\n"
+		"  -E          disable the event path (poll only)\n"
+		"  -s <ms>     poll period (default %u)\n"
+		"  -i <ms>     minimum interval between events (default %u)\n"
+		"  -d <ms>     event to decision delay (default %u)\n"
+		"  -H <polls>  polls an event plug-up is held (default %u)\n"
+		"  -q          summary only\n",
+		prog, sampling_ms, event_min_interval_ms, event_delay_ms,
+		tun.event_hold_samples);
+	exit(1);
+}
+
+static unsigned int max_cores(void)
+{
+	return tun.eco_mode ? 2 : IP_NR_CORES;
+}
+
+static int starving(void)
+{
+	return nr > online && online < max_cores();
+}
+
+/* Advance time, integrating the average and the statistics */
+static void advance(int64_t t)
+{
+	int64_t delta_ns = (t - now_us) * 1000;
+
+	if (t <= now_us)
+		return;
+
+	if (delta_ns > NR_AVE_PERIOD)
+		ave = (int64_t)nr << FSHIFT;
+	else
+		ave += (delta_ns * (((int64_t)nr << FSHIFT) - ave)) >>
+			NR_AVE_PERIOD_EXP;
+
+	online_us[online] += t - now_us;
+	if (starving())
+		starved_us += t - now_us;
+	now_us = t;
+}
+
+static void update_starve(void)
+{
+	if (starving()) {
+		if (starve_start < 0) {
+			starve_start = now_us;
+			starve_events++;
+		}
+	} else if (starve_start >= 0) {
+		if (now_us - starve_start > starve_max)
+			starve_max = now_us - starve_start;
+		starve_start = -1;
+	}
+}
+
+static void apply(const char *source, unsigned int target)
+{
+	if (target == online)
+		return;
+
+	if (!quiet)
+		printf("%10.3f %-5s nr=%u avg=%u.%02u online %u -> %u\n",
+		       now_us / 1000.0, source, nr,
+		       (unsigned int)(ave >> FSHIFT),
+		       (unsigned int)(((ave & ((1 << FSHIFT) - 1)) * 100)
+				      >> FSHIFT),
+		       online, target);
+
+	if (target > online)
+		plugs += target - online;
+	else
+		unplugs += online - target;
+	online = target;
+	update_starve();
+}
+
+int main(int argc, char **argv)
+{
+	char line[256];
+	int64_t t, next_poll, event_at = -1, event_next = 0, start = -1;
+	unsigned int n, c;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "eEs:i:d:H:q")) != -1) {
+		switch (opt) {
+		case 'e':
+			tun.eco_mode = 1;
+			break;
+		case 'E':
+			event_mode = 0;
+			break;
+		case 's':
+			sampling_ms = atoi(optarg);
+			break;
+		case 'i':
+			event_min_interval_ms = atoi(optarg);
+			break;
+		case 'd':
+			event_delay_ms = atoi(optarg);
+			break;
+		case 'H':
+			tun.event_hold_samples = atoi(optarg);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!sampling_ms)
+		usage(argv[0]);
+
+	next_poll = 0;
+	for (;;) {
+		int have = 0;
+
+		while (fgets(line, sizeof(line), stdin)) {
+			long long tt;
+
+			if (line[0] == '#' || line[0] == '\n')
+				continue;
+			if (sscanf(line, "%lld %u", &tt, &n) != 2) {
+				fprintf(stderr, "bad line: %s", line);
+				return 1;
+			}
+			t = tt;
+			have = 1;
+			break;
+		}
+		if (!have)
+			break;
+
+		if (start < 0) {
+			start = now_us = t;
+			next_poll = t + sampling_ms * 1000LL;
+		}
+		if (t < now_us) {
+			fprintf(stderr, "trace goes back in time at %lld\n",
+				(long long)t);
+			return 1;
+		}
+
+		/* Timers that expire before this sample */
+		for (;;) {
+			int64_t next = next_poll;
+
+			if (event_at >= 0 && event_at < next)
+				next = event_at;
+			if (next > t)
+				break;
+
+			advance(next);
+			if (next == event_at) {
+				event_at = -1;
+				event_decisions++;
+				apply("event", ip_event_target(&st, &tun, nr,
+							       online));
+			} else {
+				next_poll += sampling_ms * 1000LL;
+				poll_decisions++;
+				apply("poll", ip_poll_target(&st, &tun,
+					(unsigned int)ave, online));
+			}
+		}
+
+		advance(t);
+		nr = n;
+		update_starve();
+
+		/* The scheduler hook fires when a task queues behind another */
+		if (event_mode && starving() && event_at < 0) {
+			if (now_us < event_next) {
+				events_limited++;
+			} else {
+				events_fired++;
+				event_next = now_us +
+					event_min_interval_ms * 1000LL;
+				event_at = now_us + event_delay_ms * 1000LL;
+			}
+		}
+	}
+
+	if (start < 0) {
+		fprintf(stderr, "empty trace\n");
+		return 1;
+	}
+	update_starve();
+	if (starve_start >= 0 && now_us - starve_start > starve_max)
+		starve_max = now_us - starve_start;
+
+	printf("\nduration:        %.3f ms\n", (now_us - start) / 1000.0);
+	for (c = 1; c <= IP_NR_CORES; c++)
+		printf("%u online:        %.3f ms (%.1f%%)\n", c,
+		       online_us[c] / 1000.0,
+		       now_us > start ?
+		       online_us[c] * 100.0 / (now_us - start) : 0.0);
+	printf("plugs/unplugs:   %u/%u\n", plugs, unplugs);
+	printf("decisions:       %u poll, %u event\n", poll_decisions,
+	       event_decisions);
+	printf("events:          %u fired, %u rate limited\n", events_fired,
+	       events_limited);
+	printf("starved:         %.3f ms in %u episodes, longest %.3f ms\n",
+	       starved_us / 1000.0, starve_events, starve_max / 1000.0);
+
+	return 0;
+}
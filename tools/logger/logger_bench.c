@@ -0,0 +1,257 @@
+/*
+ * logger_bench: logger write throughput under contention
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * For 1, 2, 4, ... up to -t threads, each thread pinned to its own CPU
+ * where there are enough of them, every thread writes -n entries of -s
+ * bytes to a log the same way liblog does: a single writev() of priority,
+ * tag and message. For each thread count the aggregate write rate, the rate
+ * per thread and the write latency percentiles are printed. A reader may
+ * be left running on the log (-r) to include the cost of waking it up.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include "logger.h"
+
+#define TAG		"logger_bench"
+#define PRIO_DEBUG	3
+#define WARMUP		100
+
+static const char *log_path = "/dev/log/main";
+static unsigned int max_threads = 8;
+static unsigned int iterations = 100000;
+static unsigned int payload = 64;
+static int with_reader;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct writer {
+	pthread_t tid;
+	unsigned int cpu;
+	uint64_t *lat;
+	int failed;
+};
+
+static void *writer_loop(void *arg)
+{
+	struct writer *w = arg;
+	unsigned char prio = PRIO_DEBUG;
+	struct iovec vec[3];
+	char *msg;
+	unsigned int i;
+	cpu_set_t set;
+	int fd;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+
+	fd = open(log_path, O_WRONLY);
+	if (fd < 0) {
+		w->failed = errno;
+		return NULL;
+	}
+
+	msg = malloc(payload);
+	if (!msg)
+		die("malloc");
+	memset(msg, 'x', payload - 1);
+	msg[payload - 1] = '\0';
+
+	vec[0].iov_base = &prio;
+	vec[0].iov_len = 1;
+	vec[1].iov_base = TAG;
+	vec[1].iov_len = sizeof(TAG);
+	vec[2].iov_base = msg;
+	vec[2].iov_len = payload;
+
+	for (i = 0; i < WARMUP + iterations; i++) {
+		uint64_t start = now_ns();
+
+		if (writev(fd, vec, 3) < 0) {
+			w->failed = errno;
+			break;
+		}
+		if (i >= WARMUP)
+			w->lat[i - WARMUP] = now_ns() - start;
+	}
+
+	free(msg);
+	close(fd);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int run_round(unsigned int nr_threads, unsigned int nr_cpus)
+{
+	struct writer *writers;
+	uint64_t *lat, start, elapsed;
+	size_t total = (size_t)nr_threads * iterations;
+	double rate;
+	unsigned int i;
+
+	writers = calloc(nr_threads, sizeof(*writers));
+	lat = malloc(total * sizeof(*lat));
+	if (!writers || !lat)
+		die("malloc");
+
+	start = now_ns();
+	for (i = 0; i < nr_threads; i++) {
+		writers[i].cpu = i % nr_cpus;
+		writers[i].lat = lat + (size_t)i * iterations;
+		if (pthread_create(&writers[i].tid, NULL, writer_loop,
+				   &writers[i]))
+			die("pthread_create");
+	}
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(writers[i].tid, NULL);
+		if (writers[i].failed) {
+			errno = writers[i].failed;
+			perror(log_path);
+			return -1;
+		}
+	}
+	elapsed = now_ns() - start;
+
+	rate = (double)nr_threads * (WARMUP + iterations) * 1e9 / elapsed;
+	qsort(lat, total, sizeof(*lat), cmp_u64);
+	printf("%7u %10.0f %10.0f %9.1f %9.1f %9.1f\n", nr_threads, rate,
+	       rate / nr_threads, lat[total / 2] / 1e3,
+	       lat[total * 99 / 100] / 1e3, lat[total - 1] / 1e3);
+
+	free(lat);
+	free(writers);
+	return 0;
+}
+
+/* drains the log like logcat would, so that writers have to wake it */
+static void run_reader(void)
+{
+	char buf[sizeof(struct logger_entry) + LOGGER_ENTRY_MAX_PAYLOAD];
+	int fd;
+
+	fd = open(log_path, O_RDONLY);
+	if (fd < 0)
+		die(log_path);
+	for (;;) {
+		if (read(fd, buf, sizeof(buf)) < 0 && errno != EINTR)
+			die("read");
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -l <path>     log to write to (default %s)\n"
+		"  -t <threads>  highest number of writer threads (default %u)\n"
+		"  -n <count>    writes per thread and round (default %u)\n"
+		"  -s <bytes>    message size per write (default %u)\n"
+		"  -r            keep a reader blocked on the log\n",
+		prog, log_path, max_threads, iterations, payload);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_threads;
+	long nr_cpus;
+	pid_t reader = 0;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "l:t:n:s:r")) != -1) {
+		switch (opt) {
+		case 'l':
+			log_path = optarg;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 's':
+			payload = atoi(optarg);
+			break;
+		case 'r':
+			with_reader = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!max_threads || !iterations || !payload ||
+	    payload + sizeof(TAG) + 1 > LOGGER_ENTRY_MAX_PAYLOAD)
+		usage(argv[0]);
+
+	nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_cpus < 1)
+		nr_cpus = 1;
+
+	if (with_reader) {
+		reader = fork();
+		if (reader < 0)
+			die("fork");
+		if (reader == 0) {
+			run_reader();
+			return 0;
+		}
+	}
+
+	printf("%ld cpus, %u byte messages to %s%s\n", nr_cpus, payload,
+	       log_path, with_reader ? " with a reader" : "");
+	printf("threads   writes/s  per thread   p50(us)   p99(us)   max(us)\n");
+	for (nr_threads = 1; nr_threads <= max_threads; nr_threads *= 2) {
+		ret = run_round(nr_threads, nr_cpus);
+		if (ret)
+			break;
+	}
+
+	if (reader) {
+		kill(reader, SIGTERM);
+		waitpid(reader, NULL, 0);
+	}
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,75 @@
+#!/bin/bash
+#
+# MTP file transfer benchmark, run on the host.
+#
+# The device's MTP storage must be mounted on the host through a FUSE MTP
+# filesystem (jmtpfs, simple-mtpfs, go-mtpfs ...) and adb must have root
+# on the device, to read the f_mtp transfer statistics.
+#
+# usage: mtp-bench.sh MOUNTPOINT [LARGE_MB [SMALL_COUNT [SMALL_KB]]]
+#
+# Copies one large file and many small files to the device (MTP receive)
+# and back (MTP send), and reports for each case the MB/s seen by the host
+# and the MB/s and CPU% of the device side transfer work.
+#
+
+MNT=$1
+LARGE_MB=${2:-1024}
+SMALL_COUNT=${3:-500}
+SMALL_KB=${4:-64}
+
+STATS=/sys/class/android_usb/android0/f_mtp/mtp_perf_stats
+
+if [ "$MNT" = "" ] || [ ! -d "$MNT" ]; then
+	echo "usage: $0 MOUNTPOINT [LARGE_MB [SMALL_COUNT [SMALL_KB]]]" 1>&2
+	exit 1
+fi
+
+DIR=$MNT/mtp-bench.$$
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP" "$DIR"' EXIT
+
+mkdir -p "$TMP/out/small" "$TMP/in" "$DIR" || exit 1
+
+echo "creating $LARGE_MB MB file and $SMALL_COUNT x $SMALL_KB KB files"
+dd if=/dev/urandom of="$TMP/out/large" bs=1M count=$LARGE_MB 2>/dev/null
+for i in $(seq $SMALL_COUNT); do
+	dd if=/dev/urandom of="$TMP/out/small/$i" bs=1K count=$SMALL_KB \
+		2>/dev/null
+done
+
+now_ms()
+{
+	echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# run CMD..., print host throughput for BYTES and the device statistics
+run()
+{
+	local name=$1 bytes=$2 start end ms
+	shift 2
+
+	sync
+	adb shell "echo 0 > $STATS" > /dev/null
+	start=$(now_ms)
+	"$@" || { echo "$name: failed" 1>&2; return 1; }
+	sync
+	end=$(now_ms)
+	ms=$(( end - start ))
+	[ $ms -gt 0 ] || ms=1
+
+	echo "$name: $(( bytes / 1000 / ms )).$(( bytes / 10 / ms % 100 )) MB/s (host, $ms ms)"
+	adb shell cat $STATS | tr -d '\r' | sed 's/^/    device /'
+}
+
+LARGE_BYTES=$(( LARGE_MB * 1024 * 1024 ))
+SMALL_BYTES=$(( SMALL_COUNT * SMALL_KB * 1024 ))
+
+run "large to device" $LARGE_BYTES cp "$TMP/out/large" "$DIR/large"
+run "large from device" $LARGE_BYTES cp "$DIR/large" "$TMP/in/large"
+cmp -s "$TMP/out/large" "$TMP/in/large" || echo "large: data mismatch" 1>&2
+
+run "small to device" $SMALL_BYTES cp -r "$TMP/out/small" "$DIR/small"
+run "small from device" $SMALL_BYTES cp -r "$DIR/small" "$TMP/in/small"
+diff -rq "$TMP/out/small" "$TMP/in/small" > /dev/null ||
+	echo "small: data mismatch" 1>&2